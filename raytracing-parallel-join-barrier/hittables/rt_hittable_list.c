@@ -6,6 +6,8 @@
  */
 
 #include <assert.h>
+#include <string.h>
+#include "rt_arena.h"
 #include "rt_hittable_list.h"
 
 struct rt_hittable_list_s
@@ -13,16 +15,20 @@ struct rt_hittable_list_s
     rt_hittable_t **hittables;
     size_t size;
     size_t capacity;
+
+    // Arena the list and its array live in, NULL for lists on the heap
+    rt_arena_t *arena;
 };
 
+static rt_hittable_t **list_alloc_array(const rt_hittable_list_t *list, size_t capacity);
+
 rt_hittable_list_t *rt_hittable_list_init(size_t capacity)
 {
-    rt_hittable_list_t *list = calloc(1, sizeof(rt_hittable_list_t));
+    rt_hittable_list_t *list = rt_arena_calloc(sizeof(rt_hittable_list_t));
     assert(NULL != list);
 
-    list->hittables = calloc(capacity, sizeof(rt_hittable_t *));
-    assert(NULL != list->hittables);
-
+    list->arena = rt_arena_get_current();
+    list->hittables = list_alloc_array(list, capacity);
     list->capacity = capacity;
     list->size = 0;
 
@@ -33,10 +39,20 @@ void rt_hittable_list_add(rt_hittable_list_t *list, rt_hittable_t *hittable)
 {
     assert(NULL != list);
 
-    if (list->size > list->capacity)
+    if (list->size >= list->capacity)
     {
-        list->hittables = realloc(list->hittables, list->capacity * 2 * sizeof(rt_hittable_t *));
-        assert(NULL != list->hittables);
+        if (NULL == list->arena)
+        {
+            list->hittables = realloc(list->hittables, list->capacity * 2 * sizeof(rt_hittable_t *));
+            assert(NULL != list->hittables);
+        }
+        else
+        {
+            // The old array stays in the arena, growing by doubling wastes less than the final array takes
+            rt_hittable_t **hittables = list_alloc_array(list, list->capacity * 2);
+            memcpy(hittables, list->hittables, list->size * sizeof(rt_hittable_t *));
+            list->hittables = hittables;
+        }
         list->capacity = list->capacity * 2;
     }
     list->hittables[list->size++] = hittable;
@@ -58,6 +74,10 @@ void rt_hittable_list_deinit(rt_hittable_list_t *list)
     assert(NULL != list);
 
     rt_hittable_list_clear(list);
+    if (NULL != list->arena)
+    {
+        return;
+    }
 
     free(list->hittables);
     list->capacity = 0;
@@ -96,6 +116,37 @@ bool rt_hittable_list_hit_test(const rt_hittable_list_t *list, const ray_t *ray,
     return hit_occurred;
 }
 
+unsigned rt_hittable_list_hit_packet(const rt_hittable_list_t *list, rt_ray_packet_t *packet, unsigned mask,
+                                     double t_min, double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != list);
+    assert(NULL != packet);
+
+    unsigned result = 0;
+    for (size_t i = 0; i < list->size; ++i)
+    {
+        result |= rt_hittable_hit_packet(list->hittables[i], packet, mask, t_min, t_max, records);
+    }
+
+    return result;
+}
+
+bool rt_hittable_list_occluded(const rt_hittable_list_t *list, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != list);
+    assert(NULL != ray);
+
+    for (size_t i = 0; i < list->size; ++i)
+    {
+        if (rt_hittable_occluded(list->hittables[i], ray, t_min, t_max))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool rt_hittable_list_bb(const rt_hittable_list_t *list, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != list);
@@ -135,9 +186,64 @@ size_t rt_hittable_list_get_size(const rt_hittable_list_t *list)
     return list->size;
 }
 
+rt_hittable_list_t *rt_hittable_list_collect_lights(const rt_hittable_list_t *list)
+{
+    assert(NULL != list);
+
+    rt_hittable_list_t *lights = rt_hittable_list_init(1);
+    for (size_t i = 0; i < list->size; ++i)
+    {
+        rt_hittable_collect_lights(list->hittables[i], lights);
+    }
+
+    return lights;
+}
+
+vec3_t rt_hittable_list_random(const rt_hittable_list_t *list, const point3_t *origin)
+{
+    assert(NULL != list);
+    assert(list->size > 0);
+
+    size_t index = (size_t)rt_random_double(0, (double)list->size);
+    if (index >= list->size)
+    {
+        index = list->size - 1;
+    }
+    return rt_hittable_random(list->hittables[index], origin);
+}
+
+double rt_hittable_list_pdf_value(const rt_hittable_list_t *list, const point3_t *origin, const vec3_t *direction)
+{
+    assert(NULL != list);
+
+    if (0 == list->size)
+    {
+        return 0.0;
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < list->size; ++i)
+    {
+        sum += rt_hittable_pdf_value(list->hittables[i], origin, direction);
+    }
+    return sum / (double)list->size;
+}
+
 rt_hittable_t **rt_hittable_list_get_underlying_container(const rt_hittable_list_t *list)
 {
     assert(NULL != list);
 
     return list->hittables;
 }
+
+static rt_hittable_t **list_alloc_array(const rt_hittable_list_t *list, size_t capacity)
+{
+    if (NULL != list->arena)
+    {
+        return rt_arena_alloc(list->arena, capacity * sizeof(rt_hittable_t *), _Alignof(rt_hittable_t *));
+    }
+
+    rt_hittable_t **result = calloc(capacity, sizeof(rt_hittable_t *));
+    assert(NULL != result);
+    return result;
+}
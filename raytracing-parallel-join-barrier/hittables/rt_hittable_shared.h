@@ -9,6 +9,7 @@
 #define RAY_TRACING_ONE_WEEK_RT_HITTABLE_SHARED_H
 
 #include <stdbool.h>
+#include <rt_arena.h>
 #include <rt_material.h>
 #include "rt_hittable.h"
 
@@ -22,15 +23,28 @@ typedef enum rt_hittable_type_e
     RT_HITTABLE_TYPE_BOX,
     RT_HITTABLE_TYPE_INSTANCE,
     RT_HITTABLE_CONSTANT_MEDIUM,
+    RT_HITTABLE_TYPE_MESH,
 } rt_hittable_type_t;
 
 typedef bool (*rt_hittable_hit_fn)(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                                    rt_hit_record_t *record);
 
+typedef bool (*rt_hittable_occluded_fn)(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+
+typedef unsigned (*rt_hittable_hit_packet_fn)(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                              double t_min, double *t_max, rt_hit_record_t *records);
+
 typedef bool (*rt_hittable_bb_fn)(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 
 typedef void (*rt_hittable_delete_fn)(rt_hittable_t *hittable);
 
+typedef vec3_t (*rt_hittable_random_fn)(const rt_hittable_t *hittable, const point3_t *origin);
+
+typedef double (*rt_hittable_pdf_value_fn)(const rt_hittable_t *hittable, const point3_t *origin,
+                                           const vec3_t *direction);
+
+typedef void (*rt_hittable_collect_lights_fn)(rt_hittable_t *hittable, rt_hittable_list_t *lights);
+
 struct rt_hittable_s
 {
     rt_hittable_type_t type;
@@ -39,11 +53,25 @@ struct rt_hittable_s
     rt_hittable_hit_fn hit;
     rt_hittable_bb_fn bb;
     rt_hittable_delete_fn delete;
+
+    // Any-hit query, falls back to hit() when a hittable doesn't provide a cheaper one
+    rt_hittable_occluded_fn occluded;
+    // Packet query, falls back to calling hit() for every lane
+    rt_hittable_hit_packet_fn hit_packet;
+
+    // Light sampling, only set by the hittables that may be used as lights and by containers of other hittables
+    rt_hittable_random_fn random;
+    rt_hittable_pdf_value_fn pdf_value;
+    rt_hittable_collect_lights_fn collect_lights;
 };
 
 void rt_hittable_init(rt_hittable_t *hittable, rt_hittable_type_t type, rt_hittable_hit_fn hit_fn,
                       rt_hittable_bb_fn bb_fn, rt_hittable_delete_fn delete_fn);
 
+void rt_hittable_init_light_sampling(rt_hittable_t *hittable, rt_hittable_random_fn random_fn,
+                                     rt_hittable_pdf_value_fn pdf_value_fn,
+                                     rt_hittable_collect_lights_fn collect_lights_fn);
+
 bool rt_sphere_hit_test_generic(point3_t center, double radius, rt_material_t *material, const ray_t *ray, double t_min,
                                 double t_max, rt_hit_record_t *record);
 
@@ -0,0 +1,462 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rt_mesh_shared.h"
+
+// A growing array of plain values, elements are appended one by one while the file is being read
+typedef struct obj_array_s
+{
+    void *data;
+    size_t size;
+    size_t capacity;
+    size_t element_size;
+} obj_array_t;
+
+// OBJ faces index positions, texture coordinates and normals separately, while a mesh has one index per vertex. Every
+// distinct (position, texture coordinate, normal) triple becomes a mesh vertex, the table maps triples to them.
+typedef struct obj_corner_s
+{
+    long position;
+    long texture_coordinate;
+    long normal;
+} obj_corner_t;
+
+typedef struct obj_vertex_table_s
+{
+    obj_corner_t *corners;
+    uint32_t *vertices;
+    size_t capacity;
+    size_t size;
+} obj_vertex_table_t;
+
+typedef struct obj_loader_s
+{
+    const char *file_name;
+    size_t line_number;
+
+    obj_array_t positions;           // 3 doubles per position
+    obj_array_t texture_coordinates; // 2 doubles per texture coordinate
+    obj_array_t normals;             // 3 doubles per normal
+
+    obj_vertex_table_t table;
+    obj_array_t corners;  // obj_corner_t of every mesh vertex, in order
+    obj_array_t indices;  // uint32_t, 3 per triangle
+    obj_array_t polygon;  // uint32_t mesh vertices of the face being read
+} obj_loader_t;
+
+static void obj_array_init(obj_array_t *array, size_t element_size);
+static void *obj_array_push(obj_array_t *array);
+static void obj_array_free(obj_array_t *array);
+
+static bool obj_read_line(FILE *file, char **line, size_t *capacity);
+static bool obj_parse_doubles(obj_loader_t *loader, const char *text, double *out, int count);
+static bool obj_parse_face(obj_loader_t *loader, char *text);
+static bool obj_parse_corner(obj_loader_t *loader, const char *token, obj_corner_t *out_corner);
+static bool obj_resolve_index(obj_loader_t *loader, long index, size_t count, long *out_index);
+static uint32_t obj_find_vertex(obj_loader_t *loader, const obj_corner_t *corner);
+static rt_hittable_t *obj_build_mesh(obj_loader_t *loader, rt_material_t *material);
+static void obj_loader_free(obj_loader_t *loader);
+
+rt_hittable_t *rt_mesh_load_obj(const char *file_name, rt_material_t *material)
+{
+    assert(NULL != file_name);
+
+    // An up to date cache makes parsing the file and building the BVH unnecessary
+    rt_mesh_source_t source;
+    bool use_cache = rt_mesh_cache_get_source(file_name, &source);
+    if (use_cache)
+    {
+        rt_hittable_t *cached = rt_mesh_cache_find(&source, material);
+        if (NULL != cached)
+        {
+            return cached;
+        }
+    }
+
+    FILE *file = fopen(file_name, "r");
+    if (NULL == file)
+    {
+        fprintf(stderr, "Failed to open OBJ file %s: %s\n", file_name, strerror(errno));
+        rt_material_delete(material);
+        return NULL;
+    }
+
+    obj_loader_t loader = {.file_name = file_name};
+    obj_array_init(&loader.positions, 3 * sizeof(double));
+    obj_array_init(&loader.texture_coordinates, 2 * sizeof(double));
+    obj_array_init(&loader.normals, 3 * sizeof(double));
+    obj_array_init(&loader.corners, sizeof(obj_corner_t));
+    obj_array_init(&loader.indices, 3 * sizeof(uint32_t));
+    obj_array_init(&loader.polygon, sizeof(uint32_t));
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    bool ok = true;
+    while (ok && obj_read_line(file, &line, &line_capacity))
+    {
+        loader.line_number++;
+
+        char *text = line;
+        while (isspace((unsigned char)*text))
+        {
+            text++;
+        }
+
+        if (0 == strncmp(text, "v ", 2) || 0 == strncmp(text, "v\t", 2))
+        {
+            ok = obj_parse_doubles(&loader, text + 2, obj_array_push(&loader.positions), 3);
+        }
+        else if (0 == strncmp(text, "vt ", 3) || 0 == strncmp(text, "vt\t", 3))
+        {
+            // The optional third coordinate of 3D textures is ignored
+            ok = obj_parse_doubles(&loader, text + 3, obj_array_push(&loader.texture_coordinates), 2);
+        }
+        else if (0 == strncmp(text, "vn ", 3) || 0 == strncmp(text, "vn\t", 3))
+        {
+            ok = obj_parse_doubles(&loader, text + 3, obj_array_push(&loader.normals), 3);
+        }
+        else if (0 == strncmp(text, "f ", 2) || 0 == strncmp(text, "f\t", 2))
+        {
+            ok = obj_parse_face(&loader, text + 2);
+        }
+    }
+    if (ok && ferror(file))
+    {
+        fprintf(stderr, "Failed to read OBJ file %s: %s\n", file_name, strerror(errno));
+        ok = false;
+    }
+    free(line);
+    fclose(file);
+
+    if (ok && 0 == loader.indices.size)
+    {
+        fprintf(stderr, "OBJ file %s has no faces\n", file_name);
+        ok = false;
+    }
+
+    rt_hittable_t *result = NULL;
+    if (ok)
+    {
+        result = obj_build_mesh(&loader, material);
+        if (use_cache)
+        {
+            rt_mesh_cache_store(result, &source);
+        }
+    }
+    else
+    {
+        rt_material_delete(material);
+    }
+    obj_loader_free(&loader);
+    return result;
+}
+
+static void obj_array_init(obj_array_t *array, size_t element_size)
+{
+    *array = (obj_array_t){.element_size = element_size};
+}
+
+static void *obj_array_push(obj_array_t *array)
+{
+    if (array->size == array->capacity)
+    {
+        size_t capacity = 0 == array->capacity ? 256 : 2 * array->capacity;
+        void *data = realloc(array->data, capacity * array->element_size);
+        assert(NULL != data);
+
+        array->data = data;
+        array->capacity = capacity;
+    }
+    return (unsigned char *)array->data + array->element_size * array->size++;
+}
+
+static void obj_array_free(obj_array_t *array)
+{
+    free(array->data);
+    *array = (obj_array_t){0};
+}
+
+// Reads a whole line however long it is, without the line break. Returns false at the end of the file.
+static bool obj_read_line(FILE *file, char **line, size_t *capacity)
+{
+    size_t length = 0;
+    for (;;)
+    {
+        if (*capacity - length < 2)
+        {
+            size_t new_capacity = 0 == *capacity ? 256 : 2 * *capacity;
+            char *new_line = realloc(*line, new_capacity);
+            assert(NULL != new_line);
+
+            *line = new_line;
+            *capacity = new_capacity;
+        }
+
+        if (NULL == fgets(*line + length, (int)(*capacity - length), file))
+        {
+            (*line)[length] = '\0';
+            return length > 0;
+        }
+        length += strlen(*line + length);
+        if (length > 0 && '\n' == (*line)[length - 1])
+        {
+            (*line)[--length] = '\0';
+            if (length > 0 && '\r' == (*line)[length - 1])
+            {
+                (*line)[--length] = '\0';
+            }
+            return true;
+        }
+    }
+}
+
+static bool obj_parse_doubles(obj_loader_t *loader, const char *text, double *out, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        char *end;
+        out[i] = strtod(text, &end);
+        if (end == text)
+        {
+            fprintf(stderr, "%s:%zu: expected %d numbers\n", loader->file_name, loader->line_number, count);
+            return false;
+        }
+        text = end;
+    }
+    return true;
+}
+
+// Polygons are split into fans around their first vertex, which is exact for the convex ones OBJ exporters write
+static bool obj_parse_face(obj_loader_t *loader, char *text)
+{
+    loader->polygon.size = 0;
+
+    char *save = NULL;
+    for (char *token = strtok_r(text, " \t", &save); NULL != token; token = strtok_r(NULL, " \t", &save))
+    {
+        obj_corner_t corner;
+        if (!obj_parse_corner(loader, token, &corner))
+        {
+            return false;
+        }
+        *(uint32_t *)obj_array_push(&loader->polygon) = obj_find_vertex(loader, &corner);
+    }
+
+    if (loader->polygon.size < 3)
+    {
+        fprintf(stderr, "%s:%zu: a face needs at least 3 vertices\n", loader->file_name, loader->line_number);
+        return false;
+    }
+
+    const uint32_t *polygon = loader->polygon.data;
+    for (size_t i = 1; i + 1 < loader->polygon.size; ++i)
+    {
+        uint32_t *triangle = obj_array_push(&loader->indices);
+        triangle[0] = polygon[0];
+        triangle[1] = polygon[i];
+        triangle[2] = polygon[i + 1];
+    }
+    return true;
+}
+
+// A face corner is "v", "v/vt", "v//vn" or "v/vt/vn", missing attributes are -1
+static bool obj_parse_corner(obj_loader_t *loader, const char *token, obj_corner_t *out_corner)
+{
+    long values[3] = {0, 0, 0};
+    const char *text = token;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (i > 0)
+        {
+            if ('/' != *text)
+            {
+                break;
+            }
+            text++;
+        }
+        if (i > 0 && ('/' == *text || '\0' == *text))
+        {
+            continue;
+        }
+
+        char *end;
+        values[i] = strtol(text, &end, 10);
+        if (end == text || 0 == values[i])
+        {
+            fprintf(stderr, "%s:%zu: invalid face vertex '%s'\n", loader->file_name, loader->line_number, token);
+            return false;
+        }
+        text = end;
+    }
+    if ('\0' != *text)
+    {
+        fprintf(stderr, "%s:%zu: invalid face vertex '%s'\n", loader->file_name, loader->line_number, token);
+        return false;
+    }
+
+    out_corner->texture_coordinate = -1;
+    out_corner->normal = -1;
+    return obj_resolve_index(loader, values[0], loader->positions.size, &out_corner->position) &&
+           (0 == values[1] ||
+            obj_resolve_index(loader, values[1], loader->texture_coordinates.size, &out_corner->texture_coordinate)) &&
+           (0 == values[2] || obj_resolve_index(loader, values[2], loader->normals.size, &out_corner->normal));
+}
+
+// OBJ indices start at 1, negative ones count back from the last element read so far
+static bool obj_resolve_index(obj_loader_t *loader, long index, size_t count, long *out_index)
+{
+    long resolved = index > 0 ? index - 1 : (long)count + index;
+    if (resolved < 0 || resolved >= (long)count)
+    {
+        fprintf(stderr, "%s:%zu: index %ld is out of range\n", loader->file_name, loader->line_number, index);
+        return false;
+    }
+    *out_index = resolved;
+    return true;
+}
+
+static size_t obj_hash_corner(const obj_corner_t *corner)
+{
+    size_t hash = (size_t)corner->position * 73856093u;
+    hash ^= (size_t)(corner->texture_coordinate + 1) * 19349663u;
+    hash ^= (size_t)(corner->normal + 1) * 83492791u;
+    return hash;
+}
+
+// Open addressing with linear probing, the table is kept at most half full
+static uint32_t obj_find_vertex(obj_loader_t *loader, const obj_corner_t *corner)
+{
+    obj_vertex_table_t *table = &loader->table;
+    if (2 * (table->size + 1) > table->capacity)
+    {
+        size_t capacity = 0 == table->capacity ? 1024 : 2 * table->capacity;
+        obj_corner_t *corners = malloc(capacity * sizeof(obj_corner_t));
+        uint32_t *vertices = malloc(capacity * sizeof(uint32_t));
+        assert(NULL != corners && NULL != vertices);
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            corners[i].position = -1;
+        }
+
+        for (size_t i = 0; i < table->capacity; ++i)
+        {
+            if (table->corners[i].position < 0)
+            {
+                continue;
+            }
+            size_t slot = obj_hash_corner(&table->corners[i]) & (capacity - 1);
+            while (corners[slot].position >= 0)
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            corners[slot] = table->corners[i];
+            vertices[slot] = table->vertices[i];
+        }
+
+        free(table->corners);
+        free(table->vertices);
+        table->corners = corners;
+        table->vertices = vertices;
+        table->capacity = capacity;
+    }
+
+    size_t slot = obj_hash_corner(corner) & (table->capacity - 1);
+    while (table->corners[slot].position >= 0)
+    {
+        const obj_corner_t *existing = &table->corners[slot];
+        if (existing->position == corner->position && existing->texture_coordinate == corner->texture_coordinate &&
+            existing->normal == corner->normal)
+        {
+            return table->vertices[slot];
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    assert(loader->corners.size < UINT32_MAX);
+    uint32_t vertex = (uint32_t)loader->corners.size;
+    *(obj_corner_t *)obj_array_push(&loader->corners) = *corner;
+    table->corners[slot] = *corner;
+    table->vertices[slot] = vertex;
+    table->size++;
+    return vertex;
+}
+
+static rt_hittable_t *obj_build_mesh(obj_loader_t *loader, rt_material_t *material)
+{
+    size_t number_of_vertices = loader->corners.size;
+    const obj_corner_t *corners = loader->corners.data;
+
+    // Attributes only some vertices have are dropped, the mesh has them for all vertices or for none
+    bool has_texture_coordinates = true, has_normals = true;
+    for (size_t i = 0; i < number_of_vertices; ++i)
+    {
+        has_texture_coordinates = has_texture_coordinates && corners[i].texture_coordinate >= 0;
+        has_normals = has_normals && corners[i].normal >= 0;
+    }
+
+    int number_of_arrays = 3 + (has_normals ? 3 : 0) + (has_texture_coordinates ? 2 : 0);
+    rt_real_t *attributes = calloc(number_of_arrays * number_of_vertices, sizeof(rt_real_t));
+    assert(NULL != attributes);
+
+    rt_mesh_data_t data = {.number_of_vertices = number_of_vertices,
+                           .number_of_triangles = loader->indices.size,
+                           .indices = loader->indices.data};
+    rt_real_t *positions[3], *normals[3], *texture_coordinates[2];
+    rt_real_t *next = attributes;
+    for (int axis = 0; axis < 3; ++axis, next += number_of_vertices)
+    {
+        data.positions[axis] = positions[axis] = next;
+    }
+    for (int axis = 0; has_normals && axis < 3; ++axis, next += number_of_vertices)
+    {
+        data.normals[axis] = normals[axis] = next;
+    }
+    for (int i = 0; has_texture_coordinates && i < 2; ++i, next += number_of_vertices)
+    {
+        data.texture_coordinates[i] = texture_coordinates[i] = next;
+    }
+
+    const double *position_values = loader->positions.data;
+    const double *normal_values = loader->normals.data;
+    const double *texture_coordinate_values = loader->texture_coordinates.data;
+    for (size_t i = 0; i < number_of_vertices; ++i)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            positions[axis][i] = (rt_real_t)position_values[3 * corners[i].position + axis];
+            if (has_normals)
+            {
+                normals[axis][i] = (rt_real_t)normal_values[3 * corners[i].normal + axis];
+            }
+        }
+        for (int j = 0; has_texture_coordinates && j < 2; ++j)
+        {
+            texture_coordinates[j][i] = (rt_real_t)texture_coordinate_values[2 * corners[i].texture_coordinate + j];
+        }
+    }
+
+    rt_hittable_t *result = rt_mesh_new(&data, material);
+    free(attributes);
+    return result;
+}
+
+static void obj_loader_free(obj_loader_t *loader)
+{
+    obj_array_free(&loader->positions);
+    obj_array_free(&loader->texture_coordinates);
+    obj_array_free(&loader->normals);
+    obj_array_free(&loader->corners);
+    obj_array_free(&loader->indices);
+    obj_array_free(&loader->polygon);
+    free(loader->table.corners);
+    free(loader->table.vertices);
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_MESH_SHARED_H
+#define RAY_TRACING_ONE_WEEK_RT_MESH_SHARED_H
+
+#include <stdint.h>
+#include "rt_bvh.h"
+#include "rt_hittable_shared.h"
+#include "rt_mesh.h"
+
+typedef struct rt_mesh_s
+{
+    rt_hittable_t base;
+    rt_material_t *material;
+
+    size_t number_of_vertices;
+    rt_real_t *positions[3];
+    rt_real_t *normals[3];
+    rt_real_t *texture_coordinates[2];
+
+    // Triangles are stored in the order of the BVH leaves, so every leaf refers to a contiguous range of them
+    size_t number_of_triangles;
+    uint32_t *indices;
+
+    rt_bvh_node_t *nodes;
+    size_t number_of_nodes;
+    rt_aabb_t box;
+
+    // Mapped cache file the arrays above point into, NULL if the mesh owns them
+    void *mapping;
+    size_t mapping_size;
+} rt_mesh_t;
+
+// Sets up the hittable part of a mesh whose arrays are already filled in
+void rt_mesh_init(rt_mesh_t *mesh);
+
+// The OBJ file a cache was made from. The cache stays valid as long as the file has the same size and modification
+// time.
+typedef struct rt_mesh_source_s
+{
+    uint64_t size;
+    int64_t modification_time; // in nanoseconds
+    char cache_file_name[1024];
+} rt_mesh_source_t;
+
+// Fills source in for an OBJ file, returns false if there's no cache directory or the file can't be found
+bool rt_mesh_cache_get_source(const char *obj_file_name, rt_mesh_source_t *source);
+
+// Maps the cache of source if there is an up to date one. Returns NULL without printing anything otherwise, the
+// material is only taken over on success.
+rt_hittable_t *rt_mesh_cache_find(const rt_mesh_source_t *source, rt_material_t *material);
+
+void rt_mesh_cache_store(const rt_hittable_t *mesh, const rt_mesh_source_t *source);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_MESH_SHARED_H
@@ -9,75 +9,40 @@
 #include <pthread.h>
 #include "hittables/rt_hittable_list.h"
 #include "rt_camera.h"
+#include "rt_sampler.h"
+#include "rt_integrator.h"
+#include "hittables/rt_bvh.h"
+#include "hittables/rt_mesh.h"
 #include "rt_skybox_simple.h"
+#include "rt_thread_pool.h"
+#include "rt_arena.h"
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <scenes/rt_scenes.h>
 #include <assert.h>
-#define NUM_THREADS 8
 
 static void show_usage(const char *program_name, int err);
 
-static colour_t ray_colour(const ray_t *ray, const rt_hittable_list_t *list, rt_skybox_t *skybox, int child_rays)
-{
-    if (child_rays <= 0)
-    {
-        return colour(0, 0, 0);
-    }
-
-    rt_hit_record_t record;
-    if (!rt_hittable_list_hit_test(list, ray, 0.001, INFINITY, &record))
-    {
-        return rt_skybox_value(skybox, ray);
-    }
-
-    ray_t scattered;
-    colour_t attenuation;
-    colour_t emitted = rt_material_emit(record.material, record.u, record.v, &record.p);
-    if (rt_material_scatter(record.material, ray, &record, &attenuation, &scattered))
-    {
-        return vec3_sum(emitted, vec3_multiply(attenuation, ray_colour(&scattered, list, skybox, child_rays - 1)));
-    }
-    return emitted;
-}
-
 // Changes start here
 
 typedef struct {
 	// args to calculate the ray tracing
-	int IMAGE_WIDTH;
-	int IMAGE_HEIGHT;
-	long number_of_samples;
-	rt_camera_t *camera;
-	rt_hittable_list_t *world;
-	rt_skybox_t *skybox;
-	int CHILD_RAYS;
+	const rt_integrator_frame_t *frame;
 	// args to divide the work
 	int cur_line;
 	colour_t *line_res;
 } thread_work;
 
-void *process_line_thread(void *work)
+void process_line_thread(void *work)
 {
 	thread_work *cur_work = (thread_work *)work;
-	colour_t *local_work_res = (colour_t *)malloc(cur_work->IMAGE_WIDTH * sizeof(colour_t));
+	const rt_integrator_frame_t *frame = cur_work->frame;
+	colour_t *local_work_res = (colour_t *)malloc(frame->image_width * sizeof(colour_t));
 	
-	for (int i = 0; i < cur_work->IMAGE_WIDTH; ++i)
-        {
-		colour_t pixel = colour(0, 0, 0);
-		for (int s = 0; s < cur_work->number_of_samples; ++s)
-		{
-			double u = (double)(i + rt_random_double(0, 1)) / (cur_work->IMAGE_WIDTH - 1);
-			double v = (double)(cur_work->cur_line + rt_random_double(0, 1)) / (cur_work->IMAGE_HEIGHT - 1);
-
-			ray_t ray = rt_camera_get_ray(cur_work->camera, u, v);
-			vec3_add(&pixel, ray_colour(&ray, cur_work->world, cur_work->skybox, cur_work->CHILD_RAYS));
-		}
-		local_work_res[i] = pixel;
-	}
+	rt_integrator_tile_colour(frame, 0, frame->image_width, cur_work->cur_line, 1, local_work_res, frame->image_width);
 	
 	cur_work->line_res = local_work_res;
-	pthread_exit(NULL);
 }
 
 void despatch_line(const int IMAGE_WIDTH, colour_t *line_res, FILE *out_file, long number_of_samples)
@@ -88,51 +53,46 @@ void despatch_line(const int IMAGE_WIDTH, colour_t *line_res, FILE *out_file, lo
 	}
 }
 
-void render(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_samples, rt_camera_t *camera, rt_hittable_list_t *world, rt_skybox_t *skybox, const int CHILD_RAYS, FILE *out_file)
+void render(const rt_integrator_frame_t *frame, rt_thread_pool_t *pool, FILE *out_file)
 {
 	// Initial setup
-	long cur_line = IMAGE_HEIGHT-1;
-	pthread_t threads[NUM_THREADS];
+	long cur_line = frame->image_height-1;
+	int num_threads = (int)rt_thread_pool_get_size(pool);
 	int num_workers = 0;
+	thread_work *work = (thread_work *)malloc(num_threads * sizeof(thread_work));
 	
 	// Until reachs the image end
-	while (cur_line > 0)
+	while (cur_line >= 0)
 	{
 		num_workers = 0;
-		thread_work *work = (thread_work *)malloc(NUM_THREADS * sizeof(thread_work));
 		
-		// Create the threads
-		for (int t = 0; t < NUM_THREADS; ++t)
+		// Hand one line to each worker of the pool
+		for (int t = 0; t < num_threads; ++t)
 		{
 			// Verify if still have work to be done
 			if (cur_line >= 0)
 			{
-				work[t].IMAGE_WIDTH = IMAGE_WIDTH;
-				work[t].IMAGE_HEIGHT = IMAGE_HEIGHT;
-				work[t].number_of_samples = number_of_samples;
-				work[t].camera = camera;
-				work[t].world = world;
-				work[t].skybox = skybox;
-				work[t].CHILD_RAYS = CHILD_RAYS;
+				work[t].frame = frame;
 				
 				work[t].cur_line = cur_line;
 				work[t].line_res = NULL;
 				
-				pthread_create(&threads[t], NULL, &process_line_thread, (void *)&work[t]);
+				rt_thread_pool_submit(pool, &process_line_thread, (void *)&work[t]);
 				cur_line--;
 				num_workers++;
 			}
 		}
 
-		// Collect results and despatch it
+		// Barrier: wait for the whole batch, then collect results and despatch it
+		rt_thread_pool_wait(pool);
 		for (int t = 0; t < num_workers; ++t)
 		{
-			pthread_join(threads[t], NULL);
-			despatch_line(IMAGE_WIDTH, work[t].line_res, out_file, number_of_samples);
+			despatch_line(frame->image_width, work[t].line_res, out_file, frame->number_of_samples);
+			free(work[t].line_res);
 		}
-
-		free(work);
 	}
+
+	free(work);
 }
 
 // Changes finish here
@@ -141,8 +101,24 @@ int main(int argc, char const *argv[])
 {
     const char *number_of_samples_str = NULL;
     const char *scene_id_str = NULL;
+    const char *number_of_threads_str = NULL;
+    const char *seed_str = NULL;
+    const char *sampler_str = NULL;
+    const char *bvh_layout_str = NULL;
+    const char *max_depth_str = NULL;
+    const char *adaptive_str = NULL;
     const char *file_name = NULL;
+    const char *mesh_cache_directory = NULL;
     bool verbose = false;
+    bool pin_threads = false;
+    bool allow_simd = true;
+    bool sample_lights = true;
+    bool trace_packets = true;
+    bool wavefront = false;
+    bool sort_rays = false;
+    bool use_arena = true;
+    bool build_cache_only = false;
+    int exit_code = EXIT_SUCCESS;
     //pthread_exit(NULL);
     // Parse console arguments
     for (int i = 1; i < argc; ++i)
@@ -167,9 +143,121 @@ int main(int argc, char const *argv[])
             scene_id_str = argv[++i];
             continue;
         }
+        else if (0 == strcmp(argv[i], "-t") || 0 == strcmp(argv[i], "--threads"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            number_of_threads_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--sampler"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            sampler_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--bvh"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            bvh_layout_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-simd"))
+        {
+            allow_simd = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-nee"))
+        {
+            sample_lights = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-packets"))
+        {
+            trace_packets = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--wavefront"))
+        {
+            wavefront = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--sort-rays"))
+        {
+            wavefront = true;
+            sort_rays = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-arena"))
+        {
+            use_arena = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--mesh-cache"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            mesh_cache_directory = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--build-cache"))
+        {
+            build_cache_only = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--max-depth"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            max_depth_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--adaptive"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            adaptive_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--seed"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            seed_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--pin"))
+        {
+            pin_threads = true;
+            continue;
+        }
         else if (0 == strcmp(argv[i], "-v") || 0 == strcmp(argv[i], "--verbose"))
         {
             verbose = true;
+            continue;
         }
         else if (0 == strcmp(argv[i], "-h"))
         {
@@ -193,6 +281,7 @@ int main(int argc, char const *argv[])
         fprintf(stderr, "Non-parsed parameters:\n");
         fprintf(stderr, "\t- number of samples: %s\n", number_of_samples_str);
         fprintf(stderr, "\t- scene ID:          %s\n", scene_id_str);
+        fprintf(stderr, "\t- number of threads: %s\n", number_of_threads_str);
         fprintf(stderr, "\t- file_name:         %s\n", file_name);
     }
 
@@ -208,6 +297,78 @@ int main(int argc, char const *argv[])
             show_usage(argv[0], EXIT_FAILURE);
         }
     }
+    long number_of_threads = (long)rt_thread_pool_available_cpus();
+    if (NULL != number_of_threads_str)
+    {
+        char *end_ptr = NULL;
+        number_of_threads = strtol(number_of_threads_str, &end_ptr, 10);
+        if (*end_ptr != '\0' || number_of_threads <= 0)
+        {
+            fprintf(stderr, "Fatal error: Value of 'threads' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    unsigned long long seed = 0;
+    if (NULL != seed_str)
+    {
+        char *end_ptr = NULL;
+        seed = strtoull(seed_str, &end_ptr, 10);
+        if (*end_ptr != '\0')
+        {
+            fprintf(stderr, "Fatal error: Value of 'seed' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    long max_depth = RT_INTEGRATOR_DEFAULT_MAX_DEPTH;
+    if (NULL != max_depth_str)
+    {
+        char *end_ptr = NULL;
+        max_depth = strtol(max_depth_str, &end_ptr, 10);
+        if (*end_ptr != '\0' || max_depth <= 0 || max_depth > INT_MAX)
+        {
+            fprintf(stderr, "Fatal error: Value of 'max-depth' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    double adaptive_threshold = 0.0;
+    if (NULL != adaptive_str)
+    {
+        char *end_ptr = NULL;
+        adaptive_threshold = strtod(adaptive_str, &end_ptr);
+        if (*end_ptr != '\0' || !(adaptive_threshold > 0.0))
+        {
+            fprintf(stderr, "Fatal error: Value of 'adaptive' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_sampler_type_t sampler_type = RT_SAMPLER_SOBOL;
+    if (NULL != sampler_str)
+    {
+        sampler_type = rt_sampler_get_type_by_name(sampler_str);
+        if (RT_SAMPLER_NONE == sampler_type)
+        {
+            fprintf(stderr, "Fatal error: Invalid sampler\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_bvh_layout_t bvh_layout = RT_BVH_LAYOUT_AUTO;
+    if (NULL != bvh_layout_str)
+    {
+        bvh_layout = rt_bvh_get_layout_by_name(bvh_layout_str);
+        if (RT_BVH_LAYOUT_NONE == bvh_layout)
+        {
+            fprintf(stderr, "Fatal error: Invalid BVH layout\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_bvh_set_layout(bvh_layout, allow_simd);
+    rt_ray_packet_set_simd(allow_simd);
+    if (build_cache_only && NULL == mesh_cache_directory)
+    {
+        fprintf(stderr, "Fatal error: --build-cache needs a directory to put the cache in (--mesh-cache)\n");
+        show_usage(argv[0], EXIT_FAILURE);
+    }
+    rt_mesh_set_cache_directory(mesh_cache_directory);
     rt_scene_id_t scene_id = RT_SCENE_SHOWCASE;
     if (NULL != scene_id_str)
     {
@@ -224,6 +385,33 @@ int main(int argc, char const *argv[])
         fprintf(stderr, "Parsed parameters:\n");
         fprintf(stderr, "\t- number of samples: %ld\n", number_of_samples);
         fprintf(stderr, "\t- scene ID:          %d\n", scene_id);
+        fprintf(stderr, "\t- number of threads: %ld%s\n", number_of_threads, pin_threads ? " (pinned)" : "");
+        fprintf(stderr, "\t- seed:              %llu\n", seed);
+        fprintf(stderr, "\t- sampler:           %s\n", rt_sampler_get_name_by_type(sampler_type));
+        fprintf(stderr, "\t- BVH layout:        %s\n", rt_bvh_get_layout_description());
+        fprintf(stderr, "\t- max depth:         %ld\n", max_depth);
+        fprintf(stderr, "\t- light sampling:    %s\n", sample_lights ? "on" : "off");
+        if (trace_packets)
+        {
+            fprintf(stderr, "\t- ray packets:       %d rays (%s)\n", RT_RAY_PACKET_SIZE, rt_ray_packet_get_simd_name());
+        }
+        else
+        {
+            fprintf(stderr, "\t- ray packets:       off\n");
+        }
+        fprintf(stderr, "\t- integrator:        %s\n",
+                sort_rays ? "wavefront, sorted rays" : (wavefront ? "wavefront" : "path"));
+        if (adaptive_threshold > 0.0)
+        {
+            fprintf(stderr, "\t- adaptive sampling: %g (at least %d samples)\n", adaptive_threshold,
+                    RT_INTEGRATOR_ADAPTIVE_MIN_SAMPLES);
+        }
+        else
+        {
+            fprintf(stderr, "\t- adaptive sampling: off\n");
+        }
+        fprintf(stderr, "\t- scene arena:       %s\n", use_arena ? "on" : "off");
+        fprintf(stderr, "\t- mesh cache:        %s\n", NULL != mesh_cache_directory ? mesh_cache_directory : "off");
         fprintf(stderr, "\t- file_name:         %s\n", file_name);
     }
 
@@ -231,13 +419,31 @@ int main(int argc, char const *argv[])
     const double ASPECT_RATIO = 3.0 / 2.0;
     const int IMAGE_WIDTH = 300;
     const int IMAGE_HEIGHT = (int)(IMAGE_WIDTH / ASPECT_RATIO);
-    const int CHILD_RAYS = 50;
+    const int CHILD_RAYS = (int)max_depth;
 
     // Declare Camera parameters
     point3_t look_from, look_at;
     vec3_t up = point3(0, 1, 0);
     double focus_distance = 10.0, aperture = 0.0, vertical_fov = 40.0;
 
+    // Worker threads are started once and reused for the whole run, starting with building the BVHs of the scene
+    rt_thread_pool_t *pool = rt_thread_pool_new((size_t)number_of_threads, pin_threads);
+    if (NULL == pool)
+    {
+        fprintf(stderr, "Fatal error: Unable to start %ld worker threads\n", number_of_threads);
+        return EXIT_FAILURE;
+    }
+    rt_bvh_set_build_pool(pool);
+
+    // Every random draw of the renderer is keyed by the seed, so the image doesn't depend on the number of threads
+    rt_random_set_seed(seed);
+
+    // Everything the scene is made of is allocated from one arena and freed at once after rendering
+    rt_arena_t *scene_arena = use_arena ? rt_arena_new(0) : NULL;
+    rt_arena_set_current(scene_arena);
+    struct timespec scene_start;
+    clock_gettime(CLOCK_MONOTONIC, &scene_start);
+
     // World
     rt_hittable_list_t *world = NULL;
     rt_skybox_t *skybox = NULL;
@@ -332,13 +538,57 @@ int main(int argc, char const *argv[])
             skybox = rt_skybox_new_gradient(colour(1, 1, 1), colour(0.5, 0.7, 1));
             world = rt_scene_metal_test();
             break;
+
+        case RT_SCENE_MESH_TEST:
+            look_from = point3(0, 6, -11);
+            look_at = point3(0, 0, 0);
+            vertical_fov = 30.0;
+
+            skybox = rt_skybox_new_gradient(colour(1, 1, 1), colour(0.5, 0.7, 1));
+            world = rt_scene_mesh_test();
+            break;
         case RT_SCENE_NONE:
             fprintf(stderr, "Fatal error: scene id is undefined after parsing the parameters\n");
             return EXIT_FAILURE;
     }
 
+    // Lights the integrator samples directly, an empty list disables next-event estimation
+    rt_hittable_list_t *lights = sample_lights ? rt_hittable_list_collect_lights(world) : rt_hittable_list_init(1);
+    if (verbose)
+    {
+        fprintf(stderr, "Number of sampled lights: %zu\n", rt_hittable_list_get_size(lights));
+    }
+    rt_arena_set_current(NULL);
+    if (verbose)
+    {
+        struct timespec scene_end;
+        clock_gettime(CLOCK_MONOTONIC, &scene_end);
+        fprintf(stderr, "Scene built in %.2f ms\n",
+                (double)(scene_end.tv_sec - scene_start.tv_sec) * 1e3 +
+                    (double)(scene_end.tv_nsec - scene_start.tv_nsec) * 1e-6);
+    }
+    if (verbose && NULL != scene_arena)
+    {
+        fprintf(stderr, "Scene arena: %zu KiB in %zu blocks\n", rt_arena_get_used(scene_arena) / 1024,
+                rt_arena_get_number_of_blocks(scene_arena));
+    }
+
     rt_camera_t *camera =
         rt_camera_new(look_from, look_at, up, vertical_fov, ASPECT_RATIO, aperture, focus_distance, 0.0, 1.0);
+    rt_sampler_t *sampler = rt_sampler_new(sampler_type, seed);
+    rt_sampler_use_for_bounces(sampler);
+
+    // The meshes of the scene are in the cache now, there's nothing else to do. Only meshes loaded from files are
+    // cached, a scene made of other primitives alone leaves nothing behind.
+    if (build_cache_only)
+    {
+        if (0 == rt_mesh_get_number_of_cached_meshes())
+        {
+            fprintf(stderr, "Fatal error: Scene '%s' has no meshes to cache\n", rt_scene_get_name_by_id(scene_id));
+            exit_code = EXIT_FAILURE;
+        }
+        goto cleanup;
+    }
 
     FILE *out_file = stdout;
     if (NULL != file_name)
@@ -353,28 +603,108 @@ int main(int argc, char const *argv[])
 
     // Render    
     fprintf(out_file, "P3\n%d %d\n255\n", IMAGE_WIDTH, IMAGE_HEIGHT);
-    render(IMAGE_WIDTH, IMAGE_HEIGHT, number_of_samples, camera, world, skybox, CHILD_RAYS, out_file);
+    rt_integrator_frame_t frame = {.image_width = IMAGE_WIDTH,
+                                   .image_height = IMAGE_HEIGHT,
+                                   .number_of_samples = number_of_samples,
+                                   .adaptive_threshold = adaptive_threshold,
+                                   .max_depth = CHILD_RAYS,
+                                   .trace_packets = trace_packets,
+                                   .wavefront = wavefront,
+                                   .sort_rays = sort_rays,
+                                   .measure_sorting = verbose,
+                                   .camera = camera,
+                                   .sampler = sampler,
+                                   .world = world,
+                                   .lights = lights,
+                                   .skybox = skybox};
+    render(&frame, pool, out_file);
+
+    if (verbose)
+    {
+        rt_integrator_stats_t stats;
+        rt_integrator_get_stats(&stats);
+        fprintf(stderr, "Average number of samples per pixel: %.2f\n",
+                0 == stats.pixels ? 0.0 : (double)stats.samples / (double)stats.pixels);
+        if (stats.secondary_rays > 0)
+        {
+            fprintf(stderr, "Secondary rays: %llu, traversal: %.1f ns per ray\n",
+                    (unsigned long long)stats.secondary_rays,
+                    (double)stats.secondary_traversal_ns / (double)stats.secondary_rays);
+        }
+        if (stats.sorted_rays > 0)
+        {
+            fprintf(stderr, "Sorted rays: %llu, sorting: %.1f ns per ray\n", (unsigned long long)stats.sorted_rays,
+                    (double)stats.sort_ns / (double)stats.sorted_rays);
+        }
+        if (stats.probed_rays > 0)
+        {
+            // Sorting pays for itself if it saves more traversal time per ray than it costs
+            double sorted_ns = (double)stats.probed_sorted_ns / (double)stats.probed_rays;
+            double unsorted_ns = (double)stats.probed_unsorted_ns / (double)stats.probed_rays;
+            double sort_ns = (double)stats.sort_ns / (double)stats.sorted_rays;
+            fprintf(stderr,
+                    "Sampled rays: %llu, traversal: %.1f ns per ray sorted, %.1f unsorted (%.2fx), "
+                    "net gain of sorting: %.1f ns per ray\n",
+                    (unsigned long long)stats.probed_rays, sorted_ns, unsorted_ns,
+                    sorted_ns > 0 ? unsorted_ns / sorted_ns : 0.0, unsorted_ns - sorted_ns - sort_ns);
+        }
+    }
 
 cleanup:
     // Cleanup
+    rt_bvh_set_build_pool(NULL);
+    rt_thread_pool_delete(pool);
+    rt_hittable_list_deinit(lights);
     rt_hittable_list_deinit(world);
+    rt_arena_delete(scene_arena);
     rt_camera_delete(camera);
+    rt_sampler_use_for_bounces(NULL);
+    rt_sampler_delete(sampler);
     rt_skybox_delete(skybox);
 
-    return EXIT_SUCCESS;
+    return exit_code;
 }
 
 static void show_usage(const char *program_name, int err)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "%s [-s|--samples N] [--scene SCENE] [-v|--verbose] [output_file_name]\n", program_name);
+    fprintf(stderr, "%s [-s|--samples N] [--scene SCENE] [-t|--threads N] [--pin] [--seed N] [--sampler SAMPLER] "
+                    "[--bvh LAYOUT] [--no-simd] [--max-depth N] [--no-nee] [--no-packets] [--wavefront] [--sort-rays] "
+                    "[--adaptive T] [--no-arena] [--mesh-cache DIR] [--build-cache] [-v|--verbose] "
+                    "[output_file_name]\n",
+            program_name);
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "\t-s | --samples      <int>       Number of rays to cast for each pixel\n");
+    fprintf(stderr, "\t-s | --samples      <int>       Number of rays per pixel, the upper bound with --adaptive\n");
     fprintf(stderr, "\t--scene             <string>    ID of the scene to render. List of available scenes is printed below.\n");
+    fprintf(stderr, "\t-t | --threads      <int>       Number of worker threads (default: number of available CPUs)\n");
+    fprintf(stderr, "\t--pin                           Pin every worker thread to its own CPU\n");
+    fprintf(stderr, "\t--seed              <int>       Seed of the random sequences (default: 0)\n");
+    fprintf(stderr, "\t--sampler           <string>    Sampling pattern (default: sobol)\n");
+    fprintf(stderr, "\t--bvh               <string>    Layout of the BVH nodes (default: auto)\n");
+    fprintf(stderr, "\t--no-simd                       Don't use vector units for BVH and ray packet tests\n");
+    fprintf(stderr, "\t--max-depth         <int>       Maximum number of bounces of a path (default: %d)\n",
+            RT_INTEGRATOR_DEFAULT_MAX_DEPTH);
+    fprintf(stderr, "\t--no-nee                        Don't sample lights directly, rely on scattered rays only\n");
+    fprintf(stderr, "\t--no-packets                    Trace every camera ray on its own instead of in packets\n");
+    fprintf(stderr, "\t--wavefront                     Trace a line bounce by bounce, shading by material\n");
+    fprintf(stderr, "\t--sort-rays                     Wavefront, rays sorted by direction and origin\n");
+    fprintf(stderr, "\t--no-arena                      Allocate scene objects one by one instead of from an arena\n");
+    fprintf(stderr, "\t--mesh-cache        <string>    Directory of binary caches of the OBJ meshes (triangles and "
+                    "BVH), reused while the files they were read from don't change. Only OBJ meshes are cached, the "
+                    "rest of a scene is built from code in milliseconds\n");
+    fprintf(stderr, "\t--build-cache                   Write the caches of the OBJ meshes the scene loads and exit "
+                    "without rendering, fails for scenes without OBJ meshes\n");
+    fprintf(stderr, "\t--adaptive          <double>    Stop sampling a pixel early once the error of its "
+                    "gamma corrected mean drops below the value. Only stops early, the samples a pixel doesn't "
+                    "take aren't given to other pixels\n");
     fprintf(stderr, "\t-v | --verbose                  Enable verbose output\n");
     fprintf(stderr, "\t-h                              Show this message and exit\n");
     fprintf(stderr, "Positional arguments:\n");
     fprintf(stderr, "\toutput_file_name                Name of the output file. Outputs image to console if not specified.\n");
+    fprintf(stderr, "Available samplers:\n");
+    rt_sampler_print_samplers_info(stderr);
+    fprintf(stderr, "Available BVH layouts:\n");
+    rt_bvh_print_layouts_info(stderr);
     fprintf(stderr, "Available scenes:\n");
     rt_scene_print_scenes_info(stderr);
 
@@ -18,6 +18,9 @@ typedef struct rt_material_diffuse_s
 
 static bool rt_mt_diffuse_scatter(const rt_material_t *material, const ray_t *incoming_ray,
                                   const rt_hit_record_t *hit_record, colour_t *attenuation, ray_t *scattered_ray);
+static bool rt_mt_diffuse_eval(const rt_material_t *material, const ray_t *incoming_ray,
+                               const rt_hit_record_t *hit_record, const vec3_t *direction, colour_t *value,
+                               double *pdf);
 static void rt_mt_diffuse_delete(rt_material_t *material);
 
 rt_material_t *rt_mt_diffuse_new_with_albedo(colour_t albedo)
@@ -27,12 +30,13 @@ rt_material_t *rt_mt_diffuse_new_with_albedo(colour_t albedo)
 
 rt_material_t *rt_mt_diffuse_new_with_texture(rt_texture_t *texture)
 {
-    rt_material_diffuse_t *material = calloc(1, sizeof(rt_material_diffuse_t));
+    rt_material_diffuse_t *material = rt_arena_calloc(sizeof(rt_material_diffuse_t));
     assert(NULL != material);
 
     material->texture = texture;
     rt_material_base_init(&material->base, RT_MATERIAL_TYPE_DIFFUSE_LAMBERTIAN, rt_mt_diffuse_scatter, NULL,
                           rt_mt_diffuse_delete);
+    material->base.eval = rt_mt_diffuse_eval;
     return (rt_material_t *)material;
 }
 
@@ -57,6 +61,35 @@ static bool rt_mt_diffuse_scatter(const rt_material_t *material, const ray_t *in
     return true;
 }
 
+// Lambertian BSDF is albedo / PI, scatter() samples directions proportionally to the cosine, so the pdf is cosine / PI
+static bool rt_mt_diffuse_eval(const rt_material_t *material, const ray_t *incoming_ray,
+                               const rt_hit_record_t *hit_record, const vec3_t *direction, colour_t *value,
+                               double *pdf)
+{
+    assert(NULL != material);
+    assert(NULL != hit_record);
+    assert(NULL != direction);
+    assert(NULL != value);
+    assert(NULL != pdf);
+
+    assert(RT_MATERIAL_TYPE_DIFFUSE_LAMBERTIAN == material->type);
+    (void)incoming_ray;
+
+    rt_material_diffuse_t *diffuse = (rt_material_diffuse_t *)material;
+
+    double cosine = vec3_dot(hit_record->normal, *direction) / vec3_length(*direction);
+    if (cosine <= 0)
+    {
+        *value = colour(0, 0, 0);
+        *pdf = 0;
+        return true;
+    }
+
+    *pdf = cosine / PI;
+    *value = vec3_scale(rt_texture_value(diffuse->texture, hit_record->u, hit_record->v, &hit_record->p), cosine / PI);
+    return true;
+}
+
 static void rt_mt_diffuse_delete(rt_material_t *material)
 {
     if (NULL == material)
@@ -26,7 +26,7 @@ rt_material_t *rt_mt_dl_new_with_albedo(colour_t albedo, double intensity)
 
 rt_material_t *rt_mt_dl_new_with_texture(rt_texture_t *texture, double intensity)
 {
-    rt_material_dl_t *result = calloc(1, sizeof(rt_material_dl_t));
+    rt_material_dl_t *result = rt_arena_calloc(sizeof(rt_material_dl_t));
     assert(NULL != result);
 
     result->texture = texture;
@@ -8,6 +8,7 @@
 #ifndef RAY_TRACING_ONE_WEEK_RT_MATERIAL_SHARED_H
 #define RAY_TRACING_ONE_WEEK_RT_MATERIAL_SHARED_H
 
+#include <rt_arena.h>
 #include "rt_material.h"
 
 typedef enum rt_material_type_e
@@ -27,6 +28,10 @@ typedef colour_t (*rt_material_emit_fn)(const rt_material_t *material, double u,
 
 typedef void (*rt_material_delete_fn)(rt_material_t *material);
 
+typedef bool (*rt_material_eval_fn)(const rt_material_t *material, const ray_t *incoming_ray,
+                                    const rt_hit_record_t *hit_record, const vec3_t *direction, colour_t *value,
+                                    double *pdf);
+
 struct rt_material_s
 {
     rt_material_type_t type;
@@ -35,6 +40,9 @@ struct rt_material_s
     rt_material_scatter_fn scatter;
     rt_material_emit_fn emit;
     rt_material_delete_fn delete;
+
+    // Only set by the materials that scatter into a continuous range of directions, NULL for specular ones
+    rt_material_eval_fn eval;
 };
 
 void rt_material_base_init(rt_material_t *material_base, rt_material_type_t type, rt_material_scatter_fn scatter_fn,
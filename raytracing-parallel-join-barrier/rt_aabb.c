@@ -20,26 +20,19 @@ bool rt_aabb_hit(const rt_aabb_t *aabb, double t_min, double t_max, const ray_t
 {
     assert(NULL != aabb);
 
+    const point3_t bounds[2] = {aabb->min, aabb->max};
     for (vec3_axis_t axis = VEC3_AXIS_X; axis <= VEC3_AXIS_Z; axis++)
     {
-        double inv_direction = 1.0 / ray->direction.components[axis];
-        double t0 = (aabb->min.components[axis] - ray->origin.components[axis]) * inv_direction,
-               t1 = (aabb->max.components[axis] - ray->origin.components[axis]) * inv_direction;
-        if (inv_direction < 0)
-        {
-            double tmp = t0;
-            t0 = t1;
-            t1 = tmp;
-        }
+        // The ray enters the slab through bounds[sign] and leaves through the opposite plane
+        int sign = ray->sign[axis];
+        rt_real_t origin = ray->origin.components[axis], inv_direction = ray->inv_direction.components[axis];
+        rt_real_t t0 = (bounds[sign].components[axis] - origin) * inv_direction,
+                  t1 = (bounds[1 - sign].components[axis] - origin) * inv_direction;
         t_min = t0 > t_min ? t0 : t_min;
         t_max = t1 < t_max ? t1 : t_max;
-        if (t_max <= t_min)
-        {
-            return false;
-        }
     }
 
-    return true;
+    return t_min < t_max;
 }
 
 rt_aabb_t rt_aabb_surrounding_bb(rt_aabb_t a, rt_aabb_t b)
@@ -57,3 +50,18 @@ rt_aabb_t rt_aabb_surrounding_bb(rt_aabb_t a, rt_aabb_t b)
                         }};
     return result;
 }
+
+double rt_aabb_surface_area(const rt_aabb_t *aabb)
+{
+    assert(NULL != aabb);
+
+    vec3_t extent = vec3_diff(aabb->max, aabb->min);
+    return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+point3_t rt_aabb_centroid(const rt_aabb_t *aabb)
+{
+    assert(NULL != aabb);
+
+    return vec3_scale(vec3_sum(aabb->min, aabb->max), 0.5);
+}
@@ -61,10 +61,21 @@ void rt_camera_delete(rt_camera_t *camera)
 }
 
 ray_t rt_camera_get_ray(const rt_camera_t *camera, double s, double t)
+{
+    rt_camera_sample_t sample = {0};
+    sample.lens_u = rt_random_double(0, 1);
+    sample.lens_v = rt_random_double(0, 1);
+    sample.time = rt_random_double(0, 1);
+
+    return rt_camera_get_ray_sampled(camera, s, t, &sample);
+}
+
+ray_t rt_camera_get_ray_sampled(const rt_camera_t *camera, double s, double t, const rt_camera_sample_t *sample)
 {
     assert(NULL != camera);
+    assert(NULL != sample);
 
-    vec3_t random_vector_on_lens = vec3_scale(vec3_random_in_unit_disc(), camera->lens_radius);
+    vec3_t random_vector_on_lens = vec3_scale(vec3_concentric_disc(sample->lens_u, sample->lens_v), camera->lens_radius);
     vec3_t offset =
         vec3_sum(vec3_scale(camera->u, random_vector_on_lens.x), vec3_scale(camera->v, random_vector_on_lens.y));
 
@@ -73,6 +84,6 @@ ray_t rt_camera_get_ray(const rt_camera_t *camera, double s, double t)
     vec3_sub(&ray_direction, camera->origin);
     vec3_sub(&ray_direction, offset);
 
-    return ray_init(vec3_sum(camera->origin, offset), ray_direction,
-                    rt_random_double(camera->shutter_start_time, camera->shutter_end_time));
+    double time = camera->shutter_start_time + (camera->shutter_end_time - camera->shutter_start_time) * sample->time;
+    return ray_init(vec3_sum(camera->origin, offset), ray_direction, time);
 }
@@ -0,0 +1,877 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "rt_integrator.h"
+#include "rt_material_shared.h"
+
+// Bounds of the Russian roulette survival probability. The upper one makes sure that even bright paths (e.g. between
+// two mirrors) end eventually, the lower one keeps the weight of the rare survivors of dark paths from exploding.
+#define RT_INTEGRATOR_RR_MIN_SURVIVAL (0.05)
+#define RT_INTEGRATOR_RR_MAX_SURVIVAL (0.95)
+
+// Number of values of rt_material_type_t, the wavefront keeps a queue of hits for each of them
+#define RT_INTEGRATOR_MATERIAL_TYPES (RT_MATERIAL_TYPE_ISOTROPIC + 1)
+
+// Number of cells along every axis ray origins are quantized to for sorting
+#define RT_INTEGRATOR_MORTON_CELLS (512)
+
+// Queues up to that long are sorted by insertion
+#define RT_INTEGRATOR_SMALL_SORT (64)
+
+// With measure_sorting one in that many sorted bounces of a tile is traced once more in pixel order
+#define RT_INTEGRATOR_SORT_PROBE_INTERVAL (16)
+
+// Closest distance along a ray intersections are reported at, keeps the scattered rays from hitting their own origin
+#define RT_INTEGRATOR_T_MIN (0.001)
+
+// Shadow rays stop that much (relative to the distance) before the light, so they don't hit the light itself
+#define RT_INTEGRATOR_SHADOW_EPSILON (1e-7)
+
+static atomic_uint_fast64_t gs_pixels = 0;
+static atomic_uint_fast64_t gs_samples = 0;
+static atomic_uint_fast64_t gs_secondary_rays = 0;
+static atomic_uint_fast64_t gs_secondary_traversal_ns = 0;
+static atomic_uint_fast64_t gs_sorted_rays = 0;
+static atomic_uint_fast64_t gs_sort_ns = 0;
+static atomic_uint_fast64_t gs_probed_rays = 0;
+static atomic_uint_fast64_t gs_probed_sorted_ns = 0;
+static atomic_uint_fast64_t gs_probed_unsorted_ns = 0;
+
+// First intersection of a path when it has been looked up before the path is traced, e.g. by a packet query
+typedef struct primary_hit_s
+{
+    bool hit;
+    rt_hit_record_t record;
+} primary_hit_t;
+
+// Sum of the samples of a pixel and the running mean and sum of squared deviations (Welford) of their luminance
+typedef struct pixel_accumulator_s
+{
+    colour_t sum;
+    double mean;
+    double m2;
+    long samples;
+} pixel_accumulator_t;
+
+// A path between two bounces
+typedef struct path_state_s
+{
+    ray_t ray;
+    colour_t result;
+    colour_t throughput;
+    // Whether lights have been sampled at the origin of the current ray, and the density its direction was picked with
+    bool lights_sampled;
+    double bsdf_pdf;
+    // Number of hits shaded so far
+    int depth;
+} path_state_t;
+
+static inline double power_heuristic(double pdf, double other_pdf)
+{
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// Next-event estimation: radiance arriving at the hit straight from a randomly picked light, weighted by MIS
+static colour_t sample_direct_light(const rt_hittable_list_t *world, const rt_hittable_list_t *lights,
+                                    const ray_t *incoming_ray, const rt_hit_record_t *record)
+{
+    vec3_t direction = rt_hittable_list_random(lights, &record->p);
+
+    colour_t value;
+    double bsdf_pdf;
+    if (!rt_material_eval(record->material, incoming_ray, record, &direction, &value, &bsdf_pdf) || bsdf_pdf <= 0)
+    {
+        return colour(0, 0, 0);
+    }
+
+    double light_pdf = rt_hittable_list_pdf_value(lights, &record->p, &direction);
+    if (light_pdf <= 0)
+    {
+        return colour(0, 0, 0);
+    }
+
+    ray_t shadow_ray = ray_init(record->p, direction, incoming_ray->time);
+    rt_hit_record_t light_record;
+    if (!rt_hittable_list_hit_test(lights, &shadow_ray, RT_INTEGRATOR_T_MIN, INFINITY, &light_record) ||
+        rt_hittable_list_occluded(world, &shadow_ray, RT_INTEGRATOR_T_MIN,
+                                  light_record.t * (1 - RT_INTEGRATOR_SHADOW_EPSILON)))
+    {
+        return colour(0, 0, 0);
+    }
+
+    colour_t emitted = rt_material_emit(light_record.material, light_record.u, light_record.v, &light_record.p);
+    double weight = power_heuristic(light_pdf, bsdf_pdf);
+    return vec3_scale(vec3_multiply(emitted, value), weight / light_pdf);
+}
+
+// Starts a path at the ray
+static void path_start(path_state_t *path, const ray_t *ray)
+{
+    path->ray = *ray;
+    path->result = colour(0, 0, 0);
+    path->throughput = colour(1, 1, 1);
+    path->lights_sampled = false;
+    path->bsdf_pdf = 0;
+    path->depth = 0;
+}
+
+// The current ray of the path has left the scene
+static void path_miss(path_state_t *path, rt_skybox_t *skybox)
+{
+    vec3_add(&path->result, vec3_multiply(path->throughput, rt_skybox_value(skybox, &path->ray)));
+}
+
+// Shades the hit of the current ray of the path: adds the light emitted by the surface and the light sampled directly,
+// then scatters the ray. Returns false if the path has ended, either because the material absorbed the ray or because
+// Russian roulette terminated it. Doesn't check max_depth.
+static bool path_shade(path_state_t *path, const rt_hit_record_t *record, const rt_hittable_list_t *world,
+                       const rt_hittable_list_t *lights, bool sample_lights)
+{
+    const ray_t *current = &path->ray;
+    if (rt_material_is_emissive(record->material))
+    {
+        colour_t emitted = rt_material_emit(record->material, record->u, record->v, &record->p);
+        if (path->lights_sampled)
+        {
+            // This light could have been found by the light sample at the previous hit as well
+            double light_pdf = rt_hittable_list_pdf_value(lights, &current->origin, &current->direction);
+            vec3_scale_in_place(&emitted, power_heuristic(path->bsdf_pdf, light_pdf));
+        }
+        vec3_add(&path->result, vec3_multiply(path->throughput, emitted));
+    }
+
+    ray_t scattered;
+    colour_t attenuation;
+    if (!rt_material_scatter(record->material, current, record, &attenuation, &scattered))
+    {
+        return false;
+    }
+
+    path->lights_sampled = false;
+    if (sample_lights)
+    {
+        colour_t value;
+        if (rt_material_eval(record->material, current, record, &scattered.direction, &value, &path->bsdf_pdf))
+        {
+            colour_t direct = sample_direct_light(world, lights, current, record);
+            vec3_add(&path->result, vec3_multiply(path->throughput, direct));
+            path->lights_sampled = true;
+        }
+    }
+    path->throughput = vec3_multiply(path->throughput, attenuation);
+    path->ray = scattered;
+
+    int depth = path->depth++;
+    if (depth + 1 >= RT_INTEGRATOR_RR_MIN_DEPTH)
+    {
+        double survival = fmax(path->throughput.x, fmax(path->throughput.y, path->throughput.z));
+        if (survival <= 0)
+        {
+            return false;
+        }
+        survival = fmin(fmax(survival, RT_INTEGRATOR_RR_MIN_SURVIVAL), RT_INTEGRATOR_RR_MAX_SURVIVAL);
+        if (rt_random_double(0, 1) >= survival)
+        {
+            return false;
+        }
+        vec3_scale_in_place(&path->throughput, 1.0 / survival);
+    }
+    return true;
+}
+
+// Follows the path started by the ray. If primary isn't NULL the first intersection has already been looked up, and the
+// random stream is where rt_random_begin_bounce(0) and that lookup have left it.
+static colour_t trace_path(const ray_t *ray, const primary_hit_t *primary, const rt_hittable_list_t *world,
+                           const rt_hittable_list_t *lights, rt_skybox_t *skybox, int max_depth)
+{
+    assert(NULL != ray);
+    assert(NULL != world);
+    assert(NULL != lights);
+
+    bool sample_lights = rt_hittable_list_get_size(lights) > 0;
+
+    path_state_t path;
+    path_start(&path, ray);
+    while (path.depth < max_depth)
+    {
+        rt_hit_record_t record;
+        bool hit;
+        if (0 == path.depth && NULL != primary)
+        {
+            hit = primary->hit;
+            record = primary->record;
+        }
+        else
+        {
+            rt_random_begin_bounce((uint32_t)path.depth);
+            hit = rt_hittable_list_hit_test(world, &path.ray, RT_INTEGRATOR_T_MIN, INFINITY, &record);
+        }
+
+        if (!hit)
+        {
+            path_miss(&path, skybox);
+            break;
+        }
+        if (!path_shade(&path, &record, world, lights, sample_lights))
+        {
+            break;
+        }
+    }
+
+    return path.result;
+}
+
+colour_t rt_integrator_ray_colour(const ray_t *ray, const rt_hittable_list_t *world, const rt_hittable_list_t *lights,
+                                  rt_skybox_t *skybox, int max_depth)
+{
+    return trace_path(ray, NULL, world, lights, skybox, max_depth);
+}
+
+// Keys the random stream by the sample and returns its camera ray
+static ray_t camera_ray(const rt_integrator_frame_t *frame, int x, int y, long s)
+{
+    uint64_t pixel_index = (uint64_t)y * frame->image_width + x;
+    rt_random_begin_sample(pixel_index, (uint32_t)s);
+    rt_camera_sample_t sample;
+    rt_sampler_get_camera_sample(frame->sampler, pixel_index, (uint32_t)s, &sample);
+    double u = (double)(x + sample.pixel_x) / (frame->image_width - 1);
+    double v = (double)(y + sample.pixel_y) / (frame->image_height - 1);
+
+    return rt_camera_get_ray_sampled(frame->camera, u, v, &sample);
+}
+
+// Adds a sample to the pixel, returns true once the pixel doesn't need any more of them
+static bool pixel_add_sample(const rt_integrator_frame_t *frame, pixel_accumulator_t *pixel, colour_t value)
+{
+    vec3_add(&pixel->sum, value);
+    long s = ++pixel->samples;
+    if (s >= frame->number_of_samples)
+    {
+        return true;
+    }
+
+    if (frame->adaptive_threshold > 0)
+    {
+        double luminance = 0.2126 * value.x + 0.7152 * value.y + 0.0722 * value.z;
+        double delta = luminance - pixel->mean;
+        pixel->mean += delta / s;
+        pixel->m2 += delta * (luminance - pixel->mean);
+
+        if (s >= RT_INTEGRATOR_ADAPTIVE_MIN_SAMPLES && 0 == (s & (s - 1)))
+        {
+            // Images are written with gamma 2, so an error of e around the mean shows up as roughly
+            // e / (2 * sqrt(mean)) in the output, i.e. dark pixels need a smaller error than bright ones
+            double standard_error = sqrt(pixel->m2 / (s - 1) / s);
+            if (standard_error <= frame->adaptive_threshold * sqrt(pixel->mean))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static colour_t pixel_finish(const rt_integrator_frame_t *frame, const pixel_accumulator_t *pixel)
+{
+    atomic_fetch_add_explicit(&gs_pixels, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_samples, (uint64_t)pixel->samples, memory_order_relaxed);
+
+    if (0 == pixel->samples)
+    {
+        return pixel->sum;
+    }
+    return vec3_scale(pixel->sum, (double)frame->number_of_samples / pixel->samples);
+}
+
+colour_t rt_integrator_pixel_colour(const rt_integrator_frame_t *frame, int x, int y)
+{
+    assert(NULL != frame);
+
+    pixel_accumulator_t pixel = {.sum = colour(0, 0, 0)};
+    bool done = frame->number_of_samples <= 0;
+    for (long s = 0; !done; ++s)
+    {
+        ray_t ray = camera_ray(frame, x, y, s);
+        colour_t value = trace_path(&ray, NULL, frame->world, frame->lights, frame->skybox, frame->max_depth);
+        done = pixel_add_sample(frame, &pixel, value);
+    }
+
+    return pixel_finish(frame, &pixel);
+}
+
+// Renders count (at most RT_RAY_PACKET_SIZE) neighbouring pixels of a row. Every round the pixels that still need
+// samples find the first hits of their camera rays together, then each path goes on alone from its hit.
+static void packet_colour(const rt_integrator_frame_t *frame, int x, int count, int y, colour_t *out)
+{
+    pixel_accumulator_t pixels[RT_RAY_PACKET_SIZE];
+    for (int lane = 0; lane < count; ++lane)
+    {
+        pixels[lane] = (pixel_accumulator_t){.sum = colour(0, 0, 0)};
+    }
+
+    unsigned active = frame->number_of_samples > 0 ? (1u << count) - 1 : 0;
+    for (long s = 0; 0 != active; ++s)
+    {
+        rt_ray_packet_t packet;
+        double t_max[RT_RAY_PACKET_SIZE];
+        for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+        {
+            t_max[lane] = INFINITY;
+            if (active & (1u << lane))
+            {
+                packet.rays[lane] = camera_ray(frame, x + lane, y, s);
+                rt_random_begin_bounce(0);
+                rt_random_save(&packet.random[lane]);
+            }
+        }
+        rt_ray_packet_prepare(&packet, active);
+
+        rt_hit_record_t records[RT_RAY_PACKET_SIZE];
+        unsigned hits = rt_hittable_list_hit_packet(frame->world, &packet, active, RT_INTEGRATOR_T_MIN, t_max, records);
+
+        for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+        {
+            if (0 == (active & (1u << lane)))
+            {
+                continue;
+            }
+
+            primary_hit_t primary = {.hit = 0 != (hits & (1u << lane))};
+            if (primary.hit)
+            {
+                primary.record = records[lane];
+            }
+            rt_random_restore(&packet.random[lane]);
+            colour_t value =
+                trace_path(&packet.rays[lane], &primary, frame->world, frame->lights, frame->skybox, frame->max_depth);
+            if (pixel_add_sample(frame, &pixels[lane], value))
+            {
+                active &= ~(1u << lane);
+            }
+        }
+    }
+
+    for (int lane = 0; lane < count; ++lane)
+    {
+        out[lane] = pixel_finish(frame, &pixels[lane]);
+    }
+}
+
+void rt_integrator_row_colour(const rt_integrator_frame_t *frame, int x_begin, int x_end, int y, colour_t *out)
+{
+    assert(NULL != frame);
+    assert(NULL != out);
+
+    if (!frame->trace_packets)
+    {
+        for (int x = x_begin; x < x_end; ++x)
+        {
+            out[x - x_begin] = rt_integrator_pixel_colour(frame, x, y);
+        }
+        return;
+    }
+
+    for (int x = x_begin; x < x_end; x += RT_RAY_PACKET_SIZE)
+    {
+        int count = x_end - x < RT_RAY_PACKET_SIZE ? x_end - x : RT_RAY_PACKET_SIZE;
+        packet_colour(frame, x, count, y, out + (x - x_begin));
+    }
+}
+
+// Paths of one wave of a tile: one sample of every pixel that still needs samples
+typedef struct wavefront_s
+{
+    path_state_t *paths;
+    rt_random_context_t *random;
+    // Tile pixel the path belongs to
+    int *pixels;
+
+    // Paths to intersect at the current bounce, in the order of their pixels unless sort_rays is set
+    int *queue;
+    int queue_size;
+    // Sort keys and the scratch space of the radix sort
+    uint32_t *keys;
+    uint32_t *sorted_keys;
+    int *sorted_queue;
+    // Pixel order of the queue before it was sorted, kept for the bounces traced again unsorted with measure_sorting
+    int *unsorted_queue;
+    int unsorted_size;
+    int sorted_bounces;
+    // Ray origins are quantized within the bounds of the world for their Morton codes
+    rt_aabb_t bounds;
+    vec3_t bounds_scale;
+
+    rt_hit_record_t *records;
+    // Whether the path goes on after the current bounce
+    bool *alive;
+    // Paths that hit something, bucketed by the type of the material they've hit
+    int *material_queue;
+    int material_offsets[RT_INTEGRATOR_MATERIAL_TYPES + 1];
+
+    // Statistics of the tile
+    uint64_t secondary_rays;
+    uint64_t secondary_traversal_ns;
+    uint64_t sorted_rays;
+    uint64_t sort_ns;
+    uint64_t probed_rays;
+    uint64_t probed_sorted_ns;
+    uint64_t probed_unsorted_ns;
+} wavefront_t;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Spreads the lower 9 bits of x so that there are two zero bits between every two of them
+static inline uint32_t morton_spread(uint32_t x)
+{
+    x &= 0x1ffu;
+    x = (x | (x << 16u)) & 0x030000ffu;
+    x = (x | (x << 8u)) & 0x0300f00fu;
+    x = (x | (x << 4u)) & 0x030c30c3u;
+    x = (x | (x << 2u)) & 0x09249249u;
+    return x;
+}
+
+// Sort key of a ray: octant of its direction in the upper bits, Morton code of its origin in the lower 27
+static uint32_t ray_sort_key(const wavefront_t *wave, const ray_t *ray)
+{
+    uint32_t octant = (ray->direction.x < 0 ? 4u : 0u) | (ray->direction.y < 0 ? 2u : 0u) |
+                      (ray->direction.z < 0 ? 1u : 0u);
+
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double cell = (ray->origin.components[axis] - wave->bounds.min.components[axis]) *
+                      wave->bounds_scale.components[axis];
+        uint32_t quantized = cell > 0 ? (cell < RT_INTEGRATOR_MORTON_CELLS - 1 ? (uint32_t)cell
+                                                                                : RT_INTEGRATOR_MORTON_CELLS - 1)
+                                      : 0;
+        code |= morton_spread(quantized) << (2 - axis);
+    }
+
+    return (octant << 27u) | code;
+}
+
+// Stable LSD radix sort of the queue by the sort keys of the paths' rays, so rays that are about to visit the same
+// BVH nodes are traced next to each other
+static void wavefront_sort(wavefront_t *wave)
+{
+    for (int i = 0; i < wave->queue_size; ++i)
+    {
+        wave->keys[i] = ray_sort_key(wave, &wave->paths[wave->queue[i]].ray);
+    }
+
+    // The passes of the radix sort cost the same no matter how many rays there are, and later bounces have few
+    if (wave->queue_size <= RT_INTEGRATOR_SMALL_SORT)
+    {
+        for (int i = 1; i < wave->queue_size; ++i)
+        {
+            uint32_t key = wave->keys[i];
+            int path = wave->queue[i];
+            int j = i;
+            for (; j > 0 && wave->keys[j - 1] > key; --j)
+            {
+                wave->keys[j] = wave->keys[j - 1];
+                wave->queue[j] = wave->queue[j - 1];
+            }
+            wave->keys[j] = key;
+            wave->queue[j] = path;
+        }
+        return;
+    }
+
+    for (unsigned shift = 0; shift < 32; shift += 8)
+    {
+        int offsets[257] = {0};
+        for (int i = 0; i < wave->queue_size; ++i)
+        {
+            offsets[((wave->keys[i] >> shift) & 0xffu) + 1]++;
+        }
+        if (offsets[((wave->keys[0] >> shift) & 0xffu) + 1] == wave->queue_size)
+        {
+            continue; // All the keys share this digit
+        }
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            offsets[digit + 1] += offsets[digit];
+        }
+        for (int i = 0; i < wave->queue_size; ++i)
+        {
+            int index = offsets[(wave->keys[i] >> shift) & 0xffu]++;
+            wave->sorted_keys[index] = wave->keys[i];
+            wave->sorted_queue[index] = wave->queue[i];
+        }
+
+        uint32_t *keys = wave->keys;
+        wave->keys = wave->sorted_keys;
+        wave->sorted_keys = keys;
+        int *queue = wave->queue;
+        wave->queue = wave->sorted_queue;
+        wave->sorted_queue = queue;
+    }
+}
+
+static inline rt_material_type_t material_type(const rt_hit_record_t *record)
+{
+    const rt_material_t *material = record->material;
+    return material->type;
+}
+
+// Finds the closest hits of all the queued paths, shades the misses and buckets the hits by material type
+static void wavefront_intersect(const rt_integrator_frame_t *frame, wavefront_t *wave)
+{
+    int counts[RT_INTEGRATOR_MATERIAL_TYPES] = {0};
+    int hits = 0;
+    for (int begin = 0; begin < wave->queue_size; begin += RT_RAY_PACKET_SIZE)
+    {
+        int count = wave->queue_size - begin < RT_RAY_PACKET_SIZE ? wave->queue_size - begin : RT_RAY_PACKET_SIZE;
+        const int *group = wave->queue + begin;
+        unsigned found = 0;
+        if (frame->trace_packets)
+        {
+            rt_ray_packet_t packet;
+            double t_max[RT_RAY_PACKET_SIZE];
+            rt_hit_record_t records[RT_RAY_PACKET_SIZE];
+            for (int lane = 0; lane < count; ++lane)
+            {
+                int path = group[lane];
+                rt_random_restore(&wave->random[path]);
+                rt_random_begin_bounce((uint32_t)wave->paths[path].depth);
+                rt_random_save(&packet.random[lane]);
+                packet.rays[lane] = wave->paths[path].ray;
+                t_max[lane] = INFINITY;
+            }
+            unsigned mask = (1u << count) - 1;
+            rt_ray_packet_prepare(&packet, mask);
+            found = rt_hittable_list_hit_packet(frame->world, &packet, mask, RT_INTEGRATOR_T_MIN, t_max, records);
+            for (int lane = 0; lane < count; ++lane)
+            {
+                int path = group[lane];
+                wave->random[path] = packet.random[lane];
+                if (found & (1u << lane))
+                {
+                    wave->records[path] = records[lane];
+                }
+            }
+        }
+        else
+        {
+            for (int lane = 0; lane < count; ++lane)
+            {
+                int path = group[lane];
+                rt_random_restore(&wave->random[path]);
+                rt_random_begin_bounce((uint32_t)wave->paths[path].depth);
+                if (rt_hittable_list_hit_test(frame->world, &wave->paths[path].ray, RT_INTEGRATOR_T_MIN, INFINITY,
+                                              &wave->records[path]))
+                {
+                    found |= 1u << lane;
+                }
+                rt_random_save(&wave->random[path]);
+            }
+        }
+
+        for (int lane = 0; lane < count; ++lane)
+        {
+            int path = group[lane];
+            if (found & (1u << lane))
+            {
+                counts[material_type(&wave->records[path])]++;
+                wave->queue[hits++] = path;
+            }
+            else
+            {
+                path_miss(&wave->paths[path], frame->skybox);
+            }
+        }
+    }
+
+    // Counting sort keeps the queue order within every material
+    wave->material_offsets[0] = 0;
+    for (int type = 0; type < RT_INTEGRATOR_MATERIAL_TYPES; ++type)
+    {
+        wave->material_offsets[type + 1] = wave->material_offsets[type] + counts[type];
+        counts[type] = wave->material_offsets[type];
+    }
+    for (int i = 0; i < hits; ++i)
+    {
+        int path = wave->queue[i];
+        wave->material_queue[counts[material_type(&wave->records[path])]++] = path;
+    }
+    wave->queue_size = hits;
+}
+
+// Finds the closest hits of the paths in order the way wavefront_intersect does, but only to see how long it takes: the
+// hits are thrown away and the paths are left as they are
+static void wavefront_probe(const rt_integrator_frame_t *frame, const wavefront_t *wave, const int *order, int size)
+{
+    for (int begin = 0; begin < size; begin += RT_RAY_PACKET_SIZE)
+    {
+        int count = size - begin < RT_RAY_PACKET_SIZE ? size - begin : RT_RAY_PACKET_SIZE;
+        const int *group = order + begin;
+        rt_hit_record_t records[RT_RAY_PACKET_SIZE];
+        if (frame->trace_packets)
+        {
+            rt_ray_packet_t packet;
+            double t_max[RT_RAY_PACKET_SIZE];
+            for (int lane = 0; lane < count; ++lane)
+            {
+                int path = group[lane];
+                rt_random_restore(&wave->random[path]);
+                rt_random_begin_bounce((uint32_t)wave->paths[path].depth);
+                rt_random_save(&packet.random[lane]);
+                packet.rays[lane] = wave->paths[path].ray;
+                t_max[lane] = INFINITY;
+            }
+            unsigned mask = (1u << count) - 1;
+            rt_ray_packet_prepare(&packet, mask);
+            rt_hittable_list_hit_packet(frame->world, &packet, mask, RT_INTEGRATOR_T_MIN, t_max, records);
+        }
+        else
+        {
+            for (int lane = 0; lane < count; ++lane)
+            {
+                int path = group[lane];
+                rt_random_restore(&wave->random[path]);
+                rt_random_begin_bounce((uint32_t)wave->paths[path].depth);
+                rt_hittable_list_hit_test(frame->world, &wave->paths[path].ray, RT_INTEGRATOR_T_MIN, INFINITY,
+                                          &records[lane]);
+            }
+        }
+    }
+}
+
+// Shades the hits one material type after another and queues the paths that go on
+static void wavefront_shade(const rt_integrator_frame_t *frame, wavefront_t *wave)
+{
+    bool sample_lights = rt_hittable_list_get_size(frame->lights) > 0;
+
+    for (int type = 0; type < RT_INTEGRATOR_MATERIAL_TYPES; ++type)
+    {
+        for (int i = wave->material_offsets[type]; i < wave->material_offsets[type + 1]; ++i)
+        {
+            int path = wave->material_queue[i];
+            rt_random_restore(&wave->random[path]);
+            wave->alive[path] = path_shade(&wave->paths[path], &wave->records[path], frame->world, frame->lights,
+                                           sample_lights) &&
+                                wave->paths[path].depth < frame->max_depth;
+            rt_random_save(&wave->random[path]);
+        }
+    }
+
+    // The next bounce traces the survivors in the order of their pixels again, which keeps the rays of neighbouring
+    // pixels next to each other, unless they're sorted
+    int next_size = 0;
+    for (int i = 0; i < wave->queue_size; ++i)
+    {
+        if (wave->alive[wave->queue[i]])
+        {
+            wave->queue[next_size++] = wave->queue[i];
+        }
+    }
+    wave->queue_size = next_size;
+
+    if (frame->sort_rays && next_size > 1)
+    {
+        if (frame->measure_sorting && wave->sorted_bounces++ % RT_INTEGRATOR_SORT_PROBE_INTERVAL == 0)
+        {
+            memcpy(wave->unsorted_queue, wave->queue, next_size * sizeof(int));
+            wave->unsorted_size = next_size;
+        }
+
+        uint64_t start = now_ns();
+        wavefront_sort(wave);
+        wave->sort_ns += now_ns() - start;
+        wave->sorted_rays += next_size;
+    }
+}
+
+// Renders a tile one sample of all its pixels at a time, every sample bounce by bounce
+static void wavefront_colour(const rt_integrator_frame_t *frame, int x_begin, int x_end, int y_top, int rows,
+                             colour_t *out, size_t row_stride)
+{
+    int width = x_end - x_begin;
+    int size = width * rows;
+    if (size <= 0)
+    {
+        return;
+    }
+
+    wavefront_t wave = {0};
+    wave.paths = calloc(size, sizeof(path_state_t));
+    assert(NULL != wave.paths);
+    wave.random = calloc(size, sizeof(rt_random_context_t));
+    assert(NULL != wave.random);
+    wave.pixels = calloc(size, sizeof(int));
+    assert(NULL != wave.pixels);
+    wave.queue = calloc(size, sizeof(int));
+    assert(NULL != wave.queue);
+    wave.alive = calloc(size, sizeof(bool));
+    assert(NULL != wave.alive);
+    wave.material_queue = calloc(size, sizeof(int));
+    assert(NULL != wave.material_queue);
+    wave.records = calloc(size, sizeof(rt_hit_record_t));
+    assert(NULL != wave.records);
+    if (frame->sort_rays)
+    {
+        wave.keys = calloc(size, sizeof(uint32_t));
+        assert(NULL != wave.keys);
+        wave.sorted_keys = calloc(size, sizeof(uint32_t));
+        assert(NULL != wave.sorted_keys);
+        wave.sorted_queue = calloc(size, sizeof(int));
+        assert(NULL != wave.sorted_queue);
+        if (frame->measure_sorting)
+        {
+            wave.unsorted_queue = calloc(size, sizeof(int));
+            assert(NULL != wave.unsorted_queue);
+        }
+
+        // A world without bounds only gets sorted by the direction
+        if (rt_hittable_list_bb(frame->world, 0, 1, &wave.bounds))
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double extent = wave.bounds.max.components[axis] - wave.bounds.min.components[axis];
+                wave.bounds_scale.components[axis] = extent > 0 ? RT_INTEGRATOR_MORTON_CELLS / extent : 0;
+            }
+        }
+    }
+
+    pixel_accumulator_t *pixels = calloc(size, sizeof(pixel_accumulator_t));
+    assert(NULL != pixels);
+    // Pixels that still need samples, in tile order
+    int *active = calloc(size, sizeof(int));
+    assert(NULL != active);
+    int active_size = frame->number_of_samples > 0 ? size : 0;
+    for (int i = 0; i < size; ++i)
+    {
+        pixels[i].sum = colour(0, 0, 0);
+        active[i] = i;
+    }
+
+    for (long s = 0; active_size > 0; ++s)
+    {
+        for (int i = 0; i < active_size; ++i)
+        {
+            int pixel = active[i];
+            ray_t ray = camera_ray(frame, x_begin + pixel % width, y_top - pixel / width, s);
+            path_start(&wave.paths[i], &ray);
+            rt_random_save(&wave.random[i]);
+            wave.pixels[i] = pixel;
+            wave.queue[i] = i;
+        }
+        wave.queue_size = frame->max_depth > 0 ? active_size : 0;
+
+        while (wave.queue_size > 0)
+        {
+            // All the paths of a wave are at the same bounce
+            if (wave.paths[wave.queue[0]].depth > 0)
+            {
+                int queue_size = wave.queue_size;
+                uint64_t start = now_ns();
+                wavefront_intersect(frame, &wave);
+                uint64_t traversal_ns = now_ns() - start;
+                wave.secondary_rays += queue_size;
+                wave.secondary_traversal_ns += traversal_ns;
+
+                // The same rays once more in pixel order. They go second, so they find the nodes and triangles in the
+                // cache the sorted ones have just loaded, the speedup measured that way errs on the low side.
+                if (wave.unsorted_size > 0)
+                {
+                    start = now_ns();
+                    wavefront_probe(frame, &wave, wave.unsorted_queue, wave.unsorted_size);
+                    wave.probed_unsorted_ns += now_ns() - start;
+                    wave.probed_sorted_ns += traversal_ns;
+                    wave.probed_rays += queue_size;
+                    wave.unsorted_size = 0;
+                }
+            }
+            else
+            {
+                wavefront_intersect(frame, &wave);
+            }
+            wavefront_shade(frame, &wave);
+        }
+
+        int still_active = 0;
+        for (int i = 0; i < active_size; ++i)
+        {
+            int pixel = wave.pixels[i];
+            if (!pixel_add_sample(frame, &pixels[pixel], wave.paths[i].result))
+            {
+                active[still_active++] = pixel;
+            }
+        }
+        active_size = still_active;
+    }
+
+    for (int i = 0; i < size; ++i)
+    {
+        out[(size_t)(i / width) * row_stride + i % width] = pixel_finish(frame, &pixels[i]);
+    }
+
+    atomic_fetch_add_explicit(&gs_secondary_rays, wave.secondary_rays, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_secondary_traversal_ns, wave.secondary_traversal_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_sorted_rays, wave.sorted_rays, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_sort_ns, wave.sort_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_probed_rays, wave.probed_rays, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_probed_sorted_ns, wave.probed_sorted_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gs_probed_unsorted_ns, wave.probed_unsorted_ns, memory_order_relaxed);
+
+    free(active);
+    free(pixels);
+    free(wave.unsorted_queue);
+    free(wave.sorted_queue);
+    free(wave.sorted_keys);
+    free(wave.keys);
+    free(wave.records);
+    free(wave.material_queue);
+    free(wave.alive);
+    free(wave.queue);
+    free(wave.pixels);
+    free(wave.random);
+    free(wave.paths);
+}
+
+void rt_integrator_tile_colour(const rt_integrator_frame_t *frame, int x_begin, int x_end, int y_top, int rows,
+                               colour_t *out, size_t row_stride)
+{
+    assert(NULL != frame);
+    assert(NULL != out);
+
+    if (frame->wavefront)
+    {
+        wavefront_colour(frame, x_begin, x_end, y_top, rows, out, row_stride);
+        return;
+    }
+
+    for (int row = 0; row < rows; ++row)
+    {
+        rt_integrator_row_colour(frame, x_begin, x_end, y_top - row, out + (size_t)row * row_stride);
+    }
+}
+
+void rt_integrator_get_stats(rt_integrator_stats_t *stats)
+{
+    assert(NULL != stats);
+
+    stats->pixels = atomic_load(&gs_pixels);
+    stats->samples = atomic_load(&gs_samples);
+    stats->secondary_rays = atomic_load(&gs_secondary_rays);
+    stats->secondary_traversal_ns = atomic_load(&gs_secondary_traversal_ns);
+    stats->sorted_rays = atomic_load(&gs_sorted_rays);
+    stats->sort_ns = atomic_load(&gs_sort_ns);
+    stats->probed_rays = atomic_load(&gs_probed_rays);
+    stats->probed_sorted_ns = atomic_load(&gs_probed_sorted_ns);
+    stats->probed_unsorted_ns = atomic_load(&gs_probed_unsorted_ns);
+}
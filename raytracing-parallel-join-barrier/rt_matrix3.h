@@ -9,13 +9,9 @@
 
 #include <rt_vec3.h>
 
-typedef union rt_matrix3_u
+typedef struct rt_matrix3_s
 {
-    double matrix[3][3];
-    struct
-    {
-        vec3_t columns[3];
-    };
+    rt_real_t matrix[3][3];
 } rt_matrix3_t;
 
 static inline vec3_t rt_mat3_mul_vec3(const rt_matrix3_t *a, const vec3_t *b)
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <stdatomic.h>
+#include <stddef.h>
+#include "rt_random.h"
+
+// Key used by rt_random_begin_sample before the first bounce, for the pixel jitter and camera samples
+#define RT_RANDOM_CAMERA_BOUNCE UINT32_MAX
+
+typedef struct rt_random_key_s
+{
+    uint64_t pixel_index;
+    uint32_t sample;
+} rt_random_key_t;
+
+_Thread_local rt_random_state_t rt_random_thread_state;
+_Thread_local rt_random_dimensions_t rt_random_thread_dimensions;
+
+static _Thread_local rt_random_key_t gs_thread_key;
+static atomic_uint_fast64_t gs_next_thread_stream;
+static uint64_t gs_frame_seed;
+static rt_random_pattern_fn gs_pattern_fn;
+static const void *gs_pattern;
+
+void rt_random_seed(uint64_t seed, uint64_t stream)
+{
+    rt_random_state_t *rng = &rt_random_thread_state;
+
+    rng->state = 0u;
+    rng->inc = (stream << 1u) | 1u;
+    rt_random_u32();
+    rng->state += seed;
+    rt_random_u32();
+}
+
+void rt_random_seed_thread(void)
+{
+    // Threads are numbered in the order of their first draw, so their streams change from run to run. Scenes stay the
+    // same anyway: every random draw that places objects is made by the main thread, whose stream is fixed by
+    // rt_random_set_seed, and the workers (already running the BVH build tasks then) draw nothing before rendering.
+    uint64_t stream = atomic_fetch_add(&gs_next_thread_stream, 1);
+    rt_random_seed(0x853c49e6748fea9bULL ^ (stream * 0x9e3779b97f4a7c15ULL), stream);
+}
+
+void rt_random_set_seed(uint64_t seed)
+{
+    gs_frame_seed = seed;
+    rt_random_seed(0x853c49e6748fea9bULL, 0);
+}
+
+void rt_random_begin_sample(uint64_t pixel_index, uint32_t sample)
+{
+    gs_thread_key.pixel_index = pixel_index;
+    gs_thread_key.sample = sample;
+    rt_random_begin_bounce(RT_RANDOM_CAMERA_BOUNCE);
+}
+
+void rt_random_begin_bounce(uint32_t bounce)
+{
+    // Every pixel gets a stream of its own, samples and bounces pick hashed starting points within it
+    uint64_t seed = rt_random_mix64(gs_frame_seed ^ rt_random_mix64(gs_thread_key.pixel_index));
+    seed = rt_random_mix64(seed ^ (((uint64_t)gs_thread_key.sample << 32u) | bounce));
+    rt_random_seed(seed, gs_thread_key.pixel_index);
+
+    // Points are only made when they are drawn, most bounces don't use all of them
+    rt_random_dimensions_t *dimensions = &rt_random_thread_dimensions;
+    dimensions->bounce = bounce;
+    dimensions->next = 0;
+    dimensions->count = NULL != gs_pattern_fn && bounce < RT_RANDOM_PATTERN_BOUNCES ? RT_RANDOM_PATTERN_DIMENSIONS : 0;
+}
+
+void rt_random_set_pattern(rt_random_pattern_fn fn, const void *pattern)
+{
+    gs_pattern_fn = fn;
+    gs_pattern = pattern;
+}
+
+void rt_random_pattern_point(double *u, double *v)
+{
+    rt_random_dimensions_t *dimensions = &rt_random_thread_dimensions;
+    gs_pattern_fn(gs_pattern, gs_thread_key.pixel_index, gs_thread_key.sample, dimensions->bounce, dimensions->next++,
+                  u, v);
+}
+
+void rt_random_save(rt_random_context_t *context)
+{
+    context->state = rt_random_thread_state;
+    context->dimensions = rt_random_thread_dimensions;
+    context->pixel_index = gs_thread_key.pixel_index;
+    context->sample = gs_thread_key.sample;
+}
+
+void rt_random_restore(const rt_random_context_t *context)
+{
+    rt_random_thread_state = context->state;
+    rt_random_thread_dimensions = context->dimensions;
+    gs_thread_key.pixel_index = context->pixel_index;
+    gs_thread_key.sample = context->sample;
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_RAY_PACKET_H
+#define RAY_TRACING_ONE_WEEK_RT_RAY_PACKET_H
+
+#include <stdbool.h>
+#include "rt_weekend.h"
+
+// Number of rays traced together, one per lane of a 256-bit vector of doubles
+#define RT_RAY_PACKET_SIZE (4)
+#define RT_RAY_PACKET_FULL_MASK ((1u << RT_RAY_PACKET_SIZE) - 1)
+
+// Rays that are traced together, e.g. the camera rays of neighbouring pixels. Every packet query takes the mask of the
+// lanes it works on and leaves the other lanes alone, so a packet may be partially filled.
+typedef struct rt_ray_packet_s
+{
+    ray_t rays[RT_RAY_PACKET_SIZE];
+
+    // Structure of arrays copy of the rays for the lane-parallel tests, filled by rt_ray_packet_prepare
+    double origin[3][RT_RAY_PACKET_SIZE];
+    double direction[3][RT_RAY_PACKET_SIZE];
+
+    // Random stream of every lane. Anything that draws random numbers on behalf of a lane has to switch to its stream
+    // first, so that the lane gets the same draws as a single ray would.
+    rt_random_context_t random[RT_RAY_PACKET_SIZE];
+} rt_ray_packet_t;
+
+// Fills the structure of arrays copy of the rays of the lanes in mask, the other lanes are zeroed
+void rt_ray_packet_prepare(rt_ray_packet_t *packet, unsigned mask);
+
+// Picks the lane tests for the CPU we're running on, allow_simd set to false selects the scalar ones
+void rt_ray_packet_set_simd(bool allow_simd);
+const char *rt_ray_packet_get_simd_name(void);
+
+// Intersects the rays of the lanes in mask with a sphere. Returns the lanes that hit it within (t_min, t_max[lane])
+// and writes their distances to t. The distances are bit for bit the ones rt_sphere_hit_test_generic finds.
+unsigned rt_ray_packet_sphere_test(const rt_ray_packet_t *packet, unsigned mask, point3_t center, double radius,
+                                   double t_min, const double *t_max, double *t);
+
+// Same for an axis-aligned rectangle: the plane axis_k == k, limited to [min_1, max_1] along axis_1 and
+// [min_2, max_2] along axis_2. The distances are the ones the rectangle's hit function finds.
+unsigned rt_ray_packet_rect_test(const rt_ray_packet_t *packet, unsigned mask, int axis_k, double k, int axis_1,
+                                 double min_1, double max_1, int axis_2, double min_2, double max_2, double t_min,
+                                 const double *t_max, double *t);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_RAY_PACKET_H
@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_THREAD_POOL_H
+#define RAY_TRACING_ONE_WEEK_RT_THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct rt_thread_pool_s rt_thread_pool_t;
+
+typedef void (*rt_thread_pool_job_fn)(void *arg);
+
+// Starts a pool of persistent worker threads. Workers sleep until a job is submitted and are only joined on delete, so
+// the same pool may be reused for any number of frames. With pin_workers set, worker i is bound to the i-th CPU the
+// process is allowed to run on (ignored on platforms without thread affinity support). Returns NULL if one of the
+// workers can't be started.
+rt_thread_pool_t *rt_thread_pool_new(size_t number_of_workers, bool pin_workers);
+
+// Number of CPUs this process can actually use: online CPUs, narrowed down by the affinity mask and by the cgroup CPU
+// quota when running inside a container.
+size_t rt_thread_pool_available_cpus(void);
+
+// Queues a job. Jobs are picked up by the workers in FIFO order. It's safe to submit jobs from inside another job.
+void rt_thread_pool_submit(rt_thread_pool_t *pool, rt_thread_pool_job_fn job, void *arg);
+
+// Blocks the caller until every submitted job (including the ones submitted by other jobs) has finished.
+void rt_thread_pool_wait(rt_thread_pool_t *pool);
+
+size_t rt_thread_pool_get_size(const rt_thread_pool_t *pool);
+
+void rt_thread_pool_delete(rt_thread_pool_t *pool);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_THREAD_POOL_H
@@ -14,6 +14,7 @@
 #include <rt_bvh.h>
 #include <rt_aa_rect.h>
 #include <rt_instance.h>
+#include <rt_mesh.h>
 #include <string.h>
 #include <assert.h>
 
@@ -339,6 +340,45 @@ rt_hittable_list_t *rt_scene_metal_test(void)
     return objects;
 }
 
+rt_hittable_list_t *rt_scene_mesh_test(void)
+{
+    rt_material_t *checker =
+        rt_mt_diffuse_new_with_texture(rt_texture_cp_new_with_colour(colour(0.2, 0.3, 0.1), colour(0.9, 0.9, 0.9)));
+
+    rt_hittable_list_t *objects = rt_hittable_list_init(8);
+
+    // The tori lie around the y axis, the ground touches their lower side
+    rt_hittable_list_add(objects, rt_sphere_new(point3(0, -1000.4, 0), 1000, checker));
+
+    rt_hittable_t *glass = rt_mesh_load_obj("assets/meshes/torus.obj", rt_mt_dielectric_new(1.5));
+    if (NULL != glass)
+    {
+        rt_hittable_list_add(objects, glass);
+    }
+
+    // One copy of the triangles is shared by all the instances around the glass torus
+    rt_hittable_t *torus = rt_mesh_load_obj("assets/meshes/torus.obj", rt_mt_metal_new(colour(0.8, 0.6, 0.3), 0.2));
+    if (NULL != torus)
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            double angle = RT_DEG_TO_RAD(60.0 * i);
+            rt_hittable_t *instance = rt_instance_new(rt_hittable_claim(torus));
+            rt_instance_rotate_y(instance, 60.0 * i);
+            rt_instance_translate(instance, point3(3.2 * cos(angle), 0, 3.2 * sin(angle)));
+            rt_hittable_list_add(objects, instance);
+        }
+        rt_hittable_delete(torus);
+    }
+
+    rt_hittable_list_t *result = rt_hittable_list_init(1);
+    rt_hittable_list_add(result, rt_bvh_node_new(objects, 0, 1));
+
+    rt_hittable_list_deinit(objects);
+
+    return result;
+}
+
 typedef struct rt_scenes_s
 {
     rt_scene_id_t id;
@@ -357,6 +397,7 @@ static rt_scenes_t gs_scenes[] = {
     {RT_SCENE_CORNELL_SMOKE, "cornell_smoke", "Cornell box scene but boxes as made of smoke"},
     {RT_SCENE_SHOWCASE, "showcase", "Scene from \'Ray Tracing: The Next Week\' cover"},
     {RT_SCENE_METAL_TEST, "metal_test", "Test for metal texture (several metal spheres)"},
+    {RT_SCENE_MESH_TEST, "mesh_test", "Triangle meshes loaded from an OBJ file and instanced"},
 };
 
 rt_scene_id_t rt_scene_get_id_by_name(const char *name)
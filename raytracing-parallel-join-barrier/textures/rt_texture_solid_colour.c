@@ -20,7 +20,7 @@ static void rt_texture_sc_delete(rt_texture_t *texture);
 
 rt_texture_t *rt_texture_sc_new(colour_t colour)
 {
-    rt_texture_sc_t *result = calloc(1, sizeof(rt_texture_sc_t));
+    rt_texture_sc_t *result = rt_arena_calloc(sizeof(rt_texture_sc_t));
     assert(NULL != result);
 
     result->colour = colour;
@@ -6,6 +6,7 @@
  */
 #include "rt_aa_rect.h"
 #include <rt_hittable_shared.h>
+#include <rt_hittable_list.h>
 #include <assert.h>
 
 typedef struct rt_aa_rect_s
@@ -21,13 +22,21 @@ typedef struct rt_aa_rect_s
 
 static bool rt_aa_rect_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                            rt_hit_record_t *record);
+static bool rt_aa_rect_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static unsigned rt_aa_rect_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                      double t_min, double *t_max, rt_hit_record_t *records);
+static void rt_aa_rect_fill_record(const rt_aa_rect_t *rect, const ray_t *ray, double t, const point3_t *hit,
+                                   rt_hit_record_t *record);
 static bool rt_aa_rect_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void rt_aa_rect_delete(rt_hittable_t *hittable);
+static vec3_t rt_aa_rect_random(const rt_hittable_t *hittable, const point3_t *origin);
+static double rt_aa_rect_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction);
+static void rt_aa_rect_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights);
 
 rt_hittable_t *rt_aa_rect_new(rt_aa_rect_type_t type, double axis1_min, double axis1_max, double axis2_min,
                               double axis2_max, double k, rt_material_t *material)
 {
-    rt_aa_rect_t *result = calloc(1, sizeof(rt_aa_rect_t));
+    rt_aa_rect_t *result = rt_arena_calloc(sizeof(rt_aa_rect_t));
     assert(NULL != result);
 
     result->material = material;
@@ -65,6 +74,9 @@ rt_hittable_t *rt_aa_rect_new(rt_aa_rect_type_t type, double axis1_min, double a
     result->axis2_max = axis2_max;
 
     rt_hittable_init(&result->base, RT_HITTABLE_TYPE_AA_RECT, rt_aa_rect_hit, rt_aa_rect_bb, rt_aa_rect_delete);
+    result->base.occluded = rt_aa_rect_occluded;
+    result->base.hit_packet = rt_aa_rect_hit_packet;
+    rt_hittable_init_light_sampling(&result->base, rt_aa_rect_random, rt_aa_rect_pdf_value, rt_aa_rect_collect_lights);
 
     return (rt_hittable_t *)result;
 }
@@ -94,18 +106,57 @@ bool rt_aa_rect_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_mi
 
     if (NULL != record)
     {
-        record->material = rect->material;
-        record->u = (hit_axis_1 - rect->axis1_min) / (rect->axis1_max - rect->axis1_min);
-        record->v = (hit_axis_2 - rect->axis2_min) / (rect->axis2_max - rect->axis2_min);
-        record->t = t;
-        record->p = hit;
-
-        rt_hit_record_set_front_face(record, ray, &rect->outward_normal);
+        rt_aa_rect_fill_record(rect, ray, t, &hit, record);
     }
 
     return true;
 }
 
+static bool rt_aa_rect_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    return rt_aa_rect_hit(hittable, ray, t_min, t_max, NULL);
+}
+
+static unsigned rt_aa_rect_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                      double t_min, double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+
+    assert(RT_HITTABLE_TYPE_AA_RECT == hittable->type);
+    rt_aa_rect_t *rect = (rt_aa_rect_t *)hittable;
+
+    double t[RT_RAY_PACKET_SIZE];
+    unsigned result = rt_ray_packet_rect_test(packet, mask, rect->axis_k, rect->k, rect->axis_1, rect->axis1_min,
+                                              rect->axis1_max, rect->axis_2, rect->axis2_min, rect->axis2_max, t_min,
+                                              t_max, t);
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (result & (1u << lane))
+        {
+            point3_t hit = ray_at(packet->rays[lane], t[lane]);
+            rt_aa_rect_fill_record(rect, &packet->rays[lane], t[lane], &hit, &records[lane]);
+            t_max[lane] = t[lane];
+        }
+    }
+    return result;
+}
+
+static void rt_aa_rect_fill_record(const rt_aa_rect_t *rect, const ray_t *ray, double t, const point3_t *hit,
+                                   rt_hit_record_t *record)
+{
+    double hit_axis_1 = hit->components[rect->axis_1];
+    double hit_axis_2 = hit->components[rect->axis_2];
+
+    record->material = rect->material;
+    record->u = (hit_axis_1 - rect->axis1_min) / (rect->axis1_max - rect->axis1_min);
+    record->v = (hit_axis_2 - rect->axis2_min) / (rect->axis2_max - rect->axis2_min);
+    record->t = t;
+    record->p = *hit;
+
+    rt_hit_record_set_front_face(record, ray, &rect->outward_normal);
+}
+
 bool rt_aa_rect_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != hittable);
@@ -126,6 +177,68 @@ bool rt_aa_rect_bb(const rt_hittable_t *hittable, double time0, double time1, rt
     return true;
 }
 
+// Uniformly picks a point of the rectangle
+static vec3_t rt_aa_rect_random(const rt_hittable_t *hittable, const point3_t *origin)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+
+    assert(RT_HITTABLE_TYPE_AA_RECT == hittable->type);
+    rt_aa_rect_t *rect = (rt_aa_rect_t *)hittable;
+
+    double u, v;
+    rt_random_double_2d(&u, &v);
+    point3_t point;
+    point.components[rect->axis_1] = rect->axis1_min + (rect->axis1_max - rect->axis1_min) * u;
+    point.components[rect->axis_2] = rect->axis2_min + (rect->axis2_max - rect->axis2_min) * v;
+    point.components[rect->axis_k] = rect->k;
+
+    return vec3_diff(point, *origin);
+}
+
+// Converts the uniform density over the area of the rectangle into the density over the solid angle seen from origin
+static double rt_aa_rect_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+    assert(NULL != direction);
+
+    assert(RT_HITTABLE_TYPE_AA_RECT == hittable->type);
+    rt_aa_rect_t *rect = (rt_aa_rect_t *)hittable;
+
+    rt_hit_record_t record;
+    ray_t ray = ray_init(*origin, *direction, 0);
+    if (!rt_aa_rect_hit(hittable, &ray, 0.001, INFINITY, &record))
+    {
+        return 0.0;
+    }
+
+    double length_squared = vec3_length_squared(*direction);
+    double distance_squared = record.t * record.t * length_squared;
+    double cosine = fabs(vec3_dot(*direction, rect->outward_normal)) / sqrt(length_squared);
+    double area = (rect->axis1_max - rect->axis1_min) * (rect->axis2_max - rect->axis2_min);
+    if (cosine <= 0 || area <= 0)
+    {
+        return 0.0;
+    }
+
+    return distance_squared / (cosine * area);
+}
+
+static void rt_aa_rect_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights)
+{
+    assert(NULL != hittable);
+    assert(NULL != lights);
+
+    assert(RT_HITTABLE_TYPE_AA_RECT == hittable->type);
+    rt_aa_rect_t *rect = (rt_aa_rect_t *)hittable;
+
+    if (rt_material_is_emissive(rect->material))
+    {
+        rt_hittable_list_add(lights, rt_hittable_claim(hittable));
+    }
+}
+
 void rt_aa_rect_delete(rt_hittable_t *hittable)
 {
     if (NULL == hittable)
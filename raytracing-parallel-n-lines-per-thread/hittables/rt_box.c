@@ -5,55 +5,52 @@
  * LICENSE file in the root directory of this source tree.
  */
 #include "rt_hittable.h"
-#include "rt_hittable_list.h"
-#include "rt_aa_rect.h"
 #include <rt_hittable_shared.h>
 #include <assert.h>
 
 typedef struct rt_box_s
 {
     rt_hittable_t base;
+    rt_material_t *material;
 
-    rt_hittable_list_t *sides;
     point3_t min;
     point3_t max;
 } rt_box_t;
 
+// Faces are numbered 2 * axis for the side at min and 2 * axis + 1 for the one at max. When a ray hits an edge or a
+// corner, the face with the lowest priority wins. That's the order the six rectangles a box used to be made of were
+// tested in, which keeps images exactly the same.
+static const int gs_face_priority[6] = {1, 2, 4, 3, 0, 5};
+
+// Axes the texture coordinates u and v run along on the faces perpendicular to every axis
+static const int gs_face_axes[3][2] = {
+    {VEC3_AXIS_Y, VEC3_AXIS_Z},
+    {VEC3_AXIS_X, VEC3_AXIS_Z},
+    {VEC3_AXIS_X, VEC3_AXIS_Y},
+};
+
 static bool rt_box_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                        rt_hit_record_t *record);
+static bool rt_box_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static unsigned rt_box_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                  double *t_max, rt_hit_record_t *records);
+static int rt_box_intersect(const rt_box_t *box, const ray_t *ray, double t_min, double t_max, double *out_t);
+static void rt_box_fill_record(const rt_box_t *box, const ray_t *ray, double t, int face, rt_hit_record_t *record);
 static bool rt_box_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void rt_box_delete(rt_hittable_t *hittable);
 
 rt_hittable_t *rt_box_new(point3_t min, point3_t max, rt_material_t *material)
 {
-    rt_box_t *result = calloc(1, sizeof(rt_box_t));
+    rt_box_t *result = rt_arena_calloc(sizeof(rt_box_t));
     assert(NULL != result);
 
+    result->material = material;
     result->min = min;
     result->max = max;
 
-    result->sides = rt_hittable_list_init(6);
-    assert(NULL != result->sides);
-
-    // Front and back
-    rt_hittable_list_add(result->sides, rt_aa_rect_new_xy(min.x, max.x, min.y, max.y, min.z, material));
-    // Left
-    rt_hittable_list_add(result->sides,
-                         rt_aa_rect_new_yz(min.y, max.y, min.z, max.z, min.x, rt_material_claim(material)));
-    // Right
-    rt_hittable_list_add(result->sides,
-                         rt_aa_rect_new_yz(min.y, max.y, min.z, max.z, max.x, rt_material_claim(material)));
-    // Top
-    rt_hittable_list_add(result->sides,
-                         rt_aa_rect_new_xz(min.x, max.x, min.z, max.z, max.y, rt_material_claim(material)));
-    // Bottom
-    rt_hittable_list_add(result->sides,
-                         rt_aa_rect_new_xz(min.x, max.x, min.z, max.z, min.y, rt_material_claim(material)));
-    // Back
-    rt_hittable_list_add(result->sides,
-                         rt_aa_rect_new_xy(min.x, max.x, min.y, max.y, max.z, rt_material_claim(material)));
-
     rt_hittable_init(&result->base, RT_HITTABLE_TYPE_BOX, rt_box_hit, rt_box_bb, rt_box_delete);
+    result->base.occluded = rt_box_occluded;
+    result->base.hit_packet = rt_box_hit_packet;
 
     return (rt_hittable_t *)result;
 }
@@ -66,7 +63,137 @@ bool rt_box_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, d
     assert(RT_HITTABLE_TYPE_BOX == hittable->type);
     rt_box_t *box = (rt_box_t *)hittable;
 
-    return rt_hittable_list_hit_test(box->sides, ray, t_min, t_max, record);
+    double t;
+    int face = rt_box_intersect(box, ray, t_min, t_max, &t);
+    if (face < 0)
+    {
+        return false;
+    }
+
+    rt_box_fill_record(box, ray, t, face, record);
+    return true;
+}
+
+static bool rt_box_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_BOX == hittable->type);
+    rt_box_t *box = (rt_box_t *)hittable;
+
+    double t;
+    return rt_box_intersect(box, ray, t_min, t_max, &t) >= 0;
+}
+
+static unsigned rt_box_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                  double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+
+    assert(RT_HITTABLE_TYPE_BOX == hittable->type);
+    rt_box_t *box = (rt_box_t *)hittable;
+
+    unsigned result = 0;
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        double t;
+        int face = rt_box_intersect(box, &packet->rays[lane], t_min, t_max[lane], &t);
+        if (face >= 0)
+        {
+            rt_box_fill_record(box, &packet->rays[lane], t, face, &records[lane]);
+            t_max[lane] = t;
+            result |= 1u << lane;
+        }
+    }
+    return result;
+}
+
+// Slab test: the ray enters the box at the largest of the distances to the near planes of the three slabs and leaves
+// it at the smallest of the distances to the far ones. Returns the face hit within (t_min, t_max), which is the one
+// the ray enters through unless the ray starts inside the box, and -1 if there's none.
+static int rt_box_intersect(const rt_box_t *box, const ray_t *ray, double t_min, double t_max, double *out_t)
+{
+    double t_near = -INFINITY, t_far = INFINITY;
+    int near_face = -1, far_face = -1;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // The same divisions the rectangles on the sides of the box used to do, so distances don't change either
+        double origin = ray->origin.components[axis];
+        double direction = ray->direction.components[axis];
+        double t_0 = (box->min.components[axis] - origin) / direction;
+        double t_1 = (box->max.components[axis] - origin) / direction;
+        int face_0 = 2 * axis, face_1 = 2 * axis + 1;
+        if (t_1 < t_0)
+        {
+            double t = t_0;
+            t_0 = t_1;
+            t_1 = t;
+            face_0 = 2 * axis + 1;
+            face_1 = 2 * axis;
+        }
+
+        if (t_0 > t_near || (t_0 == t_near && near_face >= 0 && gs_face_priority[face_0] < gs_face_priority[near_face]))
+        {
+            t_near = t_0;
+            near_face = face_0;
+        }
+        if (t_1 < t_far || (t_1 == t_far && far_face >= 0 && gs_face_priority[face_1] < gs_face_priority[far_face]))
+        {
+            t_far = t_1;
+            far_face = face_1;
+        }
+    }
+
+    if (t_near > t_far)
+    {
+        return -1;
+    }
+    if (t_near > t_min && t_near < t_max)
+    {
+        *out_t = t_near;
+        return near_face;
+    }
+    if (t_far > t_min && t_far < t_max)
+    {
+        *out_t = t_far;
+        return far_face;
+    }
+    return -1;
+}
+
+static void rt_box_fill_record(const rt_box_t *box, const ray_t *ray, double t, int face, rt_hit_record_t *record)
+{
+    int axis = face / 2;
+    int axis_1 = gs_face_axes[axis][0];
+    int axis_2 = gs_face_axes[axis][1];
+
+    point3_t hit = ray_at(*ray, t);
+    double hit_axis_1 = hit.components[axis_1];
+    double hit_axis_2 = hit.components[axis_2];
+    double min_1 = box->min.components[axis_1], max_1 = box->max.components[axis_1];
+    double min_2 = box->min.components[axis_2], max_2 = box->max.components[axis_2];
+
+    record->material = box->material;
+    record->u = (hit_axis_1 - min_1) / (max_1 - min_1);
+    record->v = (hit_axis_2 - min_2) / (max_2 - min_2);
+    record->t = t;
+    record->p = hit;
+
+    vec3_t outward_normal = vec3(0, 0, 0);
+    outward_normal.components[axis] = 1;
+    if (0 == face % 2)
+    {
+        outward_normal = vec3_negate(&outward_normal);
+    }
+    rt_hit_record_set_front_face(record, ray, &outward_normal);
 }
 
 bool rt_box_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
@@ -91,6 +218,6 @@ void rt_box_delete(rt_hittable_t *hittable)
     assert(RT_HITTABLE_TYPE_BOX == hittable->type);
     rt_box_t *box = (rt_box_t *)hittable;
 
-    rt_hittable_list_deinit(box->sides);
+    rt_material_delete(box->material);
     free(box);
 }
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_BVH_SIMD_H
+#define RAY_TRACING_ONE_WEEK_RT_BVH_SIMD_H
+
+#include <stdbool.h>
+
+// Ray in the single precision form used by the wide box tests
+typedef struct rt_bvh_simd_ray_s
+{
+    float origin[3];
+    float inv_direction[3];
+} rt_bvh_simd_ray_t;
+
+// Number of rays in a packet, one per lane of a 128-bit vector of floats
+#define RT_BVH_SIMD_PACKET_SIZE (4)
+
+// Rays of a packet in the single precision form used by the packet box test
+typedef struct rt_bvh_simd_packet_s
+{
+    float origin[3][RT_BVH_SIMD_PACKET_SIZE];
+    float inv_direction[3][RT_BVH_SIMD_PACKET_SIZE];
+} rt_bvh_simd_packet_t;
+
+// Tests a ray against the boxes of all children of a wide BVH node at once. Bounds are stored as structure of arrays:
+// bounds[0..2] hold min x, y, z and bounds[3..5] hold max x, y, z of every child (width floats each). Writes the entry
+// distance of every child to t_near and returns the mask of the children that were hit.
+typedef unsigned (*rt_bvh_simd_box_test_fn)(const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min,
+                                            float t_max, float *t_near);
+
+unsigned rt_bvh_simd_box_test4_scalar(const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min, float t_max,
+                                      float *t_near);
+
+unsigned rt_bvh_simd_box_test8_scalar(const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min, float t_max,
+                                      float *t_near);
+
+// Picks the fastest implementation the CPU we're running on supports, falls back to the scalar one if allow_simd is
+// false or there's no vector implementation for this width. Returns NULL for unsupported widths.
+rt_bvh_simd_box_test_fn rt_bvh_simd_select_box_test(int width, bool allow_simd, const char **out_name);
+
+// Tests every ray of a packet against one box. The box is read from bounds with the given stride: bounds[axis * stride]
+// is the min and bounds[(axis + 3) * stride] the max along the axis, which covers both a child of a wide node and a
+// plain min[3], max[3] pair. t_max holds the far end of the interval of every lane. Writes the entry distance of every
+// lane to t_near and returns the mask of the lanes that hit the box.
+typedef unsigned (*rt_bvh_simd_packet_box_test_fn)(const float *bounds, int stride,
+                                                   const rt_bvh_simd_packet_t *packet, float t_min,
+                                                   const float *t_max, float *t_near);
+
+unsigned rt_bvh_simd_packet_box_test_scalar(const float *bounds, int stride, const rt_bvh_simd_packet_t *packet,
+                                            float t_min, const float *t_max, float *t_near);
+
+rt_bvh_simd_packet_box_test_fn rt_bvh_simd_select_packet_box_test(bool allow_simd, const char **out_name);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_BVH_SIMD_H
@@ -18,8 +18,13 @@ typedef struct rt_const_medium_s
     rt_material_t *phase_function;
 
     double inv_neg_density;
+    // Key of the medium's free-flight draws
+    uint64_t random_key;
 } rt_const_medium_t;
 
+// Media are numbered in the order they're created, so the keys stay the same from run to run
+static uint64_t gs_next_random_key = 0;
+
 static bool rt_const_medium_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                                 rt_hit_record_t *record);
 static void rt_const_medium_delete(rt_hittable_t *hittable);
@@ -27,12 +32,13 @@ static bool rt_const_medium_bb(const rt_hittable_t *hittable, double time0, doub
 
 rt_hittable_t *rt_const_medium_new_with_texture(rt_hittable_t *boundary, double density, rt_texture_t *texture)
 {
-    rt_const_medium_t *result = calloc(1, sizeof(rt_const_medium_t));
+    rt_const_medium_t *result = rt_arena_calloc(sizeof(rt_const_medium_t));
     assert(NULL != result);
 
     result->boundary = boundary;
     result->inv_neg_density = -1.0 / density;
     result->phase_function = rt_mt_iso_new_with_texture(texture);
+    result->random_key = gs_next_random_key++;
 
     rt_hittable_init(&result->base, RT_HITTABLE_CONSTANT_MEDIUM, rt_const_medium_hit, rt_const_medium_bb,
                      rt_const_medium_delete);
@@ -84,7 +90,7 @@ static bool rt_const_medium_hit(const rt_hittable_t *hittable, const ray_t *ray,
 
     double ray_length = vec3_length(ray->direction);
     double dist_inside_bound = (hit2.t - hit1.t) * ray_length;
-    double hit_distance = medium->inv_neg_density * log(rt_random_double(0.0, 1.0));
+    double hit_distance = medium->inv_neg_density * log(rt_random_double_keyed(medium->random_key));
 
     if (hit_distance > dist_inside_bound)
     {
@@ -13,18 +13,37 @@ static bool hit_base(const rt_hittable_t *hittable, const ray_t *ray, double t_m
                      rt_hit_record_t *record);
 static bool bb_base(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void delete_base(rt_hittable_t *hittable);
+static void release_shared(void *data);
 
 void rt_hittable_init(rt_hittable_t *hittable, rt_hittable_type_t type, rt_hittable_hit_fn hit_fn,
                       rt_hittable_bb_fn bb_fn, rt_hittable_delete_fn delete_fn)
 {
     assert(NULL != hittable);
 
-    hittable->refcount = 1;
+    hittable->refcount = NULL != rt_arena_get_current() ? RT_ARENA_REFCOUNT : 1;
     hittable->type = type;
 
     hittable->hit = hit_fn ? hit_fn : hit_base;
     hittable->bb = bb_fn ? bb_fn : bb_base;
     hittable->delete = delete_fn ? delete_fn : delete_base;
+
+    hittable->occluded = NULL;
+    hittable->hit_packet = NULL;
+
+    hittable->random = NULL;
+    hittable->pdf_value = NULL;
+    hittable->collect_lights = NULL;
+}
+
+void rt_hittable_init_light_sampling(rt_hittable_t *hittable, rt_hittable_random_fn random_fn,
+                                     rt_hittable_pdf_value_fn pdf_value_fn,
+                                     rt_hittable_collect_lights_fn collect_lights_fn)
+{
+    assert(NULL != hittable);
+
+    hittable->random = random_fn;
+    hittable->pdf_value = pdf_value_fn;
+    hittable->collect_lights = collect_lights_fn;
 }
 
 bool rt_hittable_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
@@ -35,16 +54,73 @@ bool rt_hittable_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_m
     return hittable->hit(hittable, ray, t_min, t_max, record);
 }
 
+bool rt_hittable_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+
+    if (NULL == hittable->occluded)
+    {
+        rt_hit_record_t record;
+        return hittable->hit(hittable, ray, t_min, t_max, &record);
+    }
+    return hittable->occluded(hittable, ray, t_min, t_max);
+}
+
+unsigned rt_hittable_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+    assert(NULL != t_max);
+    assert(NULL != records);
+
+    if (NULL != hittable->hit_packet)
+    {
+        return hittable->hit_packet(hittable, packet, mask, t_min, t_max, records);
+    }
+
+    // One lane after another, each one drawing from its own random stream
+    unsigned result = 0;
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        rt_hit_record_t record;
+        rt_random_restore(&packet->random[lane]);
+        if (hittable->hit(hittable, &packet->rays[lane], t_min, t_max[lane], &record))
+        {
+            records[lane] = record;
+            t_max[lane] = record.t;
+            result |= 1u << lane;
+        }
+        rt_random_save(&packet->random[lane]);
+    }
+    return result;
+}
+
 rt_hittable_t *rt_hittable_claim(rt_hittable_t *hittable)
 {
+    if (RT_ARENA_REFCOUNT == hittable->refcount)
+    {
+        return hittable;
+    }
     hittable->refcount++;
 
+    // Arena objects never release what they hold, so the arena does it for them
+    rt_arena_t *arena = rt_arena_get_current();
+    if (NULL != arena)
+    {
+        rt_arena_add_cleanup(arena, release_shared, hittable);
+    }
     return hittable;
 }
 
 void rt_hittable_delete(rt_hittable_t *hittable)
 {
-    if (NULL == hittable || --hittable->refcount > 0)
+    if (NULL == hittable || RT_ARENA_REFCOUNT == hittable->refcount || --hittable->refcount > 0)
     {
         return;
     }
@@ -59,6 +135,42 @@ bool rt_hittable_bb(const rt_hittable_t *hittable, double time0, double time1, r
     return hittable->bb(hittable, time0, time1, out_bb);
 }
 
+vec3_t rt_hittable_random(const rt_hittable_t *hittable, const point3_t *origin)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+
+    if (NULL == hittable->random)
+    {
+        return vec3_random_unit_vector();
+    }
+    return hittable->random(hittable, origin);
+}
+
+double rt_hittable_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+    assert(NULL != direction);
+
+    if (NULL == hittable->pdf_value)
+    {
+        return 0.0;
+    }
+    return hittable->pdf_value(hittable, origin, direction);
+}
+
+void rt_hittable_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights)
+{
+    assert(NULL != hittable);
+    assert(NULL != lights);
+
+    if (NULL != hittable->collect_lights)
+    {
+        hittable->collect_lights(hittable, lights);
+    }
+}
+
 int rt_hittable_box_cmp_x(const void *a, const void *b)
 {
     assert(NULL != a && NULL != b);
@@ -142,4 +254,8 @@ static bool bb_base(const rt_hittable_t *hittable, double time0, double time1, r
 static void delete_base(rt_hittable_t *hittable)
 {
     free(hittable);
-}
\ No newline at end of file
+}
+static void release_shared(void *data)
+{
+    rt_hittable_delete(data);
+}
@@ -23,10 +23,24 @@ void rt_hittable_list_deinit(rt_hittable_list_t *list);
 bool rt_hittable_list_hit_test(const rt_hittable_list_t *list, const ray_t *ray, double t_min, double t_max,
                                rt_hit_record_t *record);
 
+// Closest hit of every lane in mask, see rt_hittable_hit_packet
+unsigned rt_hittable_list_hit_packet(const rt_hittable_list_t *list, rt_ray_packet_t *packet, unsigned mask,
+                                     double t_min, double *t_max, rt_hit_record_t *records);
+
+bool rt_hittable_list_occluded(const rt_hittable_list_t *list, const ray_t *ray, double t_min, double t_max);
+
 bool rt_hittable_list_bb(const rt_hittable_list_t *list, double time0, double time1, rt_aabb_t *out_bb);
 
 size_t rt_hittable_list_get_size(const rt_hittable_list_t *list);
 
+// Builds the list of lights of the scene: every emissive hittable of the list (including the ones stored inside BVHs)
+// that supports light sampling. Lights are shared with the list, so it may be deleted independently.
+rt_hittable_list_t *rt_hittable_list_collect_lights(const rt_hittable_list_t *list);
+
+// Mixture of the light sampling densities of the list members: each member is picked with equal probability
+vec3_t rt_hittable_list_random(const rt_hittable_list_t *list, const point3_t *origin);
+double rt_hittable_list_pdf_value(const rt_hittable_list_t *list, const point3_t *origin, const vec3_t *direction);
+
 rt_hittable_t **rt_hittable_list_get_underlying_container(const rt_hittable_list_t *list);
 
 #endif // RAY_TRACING_ONE_WEEK_RT_HITTABLE_LIST_H
@@ -0,0 +1,438 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rt_mesh_shared.h"
+
+// Flat triangles (and flat meshes) get bounding boxes this much thicker, relative to their coordinates, otherwise
+// rays crossing their plane would see an empty slab
+#define RT_MESH_FLAT_BOX_PADDING (1e-6)
+
+// Per-ray constants of the watertight test: the ray direction becomes the +z axis of a sheared space in which the
+// edge functions of a triangle are 2D cross products
+typedef struct mesh_shear_s
+{
+    int kx, ky, kz;
+    double sx, sy, sz;
+} mesh_shear_t;
+
+static bool rt_mesh_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+                        rt_hit_record_t *record);
+static bool rt_mesh_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static bool rt_mesh_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
+static void rt_mesh_delete(rt_hittable_t *hittable);
+
+static void mesh_shear_init(mesh_shear_t *shear, const ray_t *ray);
+static bool mesh_triangle_hit(const rt_mesh_t *mesh, size_t triangle, const ray_t *ray, const mesh_shear_t *shear,
+                              double t_min, double t_max, double *out_t, double *out_weights);
+static void mesh_fill_record(const rt_mesh_t *mesh, size_t triangle, const ray_t *ray, double t,
+                             const double *weights, rt_hit_record_t *record);
+static rt_aabb_t mesh_triangle_bb(const rt_mesh_t *mesh, const uint32_t *indices);
+static void mesh_pad_flat_box(rt_aabb_t *box);
+static rt_real_t *mesh_copy_attribute(const rt_real_t *source, size_t size);
+
+rt_hittable_t *rt_mesh_new(const rt_mesh_data_t *data, rt_material_t *material)
+{
+    assert(NULL != data);
+    assert(data->number_of_triangles > 0);
+    assert(data->number_of_vertices > 0 && data->number_of_vertices <= UINT32_MAX);
+    assert(NULL != data->indices);
+
+    rt_mesh_t *result = rt_arena_calloc(sizeof(rt_mesh_t));
+    assert(NULL != result);
+
+    result->material = material;
+    result->number_of_vertices = data->number_of_vertices;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        assert(NULL != data->positions[axis]);
+        result->positions[axis] = mesh_copy_attribute(data->positions[axis], data->number_of_vertices);
+        result->normals[axis] = mesh_copy_attribute(data->normals[axis], data->number_of_vertices);
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        result->texture_coordinates[i] = mesh_copy_attribute(data->texture_coordinates[i], data->number_of_vertices);
+    }
+
+    // The BVH works on triangle bounds, triangles are then copied in the order of its leaves
+    size_t number_of_triangles = data->number_of_triangles;
+    rt_aabb_t *bounds = calloc(number_of_triangles, sizeof(rt_aabb_t));
+    uint32_t *order = calloc(number_of_triangles, sizeof(uint32_t));
+    assert(NULL != bounds && NULL != order);
+
+    const rt_mesh_t source = {.positions = {(rt_real_t *)data->positions[0], (rt_real_t *)data->positions[1],
+                                            (rt_real_t *)data->positions[2]}};
+    for (size_t i = 0; i < number_of_triangles; ++i)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            assert(data->indices[3 * i + corner] < data->number_of_vertices);
+        }
+        bounds[i] = mesh_triangle_bb(&source, &data->indices[3 * i]);
+        result->box = 0 == i ? bounds[i] : rt_aabb_surrounding_bb(result->box, bounds[i]);
+    }
+
+    result->nodes = rt_bvh_build_nodes(bounds, number_of_triangles, order, &result->number_of_nodes);
+
+    result->indices = rt_arena_calloc(3 * number_of_triangles * sizeof(uint32_t));
+    assert(NULL != result->indices);
+    for (size_t i = 0; i < number_of_triangles; ++i)
+    {
+        memcpy(&result->indices[3 * i], &data->indices[3 * order[i]], 3 * sizeof(uint32_t));
+    }
+    result->number_of_triangles = number_of_triangles;
+
+    free(order);
+    free(bounds);
+
+    rt_mesh_init(result);
+
+    return (rt_hittable_t *)result;
+}
+
+void rt_mesh_init(rt_mesh_t *mesh)
+{
+    assert(NULL != mesh);
+
+    rt_hittable_init(&mesh->base, RT_HITTABLE_TYPE_MESH, rt_mesh_hit, rt_mesh_bb, rt_mesh_delete);
+    mesh->base.occluded = rt_mesh_occluded;
+}
+
+size_t rt_mesh_get_number_of_triangles(const rt_hittable_t *mesh)
+{
+    assert(NULL != mesh);
+
+    assert(RT_HITTABLE_TYPE_MESH == mesh->type);
+    return ((const rt_mesh_t *)mesh)->number_of_triangles;
+}
+
+static bool rt_mesh_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+                        rt_hit_record_t *record)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_MESH == hittable->type);
+    const rt_mesh_t *mesh = (const rt_mesh_t *)hittable;
+
+    mesh_shear_t shear;
+    mesh_shear_init(&shear, ray);
+
+    // The record is only filled for the closest triangle, once the traversal is over
+    size_t closest = SIZE_MAX;
+    double closest_weights[3];
+    uint32_t stack[RT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const rt_bvh_node_t *node = &mesh->nodes[current];
+        if (rt_bvh_node_box_hit(node, ray, t_min, t_max))
+        {
+            if (node->number_of_primitives > 0)
+            {
+                for (uint32_t i = node->offset; i < node->offset + node->number_of_primitives; ++i)
+                {
+                    double t, weights[3];
+                    if (mesh_triangle_hit(mesh, i, ray, &shear, t_min, t_max, &t, weights))
+                    {
+                        closest = i;
+                        t_max = t;
+                        memcpy(closest_weights, weights, sizeof(weights));
+                    }
+                }
+            }
+            else
+            {
+                assert(stack_size < RT_BVH_STACK_SIZE);
+                if (ray->sign[node->axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node->offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node->offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    if (SIZE_MAX == closest)
+    {
+        return false;
+    }
+    mesh_fill_record(mesh, closest, ray, t_max, closest_weights, record);
+    return true;
+}
+
+static bool rt_mesh_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_MESH == hittable->type);
+    const rt_mesh_t *mesh = (const rt_mesh_t *)hittable;
+
+    mesh_shear_t shear;
+    mesh_shear_init(&shear, ray);
+
+    uint32_t stack[RT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const rt_bvh_node_t *node = &mesh->nodes[current];
+        if (rt_bvh_node_box_hit(node, ray, t_min, t_max))
+        {
+            if (node->number_of_primitives > 0)
+            {
+                for (uint32_t i = node->offset; i < node->offset + node->number_of_primitives; ++i)
+                {
+                    double t, weights[3];
+                    if (mesh_triangle_hit(mesh, i, ray, &shear, t_min, t_max, &t, weights))
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                assert(stack_size < RT_BVH_STACK_SIZE);
+                stack[stack_size++] = node->offset;
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    return false;
+}
+
+static bool rt_mesh_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
+{
+    assert(NULL != hittable);
+    assert(NULL != out_bb);
+
+    assert(RT_HITTABLE_TYPE_MESH == hittable->type);
+    const rt_mesh_t *mesh = (const rt_mesh_t *)hittable;
+
+    *out_bb = mesh->box;
+    return true;
+}
+
+static void rt_mesh_delete(rt_hittable_t *hittable)
+{
+    if (NULL == hittable)
+    {
+        return;
+    }
+    assert(RT_HITTABLE_TYPE_MESH == hittable->type);
+    rt_mesh_t *mesh = (rt_mesh_t *)hittable;
+
+    if (NULL != mesh->mapping)
+    {
+        munmap(mesh->mapping, mesh->mapping_size);
+    }
+    else
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            free(mesh->positions[axis]);
+            free(mesh->normals[axis]);
+        }
+        free(mesh->texture_coordinates[0]);
+        free(mesh->texture_coordinates[1]);
+        free(mesh->indices);
+        free(mesh->nodes);
+    }
+
+    rt_material_delete(mesh->material);
+    free(mesh);
+}
+
+static void mesh_shear_init(mesh_shear_t *shear, const ray_t *ray)
+{
+    const vec3_t *direction = &ray->direction;
+
+    // z is the dominant axis of the direction, x and y are swapped for negative z to keep the winding of triangles
+    int kz = fabs(direction->x) > fabs(direction->y) ? VEC3_AXIS_X : VEC3_AXIS_Y;
+    kz = fabs(direction->z) > fabs(direction->components[kz]) ? VEC3_AXIS_Z : kz;
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (direction->components[kz] < 0)
+    {
+        int swap = kx;
+        kx = ky;
+        ky = swap;
+    }
+
+    shear->kx = kx;
+    shear->ky = ky;
+    shear->kz = kz;
+    shear->sx = direction->components[kx] / direction->components[kz];
+    shear->sy = direction->components[ky] / direction->components[kz];
+    shear->sz = 1.0 / direction->components[kz];
+}
+
+// Watertight ray/triangle test. Two triangles that share an edge compute its edge function from the same two vertices
+// in opposite order, so they get exactly opposite values and a ray can't miss both of them.
+static bool mesh_triangle_hit(const rt_mesh_t *mesh, size_t triangle, const ray_t *ray, const mesh_shear_t *shear,
+                              double t_min, double t_max, double *out_t, double *out_weights)
+{
+    const uint32_t *indices = &mesh->indices[3 * triangle];
+
+    // Vertices relative to the ray origin
+    double a[3], b[3], c[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double origin = ray->origin.components[axis];
+        a[axis] = mesh->positions[axis][indices[0]] - origin;
+        b[axis] = mesh->positions[axis][indices[1]] - origin;
+        c[axis] = mesh->positions[axis][indices[2]] - origin;
+    }
+
+    int kx = shear->kx, ky = shear->ky, kz = shear->kz;
+    double ax = a[kx] - shear->sx * a[kz];
+    double ay = a[ky] - shear->sy * a[kz];
+    double bx = b[kx] - shear->sx * b[kz];
+    double by = b[ky] - shear->sy * b[kz];
+    double cx = c[kx] - shear->sx * c[kz];
+    double cy = c[ky] - shear->sy * c[kz];
+
+    // Edge functions, each of them is the weight of the vertex opposite to its edge
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+    {
+        return false;
+    }
+
+    double determinant = u + v + w;
+    if (0.0 == determinant)
+    {
+        return false;
+    }
+
+    double t = (u * shear->sz * a[kz] + v * shear->sz * b[kz] + w * shear->sz * c[kz]) / determinant;
+    if (t <= t_min || t >= t_max)
+    {
+        return false;
+    }
+
+    *out_t = t;
+    out_weights[0] = u / determinant;
+    out_weights[1] = v / determinant;
+    out_weights[2] = w / determinant;
+    return true;
+}
+
+static void mesh_fill_record(const rt_mesh_t *mesh, size_t triangle, const ray_t *ray, double t,
+                             const double *weights, rt_hit_record_t *record)
+{
+    const uint32_t *indices = &mesh->indices[3 * triangle];
+
+    point3_t corners[3];
+    for (int corner = 0; corner < 3; ++corner)
+    {
+        uint32_t index = indices[corner];
+        corners[corner] = point3(mesh->positions[0][index], mesh->positions[1][index], mesh->positions[2][index]);
+    }
+
+    record->material = mesh->material;
+    record->t = t;
+    record->p = ray_at(*ray, t);
+
+    if (NULL != mesh->texture_coordinates[0])
+    {
+        record->u = 0.0;
+        record->v = 0.0;
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            record->u += weights[corner] * mesh->texture_coordinates[0][indices[corner]];
+            record->v += weights[corner] * mesh->texture_coordinates[1][indices[corner]];
+        }
+    }
+    else
+    {
+        record->u = weights[1];
+        record->v = weights[2];
+    }
+
+    // The side is decided by the geometric normal, the interpolated one is only used for shading
+    vec3_t normal = vec3_normalized(vec3_cross(vec3_diff(corners[1], corners[0]), vec3_diff(corners[2], corners[0])));
+    rt_hit_record_set_front_face(record, ray, &normal);
+    if (NULL != mesh->normals[0])
+    {
+        double shading[3] = {0.0, 0.0, 0.0};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                shading[axis] += weights[corner] * mesh->normals[axis][indices[corner]];
+            }
+        }
+        normal = vec3_normalized(vec3(shading[0], shading[1], shading[2]));
+        record->normal = record->front_face ? normal : vec3_negate(&normal);
+    }
+}
+
+static rt_aabb_t mesh_triangle_bb(const rt_mesh_t *mesh, const uint32_t *indices)
+{
+    rt_aabb_t box;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const rt_real_t *coordinates = mesh->positions[axis];
+        rt_real_t a = coordinates[indices[0]], b = coordinates[indices[1]], c = coordinates[indices[2]];
+        box.min.components[axis] = fmin(a, fmin(b, c));
+        box.max.components[axis] = fmax(a, fmax(b, c));
+    }
+    mesh_pad_flat_box(&box);
+    return box;
+}
+
+static void mesh_pad_flat_box(rt_aabb_t *box)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (box->min.components[axis] == box->max.components[axis])
+        {
+            double padding = RT_MESH_FLAT_BOX_PADDING * (1.0 + fabs(box->min.components[axis]));
+            box->min.components[axis] -= padding;
+            box->max.components[axis] += padding;
+        }
+    }
+}
+
+static rt_real_t *mesh_copy_attribute(const rt_real_t *source, size_t size)
+{
+    if (NULL == source)
+    {
+        return NULL;
+    }
+
+    rt_real_t *result = rt_arena_calloc(size * sizeof(rt_real_t));
+    assert(NULL != result);
+    memcpy(result, source, size * sizeof(rt_real_t));
+    return result;
+}
@@ -9,21 +9,31 @@
 #include <pthread.h>
 #include "hittables/rt_hittable_list.h"
 #include "rt_camera.h"
+#include "rt_sampler.h"
+#include "rt_integrator.h"
+#include "hittables/rt_bvh.h"
+#include "hittables/rt_mesh.h"
 #include "rt_skybox_simple.h"
+#include "rt_thread_pool.h"
+#include "rt_arena.h"
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <scenes/rt_scenes.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
-#define NUM_THREADS 8
 #define NUMBER_OF_MACHINE_BYTES 64
+#define DEFAULT_TILE_SIZE 16
 
-typedef struct
+typedef enum
 {
-    int tid;
-    int begin;
-    int end;
-} thread_n_lines_of_work;
+    SCHEDULER_NONE = -1,
+    SCHEDULER_STATIC,
+    SCHEDULER_DYNAMIC,
+    SCHEDULER_STEALING,
+} scheduler_t;
 
 typedef struct
 {
@@ -31,38 +41,46 @@ typedef struct
     colour_t **pixel_matrix;
 } thread_work_return;
 
+typedef struct
+{
+    int tid;
+    int begin;
+    int end;
+    thread_work_return *result;
+} thread_n_lines_of_work;
+
 int GLOBAL_IMAGE_WIDTH;
 int GLOBAL_IMAGE_HEIGHT;
 int GLOBAL_NUMBER_OF_SAMPLES;
-rt_camera_t *GLOBAL_CAMERA;
-rt_hittable_list_t *GLOBAL_WORLD;
-rt_skybox_t *GLOBAL_SKYBOX;
-int GLOBAL_CHILD_RAYS;
+rt_integrator_frame_t GLOBAL_FRAME;
 
-static void show_usage(const char *program_name, int err);
+typedef struct
+{
+    int tile_size;
+    int tiles_x;
+    int number_of_tiles;
+    colour_t *framebuffer;
+
+    // Every worker bumps this counter, keep it away from the read-only fields above to avoid false sharing
+    _Alignas(NUMBER_OF_MACHINE_BYTES) atomic_int next_tile;
+} tile_schedule;
 
-static colour_t ray_colour(const ray_t *ray, const rt_hittable_list_t *list, rt_skybox_t *skybox, int child_rays)
+// Deque of tile indices owned by a single worker. The range [top, bottom) is packed into one 64-bit word so that both
+// the owner (popping from the top) and the thieves (stealing from the bottom) can claim a tile with a single CAS.
+typedef struct
 {
-    if (child_rays <= 0)
-    {
-        return colour(0, 0, 0);
-    }
+    _Alignas(NUMBER_OF_MACHINE_BYTES) _Atomic uint64_t range;
+} tile_deque;
 
-    rt_hit_record_t record;
-    if (!rt_hittable_list_hit_test(list, ray, 0.001, INFINITY, &record))
-    {
-        return rt_skybox_value(skybox, ray);
-    }
+typedef struct
+{
+    tile_schedule *schedule;
+    tile_deque *deques;
+    int number_of_workers;
+    int worker_id;
+} stealing_worker;
 
-    ray_t scattered;
-    colour_t attenuation;
-    colour_t emitted = rt_material_emit(record.material, record.u, record.v, &record.p);
-    if (rt_material_scatter(record.material, ray, &record, &attenuation, &scattered))
-    {
-        return vec3_sum(emitted, vec3_multiply(attenuation, ray_colour(&scattered, list, skybox, child_rays - 1)));
-    }
-    return emitted;
-}
+static void show_usage(const char *program_name, int err);
 
 int get_height_real_size(int size_height)
 {
@@ -98,7 +116,7 @@ int get_width_real_size()
     return width_real_size;
 }
 
-void *process_n_lines_per_thread(void *args)
+void process_n_lines_per_thread(void *args)
 {
     thread_n_lines_of_work *thread = (thread_n_lines_of_work *)args;
     thread_work_return *thread_return = (thread_work_return *)malloc(sizeof(thread_work_return) * (NUMBER_OF_MACHINE_BYTES/16));
@@ -121,53 +139,144 @@ void *process_n_lines_per_thread(void *args)
         // fflush(stderr);
 
         thread_return->pixel_matrix[begin - j] = (colour_t *)malloc(width_real_size);
+        rt_integrator_tile_colour(&GLOBAL_FRAME, 0, GLOBAL_IMAGE_WIDTH, j, 1, thread_return->pixel_matrix[begin - j],
+                                  GLOBAL_IMAGE_WIDTH);
+    }
 
-        for (int i = 0; i < GLOBAL_IMAGE_WIDTH; ++i)
-        {
-            colour_t pixel = colour(0, 0, 0);
-            for (int s = 0; s < GLOBAL_NUMBER_OF_SAMPLES; ++s)
-            {
-                double u = (double)(i + rt_random_double(0, 1)) / (GLOBAL_IMAGE_WIDTH - 1);
-                double v = (double)(j + rt_random_double(0, 1)) / (GLOBAL_IMAGE_HEIGHT - 1);
+    // fprintf(stderr, "\rThead %d: DONE\n", tid);
 
-                ray_t ray = rt_camera_get_ray(GLOBAL_CAMERA, u, v);
-                vec3_add(&pixel, ray_colour(&ray, GLOBAL_WORLD, GLOBAL_SKYBOX, GLOBAL_CHILD_RAYS));
-            }
+    thread->result = thread_return;
+}
+
+// Renders a tile_size x tile_size block of pixels. Tiles are numbered row-major starting from the top of the image,
+// framebuffer rows are stored in the output order (top row first).
+void render_tile(const tile_schedule *schedule, int tile)
+{
+    int x_begin = (tile % schedule->tiles_x) * schedule->tile_size;
+    int x_end = x_begin + schedule->tile_size < GLOBAL_IMAGE_WIDTH ? x_begin + schedule->tile_size : GLOBAL_IMAGE_WIDTH;
+    int row_begin = (tile / schedule->tiles_x) * schedule->tile_size;
+    int row_end =
+        row_begin + schedule->tile_size < GLOBAL_IMAGE_HEIGHT ? row_begin + schedule->tile_size : GLOBAL_IMAGE_HEIGHT;
+
+    colour_t *first = schedule->framebuffer + (size_t)row_begin * GLOBAL_IMAGE_WIDTH + x_begin;
+    rt_integrator_tile_colour(&GLOBAL_FRAME, x_begin, x_end, GLOBAL_IMAGE_HEIGHT - 1 - row_begin, row_end - row_begin,
+                              first, GLOBAL_IMAGE_WIDTH);
+}
 
-            thread_return->pixel_matrix[begin - j][i] = pixel;
+void process_tiles_dynamic(void *args)
+{
+    tile_schedule *schedule = (tile_schedule *)args;
+
+    for (;;)
+    {
+        int tile = atomic_fetch_add_explicit(&schedule->next_tile, 1, memory_order_relaxed);
+        if (tile >= schedule->number_of_tiles)
+        {
+            break;
         }
+        render_tile(schedule, tile);
     }
+}
 
-    // fprintf(stderr, "\rThead %d: DONE\n", tid);
+static inline uint64_t tile_deque_pack(uint32_t top, uint32_t bottom)
+{
+    return ((uint64_t)top << 32) | bottom;
+}
 
-    pthread_exit(thread_return);
+static bool tile_deque_pop(tile_deque *deque, int *tile)
+{
+    uint64_t range = atomic_load_explicit(&deque->range, memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t top = (uint32_t)(range >> 32), bottom = (uint32_t)range;
+        if (top >= bottom)
+        {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&deque->range, &range, tile_deque_pack(top + 1, bottom)))
+        {
+            *tile = (int)top;
+            return true;
+        }
+    }
 }
 
-void set_GLOBALS(const int IMAGE_HEIGHT, const int IMAGE_WIDTH, long number_of_samples, rt_camera_t *camera,
-                rt_hittable_list_t *world, rt_skybox_t *skybox, const int CHILD_RAYS)
+static bool tile_deque_steal(tile_deque *deque, int *tile)
 {
-    GLOBAL_IMAGE_HEIGHT = IMAGE_HEIGHT;
-    GLOBAL_IMAGE_WIDTH = IMAGE_WIDTH;
-    GLOBAL_NUMBER_OF_SAMPLES = number_of_samples;
-    GLOBAL_CAMERA = camera;
-    GLOBAL_WORLD = world;
-    GLOBAL_SKYBOX = skybox;
-    GLOBAL_CHILD_RAYS = CHILD_RAYS;
+    uint64_t range = atomic_load_explicit(&deque->range, memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t top = (uint32_t)(range >> 32), bottom = (uint32_t)range;
+        if (top >= bottom)
+        {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&deque->range, &range, tile_deque_pack(top, bottom - 1)))
+        {
+            *tile = (int)bottom - 1;
+            return true;
+        }
+    }
 }
 
-void render(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_samples, rt_camera_t *camera,
-            rt_hittable_list_t *world, rt_skybox_t *skybox, const int CHILD_RAYS, FILE *out_file)
+void process_tiles_stealing(void *args)
 {
+    stealing_worker *worker = (stealing_worker *)args;
+    tile_deque *own = &worker->deques[worker->worker_id];
+    unsigned int seed = (unsigned int)worker->worker_id * 2654435761u + 1u;
 
-    set_GLOBALS(IMAGE_HEIGHT, IMAGE_WIDTH, number_of_samples, camera, world, skybox, CHILD_RAYS);
+    for (;;)
+    {
+        int tile;
+        if (tile_deque_pop(own, &tile))
+        {
+            render_tile(worker->schedule, tile);
+            continue;
+        }
 
-    pthread_t thread_list[NUM_THREADS];
+        // Own deque is drained: start from a random victim and walk over everybody else once. Tiles are never added
+        // after the start of the frame, so if all deques are empty the frame is done.
+        bool stolen = false;
+        int first_victim = rand_r(&seed) % worker->number_of_workers;
+        for (int v = 0; v < worker->number_of_workers && !stolen; ++v)
+        {
+            int victim = (first_victim + v) % worker->number_of_workers;
+            if (victim != worker->worker_id)
+            {
+                stolen = tile_deque_steal(&worker->deques[victim], &tile);
+            }
+        }
+        if (!stolen)
+        {
+            break;
+        }
+        render_tile(worker->schedule, tile);
+    }
+}
+
+void set_GLOBALS(const rt_integrator_frame_t *frame)
+{
+    GLOBAL_IMAGE_HEIGHT = frame->image_height;
+    GLOBAL_IMAGE_WIDTH = frame->image_width;
+    GLOBAL_NUMBER_OF_SAMPLES = frame->number_of_samples;
+    GLOBAL_FRAME = *frame;
+}
+
+void render_static(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_samples, rt_thread_pool_t *pool,
+                   FILE *out_file)
+{
+    // Every slice needs at least one line
+    int num_threads = (int)rt_thread_pool_get_size(pool);
+    if (num_threads > IMAGE_HEIGHT)
+    {
+        num_threads = IMAGE_HEIGHT;
+    }
     thread_n_lines_of_work *work_thread_list =
-        (thread_n_lines_of_work *)malloc(sizeof(thread_n_lines_of_work) * NUM_THREADS);
+        (thread_n_lines_of_work *)malloc(sizeof(thread_n_lines_of_work) * num_threads);
 
-    int slice_of_lines = IMAGE_HEIGHT / NUM_THREADS;
+    int slice_of_lines = IMAGE_HEIGHT / num_threads;
 
-    for (int t = 0; t < NUM_THREADS; t++)
+    for (int t = 0; t < num_threads; t++)
     {
 
         work_thread_list[t].tid = t;
@@ -181,7 +290,7 @@ void render(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_sample
             work_thread_list[t].begin = work_thread_list[t - 1].end - 1;
         }
 
-        if (t != NUM_THREADS - 1)
+        if (t != num_threads - 1)
         {
             work_thread_list[t].end = work_thread_list[t].begin - (slice_of_lines - 1);
         }
@@ -190,23 +299,17 @@ void render(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_sample
             work_thread_list[t].end = 0;
         }
 
-        pthread_create(&thread_list[t], NULL, &process_n_lines_per_thread, (void *)&work_thread_list[t]);
+        work_thread_list[t].result = NULL;
+        rt_thread_pool_submit(pool, &process_n_lines_per_thread, (void *)&work_thread_list[t]);
     }
 
-    int ret;
-    void *result;
+    rt_thread_pool_wait(pool);
+
     thread_work_return *thread_result;
 
-    for (int t = 0; t < NUM_THREADS; t++)
+    for (int t = 0; t < num_threads; t++)
     {
-        ret = pthread_join(thread_list[t], &result);
-        if (ret)
-        {
-            printf("ERROR; return code from pthread_join() is %d\n", ret);
-            exit(ret);
-        }
-
-        thread_result = (thread_work_return *)result;
+        thread_result = work_thread_list[t].result;
 
         for (int i = 0; i < thread_result->size; i++)
         {
@@ -223,16 +326,171 @@ void render(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_sample
     }
 
     free(work_thread_list);
+}
+
+void render_dynamic(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_samples, int tile_size,
+                    rt_thread_pool_t *pool, FILE *out_file)
+{
+    tile_schedule schedule;
+    schedule.tile_size = tile_size;
+    schedule.tiles_x = (IMAGE_WIDTH + tile_size - 1) / tile_size;
+    schedule.number_of_tiles = schedule.tiles_x * ((IMAGE_HEIGHT + tile_size - 1) / tile_size);
+    schedule.framebuffer = (colour_t *)malloc(sizeof(colour_t) * IMAGE_WIDTH * IMAGE_HEIGHT);
+    assert(NULL != schedule.framebuffer);
+    atomic_init(&schedule.next_tile, 0);
+
+    // Every worker keeps grabbing tiles until the counter runs past the last one
+    for (size_t t = 0; t < rt_thread_pool_get_size(pool); t++)
+    {
+        rt_thread_pool_submit(pool, &process_tiles_dynamic, (void *)&schedule);
+    }
+
+    rt_thread_pool_wait(pool);
+
+    for (int p = 0; p < IMAGE_WIDTH * IMAGE_HEIGHT; p++)
+    {
+        rt_write_colour(out_file, schedule.framebuffer[p], number_of_samples);
+    }
+
+    free(schedule.framebuffer);
+}
+
+void render_stealing(const int IMAGE_WIDTH, const int IMAGE_HEIGHT, long number_of_samples, int tile_size,
+                     rt_thread_pool_t *pool, FILE *out_file)
+{
+    tile_schedule schedule;
+    schedule.tile_size = tile_size;
+    schedule.tiles_x = (IMAGE_WIDTH + tile_size - 1) / tile_size;
+    schedule.number_of_tiles = schedule.tiles_x * ((IMAGE_HEIGHT + tile_size - 1) / tile_size);
+    schedule.framebuffer = (colour_t *)malloc(sizeof(colour_t) * IMAGE_WIDTH * IMAGE_HEIGHT);
+    assert(NULL != schedule.framebuffer);
+
+    int number_of_workers = (int)rt_thread_pool_get_size(pool);
+    tile_deque *deques = aligned_alloc(_Alignof(tile_deque), sizeof(tile_deque) * number_of_workers);
+    stealing_worker *workers = (stealing_worker *)malloc(sizeof(stealing_worker) * number_of_workers);
+    assert(NULL != deques && NULL != workers);
+
+    // Seed the deques in spatial order: each worker starts with a contiguous run of neighbouring tiles
+    for (int t = 0; t < number_of_workers; t++)
+    {
+        uint32_t top = (uint32_t)((long)schedule.number_of_tiles * t / number_of_workers);
+        uint32_t bottom = (uint32_t)((long)schedule.number_of_tiles * (t + 1) / number_of_workers);
+        atomic_init(&deques[t].range, tile_deque_pack(top, bottom));
+
+        workers[t].schedule = &schedule;
+        workers[t].deques = deques;
+        workers[t].number_of_workers = number_of_workers;
+        workers[t].worker_id = t;
+    }
+
+    for (int t = 0; t < number_of_workers; t++)
+    {
+        rt_thread_pool_submit(pool, &process_tiles_stealing, (void *)&workers[t]);
+    }
+
+    rt_thread_pool_wait(pool);
+
+    for (int p = 0; p < IMAGE_WIDTH * IMAGE_HEIGHT; p++)
+    {
+        rt_write_colour(out_file, schedule.framebuffer[p], number_of_samples);
+    }
+
+    free(workers);
+    free(deques);
+    free(schedule.framebuffer);
+}
+
+void render(const rt_integrator_frame_t *frame, scheduler_t scheduler, int tile_size, rt_thread_pool_t *pool,
+            FILE *out_file)
+{
+    const int IMAGE_WIDTH = frame->image_width;
+    const int IMAGE_HEIGHT = frame->image_height;
+    long number_of_samples = frame->number_of_samples;
+
+    set_GLOBALS(frame);
+
+    switch (scheduler)
+    {
+        case SCHEDULER_STATIC:
+            render_static(IMAGE_WIDTH, IMAGE_HEIGHT, number_of_samples, pool, out_file);
+            break;
+
+        case SCHEDULER_DYNAMIC:
+            render_dynamic(IMAGE_WIDTH, IMAGE_HEIGHT, number_of_samples, tile_size, pool, out_file);
+            break;
+
+        case SCHEDULER_STEALING:
+            render_stealing(IMAGE_WIDTH, IMAGE_HEIGHT, number_of_samples, tile_size, pool, out_file);
+            break;
+
+        case SCHEDULER_NONE:
+            assert(0);
+    }
+}
+
+typedef struct
+{
+    scheduler_t id;
+    const char *name;
+    const char *desc;
+} scheduler_info;
+
+static scheduler_info gs_schedulers[] = {
+    {SCHEDULER_STATIC, "static", "One contiguous slice of lines per worker"},
+    {SCHEDULER_DYNAMIC, "dynamic", "Workers grab the next tile from a shared atomic counter"},
+    {SCHEDULER_STEALING, "stealing", "Per-worker tile deques, idle workers steal from a random victim"},
+};
+
+static scheduler_t get_scheduler_by_name(const char *name)
+{
+    for (size_t i = 0; i < sizeof(gs_schedulers) / sizeof(gs_schedulers[0]); ++i)
+    {
+        if (0 == strcmp(gs_schedulers[i].name, name))
+        {
+            return gs_schedulers[i].id;
+        }
+    }
 
-    pthread_exit(NULL);
+    return SCHEDULER_NONE;
+}
+
+static const char *get_scheduler_name(scheduler_t scheduler)
+{
+    for (size_t i = 0; i < sizeof(gs_schedulers) / sizeof(gs_schedulers[0]); ++i)
+    {
+        if (gs_schedulers[i].id == scheduler)
+        {
+            return gs_schedulers[i].name;
+        }
+    }
+
+    return NULL;
 }
 
 int main(int argc, char const *argv[])
 {
     const char *number_of_samples_str = NULL;
     const char *scene_id_str = NULL;
+    const char *number_of_threads_str = NULL;
+    const char *seed_str = NULL;
+    const char *sampler_str = NULL;
+    const char *bvh_layout_str = NULL;
+    const char *max_depth_str = NULL;
+    const char *adaptive_str = NULL;
+    const char *scheduler_str = NULL;
+    const char *tile_size_str = NULL;
     const char *file_name = NULL;
+    const char *mesh_cache_directory = NULL;
     bool verbose = false;
+    bool pin_threads = false;
+    bool allow_simd = true;
+    bool sample_lights = true;
+    bool trace_packets = true;
+    bool wavefront = false;
+    bool sort_rays = false;
+    bool use_arena = true;
+    bool build_cache_only = false;
+    int exit_code = EXIT_SUCCESS;
 
     //  Parse console arguments
 
@@ -258,9 +516,141 @@ int main(int argc, char const *argv[])
             scene_id_str = argv[++i];
             continue;
         }
+        else if (0 == strcmp(argv[i], "-t") || 0 == strcmp(argv[i], "--threads"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            number_of_threads_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--sampler"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            sampler_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--bvh"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            bvh_layout_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-simd"))
+        {
+            allow_simd = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-nee"))
+        {
+            sample_lights = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-packets"))
+        {
+            trace_packets = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--wavefront"))
+        {
+            wavefront = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--sort-rays"))
+        {
+            wavefront = true;
+            sort_rays = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--no-arena"))
+        {
+            use_arena = false;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--mesh-cache"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            mesh_cache_directory = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--build-cache"))
+        {
+            build_cache_only = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--max-depth"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            max_depth_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--adaptive"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            adaptive_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--seed"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            seed_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--pin"))
+        {
+            pin_threads = true;
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--scheduler"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            scheduler_str = argv[++i];
+            continue;
+        }
+        else if (0 == strcmp(argv[i], "--tile-size"))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Fatal error: Argument '%s' doesn't have a value\n", argv[i]);
+                show_usage(argv[0], EXIT_FAILURE);
+            }
+            tile_size_str = argv[++i];
+            continue;
+        }
         else if (0 == strcmp(argv[i], "-v") || 0 == strcmp(argv[i], "--verbose"))
         {
             verbose = true;
+            continue;
         }
         else if (0 == strcmp(argv[i], "-h"))
         {
@@ -284,6 +674,9 @@ int main(int argc, char const *argv[])
         fprintf(stderr, "Non-parsed parameters:\n");
         fprintf(stderr, "\t- number of samples: %s\n", number_of_samples_str);
         fprintf(stderr, "\t- scene ID:          %s\n", scene_id_str);
+        fprintf(stderr, "\t- number of threads: %s\n", number_of_threads_str);
+        fprintf(stderr, "\t- scheduler:         %s\n", scheduler_str);
+        fprintf(stderr, "\t- tile size:         %s\n", tile_size_str);
         fprintf(stderr, "\t- file_name:         %s\n", file_name);
     }
 
@@ -299,6 +692,78 @@ int main(int argc, char const *argv[])
             show_usage(argv[0], EXIT_FAILURE);
         }
     }
+    long number_of_threads = (long)rt_thread_pool_available_cpus();
+    if (NULL != number_of_threads_str)
+    {
+        char *end_ptr = NULL;
+        number_of_threads = strtol(number_of_threads_str, &end_ptr, 10);
+        if (*end_ptr != '\0' || number_of_threads <= 0)
+        {
+            fprintf(stderr, "Fatal error: Value of 'threads' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    unsigned long long seed = 0;
+    if (NULL != seed_str)
+    {
+        char *end_ptr = NULL;
+        seed = strtoull(seed_str, &end_ptr, 10);
+        if (*end_ptr != '\0')
+        {
+            fprintf(stderr, "Fatal error: Value of 'seed' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    long max_depth = RT_INTEGRATOR_DEFAULT_MAX_DEPTH;
+    if (NULL != max_depth_str)
+    {
+        char *end_ptr = NULL;
+        max_depth = strtol(max_depth_str, &end_ptr, 10);
+        if (*end_ptr != '\0' || max_depth <= 0 || max_depth > INT_MAX)
+        {
+            fprintf(stderr, "Fatal error: Value of 'max-depth' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    double adaptive_threshold = 0.0;
+    if (NULL != adaptive_str)
+    {
+        char *end_ptr = NULL;
+        adaptive_threshold = strtod(adaptive_str, &end_ptr);
+        if (*end_ptr != '\0' || !(adaptive_threshold > 0.0))
+        {
+            fprintf(stderr, "Fatal error: Value of 'adaptive' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_sampler_type_t sampler_type = RT_SAMPLER_SOBOL;
+    if (NULL != sampler_str)
+    {
+        sampler_type = rt_sampler_get_type_by_name(sampler_str);
+        if (RT_SAMPLER_NONE == sampler_type)
+        {
+            fprintf(stderr, "Fatal error: Invalid sampler\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_bvh_layout_t bvh_layout = RT_BVH_LAYOUT_AUTO;
+    if (NULL != bvh_layout_str)
+    {
+        bvh_layout = rt_bvh_get_layout_by_name(bvh_layout_str);
+        if (RT_BVH_LAYOUT_NONE == bvh_layout)
+        {
+            fprintf(stderr, "Fatal error: Invalid BVH layout\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    rt_bvh_set_layout(bvh_layout, allow_simd);
+    rt_ray_packet_set_simd(allow_simd);
+    if (build_cache_only && NULL == mesh_cache_directory)
+    {
+        fprintf(stderr, "Fatal error: --build-cache needs a directory to put the cache in (--mesh-cache)\n");
+        show_usage(argv[0], EXIT_FAILURE);
+    }
+    rt_mesh_set_cache_directory(mesh_cache_directory);
     rt_scene_id_t scene_id = RT_SCENE_SHOWCASE;
     if (NULL != scene_id_str)
     {
@@ -310,11 +775,62 @@ int main(int argc, char const *argv[])
         }
     }
 
+    scheduler_t scheduler = SCHEDULER_DYNAMIC;
+    if (NULL != scheduler_str)
+    {
+        scheduler = get_scheduler_by_name(scheduler_str);
+        if (SCHEDULER_NONE == scheduler)
+        {
+            fprintf(stderr, "Fatal error: Invalid scheduler\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    long tile_size = DEFAULT_TILE_SIZE;
+    if (NULL != tile_size_str)
+    {
+        char *end_ptr = NULL;
+        tile_size = strtol(tile_size_str, &end_ptr, 10);
+        if (*end_ptr != '\0' || tile_size <= 0)
+        {
+            fprintf(stderr, "Fatal error: Value of 'tile-size' is not a correct number\n");
+            show_usage(argv[0], EXIT_FAILURE);
+        }
+    }
+
     if (verbose)
     {
         fprintf(stderr, "Parsed parameters:\n");
         fprintf(stderr, "\t- number of samples: %ld\n", number_of_samples);
         fprintf(stderr, "\t- scene ID:          %d\n", scene_id);
+        fprintf(stderr, "\t- number of threads: %ld%s\n", number_of_threads, pin_threads ? " (pinned)" : "");
+        fprintf(stderr, "\t- seed:              %llu\n", seed);
+        fprintf(stderr, "\t- sampler:           %s\n", rt_sampler_get_name_by_type(sampler_type));
+        fprintf(stderr, "\t- BVH layout:        %s\n", rt_bvh_get_layout_description());
+        fprintf(stderr, "\t- max depth:         %ld\n", max_depth);
+        fprintf(stderr, "\t- light sampling:    %s\n", sample_lights ? "on" : "off");
+        if (trace_packets)
+        {
+            fprintf(stderr, "\t- ray packets:       %d rays (%s)\n", RT_RAY_PACKET_SIZE, rt_ray_packet_get_simd_name());
+        }
+        else
+        {
+            fprintf(stderr, "\t- ray packets:       off\n");
+        }
+        fprintf(stderr, "\t- integrator:        %s\n",
+                sort_rays ? "wavefront, sorted rays" : (wavefront ? "wavefront" : "path"));
+        if (adaptive_threshold > 0.0)
+        {
+            fprintf(stderr, "\t- adaptive sampling: %g (at least %d samples)\n", adaptive_threshold,
+                    RT_INTEGRATOR_ADAPTIVE_MIN_SAMPLES);
+        }
+        else
+        {
+            fprintf(stderr, "\t- adaptive sampling: off\n");
+        }
+        fprintf(stderr, "\t- scene arena:       %s\n", use_arena ? "on" : "off");
+        fprintf(stderr, "\t- mesh cache:        %s\n", NULL != mesh_cache_directory ? mesh_cache_directory : "off");
+        fprintf(stderr, "\t- scheduler:         %s\n", get_scheduler_name(scheduler));
+        fprintf(stderr, "\t- tile size:         %ld\n", tile_size);
         fprintf(stderr, "\t- file_name:         %s\n", file_name);
     }
 
@@ -322,13 +838,31 @@ int main(int argc, char const *argv[])
     const double ASPECT_RATIO = 3.0 / 2.0;
     const int IMAGE_WIDTH = 300;
     const int IMAGE_HEIGHT = (int)(IMAGE_WIDTH / ASPECT_RATIO);
-    const int CHILD_RAYS = 50;
+    const int CHILD_RAYS = (int)max_depth;
 
     // Declare Camera parameters
     point3_t look_from, look_at;
     vec3_t up = point3(0, 1, 0);
     double focus_distance = 10.0, aperture = 0.0, vertical_fov = 40.0;
 
+    // Worker threads are started once and reused for the whole run, starting with building the BVHs of the scene
+    rt_thread_pool_t *pool = rt_thread_pool_new((size_t)number_of_threads, pin_threads);
+    if (NULL == pool)
+    {
+        fprintf(stderr, "Fatal error: Unable to start %ld worker threads\n", number_of_threads);
+        return EXIT_FAILURE;
+    }
+    rt_bvh_set_build_pool(pool);
+
+    // Every random draw of the renderer is keyed by the seed, so the image doesn't depend on the number of threads
+    rt_random_set_seed(seed);
+
+    // Everything the scene is made of is allocated from one arena and freed at once after rendering
+    rt_arena_t *scene_arena = use_arena ? rt_arena_new(0) : NULL;
+    rt_arena_set_current(scene_arena);
+    struct timespec scene_start;
+    clock_gettime(CLOCK_MONOTONIC, &scene_start);
+
     // World
     rt_hittable_list_t *world = NULL;
     rt_skybox_t *skybox = NULL;
@@ -423,13 +957,57 @@ int main(int argc, char const *argv[])
             skybox = rt_skybox_new_gradient(colour(1, 1, 1), colour(0.5, 0.7, 1));
             world = rt_scene_metal_test();
             break;
+
+        case RT_SCENE_MESH_TEST:
+            look_from = point3(0, 6, -11);
+            look_at = point3(0, 0, 0);
+            vertical_fov = 30.0;
+
+            skybox = rt_skybox_new_gradient(colour(1, 1, 1), colour(0.5, 0.7, 1));
+            world = rt_scene_mesh_test();
+            break;
         case RT_SCENE_NONE:
             fprintf(stderr, "Fatal error: scene id is undefined after parsing the parameters\n");
             return EXIT_FAILURE;
     }
 
+    // Lights the integrator samples directly, an empty list disables next-event estimation
+    rt_hittable_list_t *lights = sample_lights ? rt_hittable_list_collect_lights(world) : rt_hittable_list_init(1);
+    if (verbose)
+    {
+        fprintf(stderr, "Number of sampled lights: %zu\n", rt_hittable_list_get_size(lights));
+    }
+    rt_arena_set_current(NULL);
+    if (verbose)
+    {
+        struct timespec scene_end;
+        clock_gettime(CLOCK_MONOTONIC, &scene_end);
+        fprintf(stderr, "Scene built in %.2f ms\n",
+                (double)(scene_end.tv_sec - scene_start.tv_sec) * 1e3 +
+                    (double)(scene_end.tv_nsec - scene_start.tv_nsec) * 1e-6);
+    }
+    if (verbose && NULL != scene_arena)
+    {
+        fprintf(stderr, "Scene arena: %zu KiB in %zu blocks\n", rt_arena_get_used(scene_arena) / 1024,
+                rt_arena_get_number_of_blocks(scene_arena));
+    }
+
     rt_camera_t *camera =
         rt_camera_new(look_from, look_at, up, vertical_fov, ASPECT_RATIO, aperture, focus_distance, 0.0, 1.0);
+    rt_sampler_t *sampler = rt_sampler_new(sampler_type, seed);
+    rt_sampler_use_for_bounces(sampler);
+
+    // The meshes of the scene are in the cache now, there's nothing else to do. Only meshes loaded from files are
+    // cached, a scene made of other primitives alone leaves nothing behind.
+    if (build_cache_only)
+    {
+        if (0 == rt_mesh_get_number_of_cached_meshes())
+        {
+            fprintf(stderr, "Fatal error: Scene '%s' has no meshes to cache\n", rt_scene_get_name_by_id(scene_id));
+            exit_code = EXIT_FAILURE;
+        }
+        goto cleanup;
+    }
 
     FILE *out_file = stdout;
     if (NULL != file_name)
@@ -444,31 +1022,119 @@ int main(int argc, char const *argv[])
 
     // Render
     fprintf(out_file, "P3\n%d %d\n255\n", IMAGE_WIDTH, IMAGE_HEIGHT);
-    render(IMAGE_WIDTH, IMAGE_HEIGHT, number_of_samples, camera, world, skybox, CHILD_RAYS, out_file);
+    rt_integrator_frame_t frame = {.image_width = IMAGE_WIDTH,
+                                   .image_height = IMAGE_HEIGHT,
+                                   .number_of_samples = number_of_samples,
+                                   .adaptive_threshold = adaptive_threshold,
+                                   .max_depth = CHILD_RAYS,
+                                   .trace_packets = trace_packets,
+                                   .wavefront = wavefront,
+                                   .sort_rays = sort_rays,
+                                   .measure_sorting = verbose,
+                                   .camera = camera,
+                                   .sampler = sampler,
+                                   .world = world,
+                                   .lights = lights,
+                                   .skybox = skybox};
+    render(&frame, scheduler, (int)tile_size, pool, out_file);
     fprintf(stderr, "\nDone\n");
+
+    if (verbose)
+    {
+        rt_integrator_stats_t stats;
+        rt_integrator_get_stats(&stats);
+        fprintf(stderr, "Average number of samples per pixel: %.2f\n",
+                0 == stats.pixels ? 0.0 : (double)stats.samples / (double)stats.pixels);
+        if (stats.secondary_rays > 0)
+        {
+            fprintf(stderr, "Secondary rays: %llu, traversal: %.1f ns per ray\n",
+                    (unsigned long long)stats.secondary_rays,
+                    (double)stats.secondary_traversal_ns / (double)stats.secondary_rays);
+        }
+        if (stats.sorted_rays > 0)
+        {
+            fprintf(stderr, "Sorted rays: %llu, sorting: %.1f ns per ray\n", (unsigned long long)stats.sorted_rays,
+                    (double)stats.sort_ns / (double)stats.sorted_rays);
+        }
+        if (stats.probed_rays > 0)
+        {
+            // Sorting pays for itself if it saves more traversal time per ray than it costs
+            double sorted_ns = (double)stats.probed_sorted_ns / (double)stats.probed_rays;
+            double unsorted_ns = (double)stats.probed_unsorted_ns / (double)stats.probed_rays;
+            double sort_ns = (double)stats.sort_ns / (double)stats.sorted_rays;
+            fprintf(stderr,
+                    "Sampled rays: %llu, traversal: %.1f ns per ray sorted, %.1f unsorted (%.2fx), "
+                    "net gain of sorting: %.1f ns per ray\n",
+                    (unsigned long long)stats.probed_rays, sorted_ns, unsorted_ns,
+                    sorted_ns > 0 ? unsorted_ns / sorted_ns : 0.0, unsorted_ns - sorted_ns - sort_ns);
+        }
+    }
 cleanup:
     // Cleanup
+    rt_bvh_set_build_pool(NULL);
+    rt_thread_pool_delete(pool);
+    rt_hittable_list_deinit(lights);
     rt_hittable_list_deinit(world);
+    rt_arena_delete(scene_arena);
     rt_camera_delete(camera);
+    rt_sampler_use_for_bounces(NULL);
+    rt_sampler_delete(sampler);
     rt_skybox_delete(skybox);
 
-    return EXIT_SUCCESS;
+    return exit_code;
 }
 
 static void show_usage(const char *program_name, int err)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "%s [-s|--samples N] [--scene SCENE] [-v|--verbose] [output_file_name]\n", program_name);
+    fprintf(stderr, "%s [-s|--samples N] [--scene SCENE] [-t|--threads N] [--pin] [--seed N] [--sampler SAMPLER] "
+                    "[--bvh LAYOUT] [--no-simd] [--max-depth N] [--no-nee] [--no-packets] [--wavefront] [--sort-rays] "
+                    "[--adaptive T] [--no-arena] [--mesh-cache DIR] [--build-cache] [--scheduler SCHEDULER] "
+                    "[--tile-size N] [-v|--verbose] [output_file_name]\n",
+            program_name);
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "\t-s | --samples      <int>       Number of rays to cast for each pixel\n");
+    fprintf(stderr, "\t-s | --samples      <int>       Number of rays per pixel, the upper bound with --adaptive\n");
     fprintf(
         stderr,
         "\t--scene             <string>    ID of the scene to render. List of available scenes is printed below.\n");
+    fprintf(stderr, "\t--scheduler         <string>    How lines are distributed between workers (default: dynamic)\n");
+    fprintf(stderr, "\t--tile-size         <int>       Tile edge in pixels for tile-based schedulers (default: %d)\n",
+            DEFAULT_TILE_SIZE);
+    fprintf(stderr, "\t-t | --threads      <int>       Number of worker threads (default: number of available CPUs)\n");
+    fprintf(stderr, "\t--pin                           Pin every worker thread to its own CPU\n");
+    fprintf(stderr, "\t--seed              <int>       Seed of the random sequences (default: 0)\n");
+    fprintf(stderr, "\t--sampler           <string>    Sampling pattern (default: sobol)\n");
+    fprintf(stderr, "\t--bvh               <string>    Layout of the BVH nodes (default: auto)\n");
+    fprintf(stderr, "\t--no-simd                       Don't use vector units for BVH and ray packet tests\n");
+    fprintf(stderr, "\t--max-depth         <int>       Maximum number of bounces of a path (default: %d)\n",
+            RT_INTEGRATOR_DEFAULT_MAX_DEPTH);
+    fprintf(stderr, "\t--no-nee                        Don't sample lights directly, rely on scattered rays only\n");
+    fprintf(stderr, "\t--no-packets                    Trace every camera ray on its own instead of in packets\n");
+    fprintf(stderr, "\t--wavefront                     Trace a tile bounce by bounce, shading by material\n");
+    fprintf(stderr, "\t--sort-rays                     Wavefront, rays sorted by direction and origin\n");
+    fprintf(stderr, "\t--no-arena                      Allocate scene objects one by one instead of from an arena\n");
+    fprintf(stderr, "\t--mesh-cache        <string>    Directory of binary caches of the OBJ meshes (triangles and "
+                    "BVH), reused while the files they were read from don't change. Only OBJ meshes are cached, the "
+                    "rest of a scene is built from code in milliseconds\n");
+    fprintf(stderr, "\t--build-cache                   Write the caches of the OBJ meshes the scene loads and exit "
+                    "without rendering, fails for scenes without OBJ meshes\n");
+    fprintf(stderr, "\t--adaptive          <double>    Stop sampling a pixel early once the error of its "
+                    "gamma corrected mean drops below the value. Only stops early, the samples a pixel doesn't "
+                    "take aren't given to other pixels\n");
     fprintf(stderr, "\t-v | --verbose                  Enable verbose output\n");
     fprintf(stderr, "\t-h                              Show this message and exit\n");
     fprintf(stderr, "Positional arguments:\n");
     fprintf(stderr,
             "\toutput_file_name                Name of the output file. Outputs image to console if not specified.\n");
+    fprintf(stderr, "Available schedulers:\n");
+    for (size_t i = 0; i < sizeof(gs_schedulers) / sizeof(gs_schedulers[0]); ++i)
+    {
+        fprintf(stderr, "\t%-30s  %s\n", gs_schedulers[i].name, gs_schedulers[i].desc);
+    }
+    fprintf(stderr, "Available samplers:\n");
+    rt_sampler_print_samplers_info(stderr);
+    fprintf(stderr, "Available BVH layouts:\n");
+    rt_bvh_print_layouts_info(stderr);
     fprintf(stderr, "Available scenes:\n");
     rt_scene_print_scenes_info(stderr);
 
@@ -14,13 +14,14 @@ static bool scatter_base(const rt_material_t *material, const ray_t *incoming_ra
 static colour_t emit_base(const rt_material_t *material, double u, double v, const point3_t *p);
 
 static void delete_base(rt_material_t *material);
+static void release_shared(void *data);
 
 void rt_material_base_init(rt_material_t *material_base, rt_material_type_t type, rt_material_scatter_fn scatter_fn,
                            rt_material_emit_fn emit_fn, rt_material_delete_fn delete_fn)
 {
     assert(NULL != material_base);
     material_base->type = type;
-    material_base->refcount = 1;
+    material_base->refcount = NULL != rt_arena_get_current() ? RT_ARENA_REFCOUNT : 1;
 
     if (NULL == scatter_fn)
     {
@@ -39,13 +40,25 @@ void rt_material_base_init(rt_material_t *material_base, rt_material_type_t type
         delete_fn = delete_base;
     }
     material_base->delete = delete_fn;
+
+    material_base->eval = NULL;
 }
 
 rt_material_t *rt_material_claim(rt_material_t *material)
 {
     assert(NULL != material);
+    if (RT_ARENA_REFCOUNT == material->refcount)
+    {
+        return material;
+    }
     material->refcount++;
 
+    // The reference is taken by an object of the current arena, it goes away with the arena
+    rt_arena_t *arena = rt_arena_get_current();
+    if (NULL != arena)
+    {
+        rt_arena_add_cleanup(arena, release_shared, material);
+    }
     return material;
 }
 
@@ -64,9 +77,28 @@ colour_t rt_material_emit(const rt_material_t *material, double u, double v, con
     return material->emit(material, u, v, p);
 }
 
+bool rt_material_is_emissive(const rt_material_t *material)
+{
+    assert(NULL != material);
+
+    return emit_base != material->emit;
+}
+
+bool rt_material_eval(const rt_material_t *material, const ray_t *incoming_ray, const rt_hit_record_t *hit_record,
+                      const vec3_t *direction, colour_t *value, double *pdf)
+{
+    assert(NULL != material);
+
+    if (NULL == material->eval)
+    {
+        return false;
+    }
+    return material->eval(material, incoming_ray, hit_record, direction, value, pdf);
+}
+
 void rt_material_delete(rt_material_t *material)
 {
-    if (NULL == material || --material->refcount > 0)
+    if (NULL == material || RT_ARENA_REFCOUNT == material->refcount || --material->refcount > 0)
     {
         return;
     }
@@ -89,3 +121,8 @@ static void delete_base(rt_material_t *material)
 {
     free(material);
 }
+
+static void release_shared(void *data)
+{
+    rt_material_delete(data);
+}
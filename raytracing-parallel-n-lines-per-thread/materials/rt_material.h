@@ -23,6 +23,14 @@ bool rt_material_scatter(const rt_material_t *material, const ray_t *incoming_ra
 
 colour_t rt_material_emit(const rt_material_t *material, double u, double v, const point3_t *p);
 
+bool rt_material_is_emissive(const rt_material_t *material);
+
+// Evaluates scattering towards the given direction: value receives the BSDF times the cosine term and pdf the density
+// rt_material_scatter picks that direction with. Returns false if the material scatters into discrete directions only
+// (mirrors, glass), so there's no point in sampling lights for it.
+bool rt_material_eval(const rt_material_t *material, const ray_t *incoming_ray, const rt_hit_record_t *hit_record,
+                      const vec3_t *direction, colour_t *value, double *pdf);
+
 void rt_material_delete(rt_material_t *material);
 
 // Dielectric material
@@ -21,7 +21,7 @@ static double schlick_approximation(double cosine, double refraction_factor);
 
 rt_material_t *rt_mt_dielectric_new(double refraction_factor)
 {
-    rt_material_dielectric_t *material = calloc(1, sizeof(rt_material_dielectric_t));
+    rt_material_dielectric_t *material = rt_arena_calloc(sizeof(rt_material_dielectric_t));
     assert(NULL != material);
 
     rt_material_base_init(&material->base, RT_MATERIAL_TYPE_DIELECTRIC, rt_mt_dielectric_scatter, NULL, NULL);
@@ -26,7 +26,7 @@ rt_material_t *rt_mt_iso_new_with_albedo(colour_t albedo)
 
 rt_material_t *rt_mt_iso_new_with_texture(rt_texture_t *texture)
 {
-    rt_material_iso_t *result = calloc(1, sizeof(rt_material_iso_t));
+    rt_material_iso_t *result = rt_arena_calloc(sizeof(rt_material_iso_t));
     assert(NULL != result);
 
     result->albedo = texture;
@@ -22,7 +22,7 @@ static bool rt_mt_metal_scatter(const rt_material_t *material, const ray_t *inco
 
 rt_material_t *rt_mt_metal_new(colour_t albedo, double fuzziness)
 {
-    rt_material_metal_t *material = calloc(1, sizeof(rt_material_metal_t));
+    rt_material_metal_t *material = rt_arena_calloc(sizeof(rt_material_metal_t));
     assert(NULL != material);
 
     rt_material_base_init(&material->base, RT_MATERIAL_TYPE_METAL, rt_mt_metal_scatter, NULL, NULL);
@@ -22,4 +22,8 @@ bool rt_aabb_hit(const rt_aabb_t *aabb, double t_min, double t_max, const ray_t
 
 rt_aabb_t rt_aabb_surrounding_bb(rt_aabb_t a, rt_aabb_t b);
 
+double rt_aabb_surface_area(const rt_aabb_t *aabb);
+
+point3_t rt_aabb_centroid(const rt_aabb_t *aabb);
+
 #endif // RAY_TRACING_ONE_WEEK_RT_AABB_H
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rt_arena.h"
+
+#define RT_ARENA_DEFAULT_BLOCK_SIZE (256 * 1024)
+
+typedef struct rt_arena_block_s
+{
+    struct rt_arena_block_s *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+} rt_arena_block_t;
+
+typedef struct rt_arena_cleanup_s
+{
+    struct rt_arena_cleanup_s *next;
+    rt_arena_cleanup_fn fn;
+    void *data;
+} rt_arena_cleanup_t;
+
+struct rt_arena_s
+{
+    // The block allocations are carved from comes first, blocks of allocations too large to share one follow it
+    rt_arena_block_t *blocks;
+    size_t block_size;
+    size_t number_of_blocks;
+    size_t used;
+
+    // Most recently registered first
+    rt_arena_cleanup_t *cleanups;
+};
+
+static rt_arena_t *gs_current_arena = NULL;
+
+static rt_arena_block_t *arena_block_new(size_t size);
+
+rt_arena_t *rt_arena_new(size_t block_size)
+{
+    rt_arena_t *arena = calloc(1, sizeof(rt_arena_t));
+    assert(NULL != arena);
+
+    arena->block_size = 0 == block_size ? RT_ARENA_DEFAULT_BLOCK_SIZE : block_size;
+    return arena;
+}
+
+void *rt_arena_alloc(rt_arena_t *arena, size_t size, size_t alignment)
+{
+    assert(NULL != arena);
+    assert(0 != alignment && 0 == (alignment & (alignment - 1)));
+
+    rt_arena_block_t *block = arena->blocks;
+    size_t offset = 0;
+    if (NULL != block)
+    {
+        offset = ((uintptr_t)block->data + block->used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        offset -= (uintptr_t)block->data;
+    }
+
+    if (NULL == block || offset + size > block->size)
+    {
+        size_t needed = size + alignment - 1;
+        if (needed > arena->block_size / 4)
+        {
+            // Don't throw away the free space of the current block because of one large allocation
+            rt_arena_block_t *large = arena_block_new(needed);
+            large->used = large->size;
+            if (NULL == block)
+            {
+                arena->blocks = large;
+            }
+            else
+            {
+                large->next = block->next;
+                block->next = large;
+            }
+            arena->number_of_blocks++;
+            arena->used += size;
+
+            uintptr_t address = ((uintptr_t)large->data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            return (void *)address;
+        }
+
+        block = arena_block_new(arena->block_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->number_of_blocks++;
+
+        offset = ((uintptr_t)block->data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        offset -= (uintptr_t)block->data;
+    }
+
+    block->used = offset + size;
+    arena->used += size;
+    return block->data + offset;
+}
+
+void rt_arena_add_cleanup(rt_arena_t *arena, rt_arena_cleanup_fn fn, void *data)
+{
+    assert(NULL != arena);
+    assert(NULL != fn);
+
+    rt_arena_cleanup_t *cleanup = rt_arena_alloc(arena, sizeof(rt_arena_cleanup_t), alignof(rt_arena_cleanup_t));
+    cleanup->fn = fn;
+    cleanup->data = data;
+    cleanup->next = arena->cleanups;
+    arena->cleanups = cleanup;
+}
+
+size_t rt_arena_get_used(const rt_arena_t *arena)
+{
+    assert(NULL != arena);
+
+    return arena->used;
+}
+
+size_t rt_arena_get_number_of_blocks(const rt_arena_t *arena)
+{
+    assert(NULL != arena);
+
+    return arena->number_of_blocks;
+}
+
+void rt_arena_delete(rt_arena_t *arena)
+{
+    if (NULL == arena)
+    {
+        return;
+    }
+    if (gs_current_arena == arena)
+    {
+        gs_current_arena = NULL;
+    }
+
+    // Cleanups live in the blocks themselves, so they have to run before anything is freed
+    for (rt_arena_cleanup_t *cleanup = arena->cleanups; NULL != cleanup; cleanup = cleanup->next)
+    {
+        cleanup->fn(cleanup->data);
+    }
+
+    rt_arena_block_t *block = arena->blocks;
+    while (NULL != block)
+    {
+        rt_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+void rt_arena_set_current(rt_arena_t *arena)
+{
+    gs_current_arena = arena;
+}
+
+rt_arena_t *rt_arena_get_current(void)
+{
+    return gs_current_arena;
+}
+
+void *rt_arena_calloc(size_t size)
+{
+    if (NULL == gs_current_arena)
+    {
+        return calloc(1, size);
+    }
+    return rt_arena_alloc(gs_current_arena, size, alignof(max_align_t));
+}
+
+static rt_arena_block_t *arena_block_new(size_t size)
+{
+    // Blocks are zeroed up front, so allocations don't have to clear their memory one by one
+    rt_arena_block_t *block = calloc(1, sizeof(rt_arena_block_t) + size);
+    assert(NULL != block);
+
+    block->size = size;
+    return block;
+}
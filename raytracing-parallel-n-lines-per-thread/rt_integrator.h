@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_INTEGRATOR_H
+#define RAY_TRACING_ONE_WEEK_RT_INTEGRATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hittables/rt_hittable_list.h"
+#include "rt_camera.h"
+#include "rt_sampler.h"
+#include "rt_skybox_simple.h"
+
+// Bounce limit used when it's not given on the command line
+#define RT_INTEGRATOR_DEFAULT_MAX_DEPTH (50)
+
+// Number of bounces every path survives before Russian roulette may terminate it
+#define RT_INTEGRATOR_RR_MIN_DEPTH (3)
+
+// Number of samples every pixel takes before adaptive sampling may consider it converged
+#define RT_INTEGRATOR_ADAPTIVE_MIN_SAMPLES (16)
+
+// Everything needed to render the pixels of a frame
+typedef struct rt_integrator_frame_s
+{
+    int image_width;
+    int image_height;
+    // Samples per pixel, the upper bound when sampling adaptively
+    long number_of_samples;
+    // Standard error (relative to the gamma corrected value) a pixel stops sampling at, 0 takes number_of_samples
+    // samples everywhere
+    double adaptive_threshold;
+    int max_depth;
+    // Find the first hits of neighbouring pixels' camera rays with packet queries, see rt_integrator_row_colour
+    bool trace_packets;
+    // Render tiles with the wavefront integrator, see rt_integrator_tile_colour
+    bool wavefront;
+    // Sort the rays of every wavefront bounce after the first one by direction octant and Morton code of the origin
+    bool sort_rays;
+    // With sort_rays, trace some of the sorted bounces once more in pixel order to measure what sorting saves, see
+    // rt_integrator_stats_t
+    bool measure_sorting;
+
+    const rt_camera_t *camera;
+    const rt_sampler_t *sampler;
+    const rt_hittable_list_t *world;
+    const rt_hittable_list_t *lights;
+    rt_skybox_t *skybox;
+} rt_integrator_frame_t;
+
+typedef struct rt_integrator_stats_s
+{
+    uint64_t pixels;
+    uint64_t samples;
+
+    // Wavefront only: rays traced after the first bounce and the time spent finding their hits, rays sorted and the
+    // time spent sorting them. Times are summed over the threads.
+    uint64_t secondary_rays;
+    uint64_t secondary_traversal_ns;
+    uint64_t sorted_rays;
+    uint64_t sort_ns;
+    // Wavefront with measure_sorting only: rays of the sampled bounces and the time spent finding their hits sorted
+    // and in pixel order. The difference per ray against sort_ns per ray is what sorting gains.
+    uint64_t probed_rays;
+    uint64_t probed_sorted_ns;
+    uint64_t probed_unsorted_ns;
+} rt_integrator_stats_t;
+
+// Traces the path started by the ray and returns the radiance it carries back. The path is followed iteratively,
+// accumulating the throughput of every bounce, until it leaves the scene, hits a non-scattering material, runs out of
+// max_depth bounces or gets terminated by Russian roulette. Surviving paths are reweighted by the survival probability,
+// so the estimate stays unbiased.
+//
+// At every diffuse hit one of the lights (see rt_hittable_list_collect_lights) is sampled directly and connected to the
+// hit with a shadow ray. Light samples and the lights found by the scattered rays are combined with multiple
+// importance sampling (power heuristic). An empty list of lights turns it back into a plain path tracer.
+colour_t rt_integrator_ray_colour(const ray_t *ray, const rt_hittable_list_t *world, const rt_hittable_list_t *lights,
+                                  rt_skybox_t *skybox, int max_depth);
+
+// Renders pixel (x, y), y counts from the bottom of the image. Returns the sum of the samples scaled up to
+// number_of_samples, so it can be written with rt_write_colour no matter how many samples have actually been taken.
+//
+// With adaptive sampling a pixel tracks the running mean and variance of its luminance and stops as soon as the
+// standard error of the mean, relative to the gamma corrected value the pixel is written with, drops below
+// adaptive_threshold (i.e. error <= adaptive_threshold * sqrt(mean)). The check only runs at power of two sample
+// counts, where the sampler's patterns are well stratified, and not before RT_INTEGRATOR_ADAPTIVE_MIN_SAMPLES. It only
+// stops early: no pixel takes more than number_of_samples, and the samples a converged pixel leaves out aren't spent on
+// noisier ones. That keeps pixels independent of each other, so the image doesn't depend on how the frame is split
+// between the workers.
+colour_t rt_integrator_pixel_colour(const rt_integrator_frame_t *frame, int x, int y);
+
+// Renders pixels [x_begin, x_end) of row y into out, each of them the way rt_integrator_pixel_colour does.
+//
+// With trace_packets the row is cut into groups of RT_RAY_PACKET_SIZE pixels, whose camera rays for the same sample
+// index are intersected with the world as one packet (rt_hittable_list_hit_packet). Every path then goes on from its
+// first hit on its own, and a pixel done sampling adaptively leaves its group's packets. The lanes keep their own
+// random streams, so the pixels come out the same as without packets.
+void rt_integrator_row_colour(const rt_integrator_frame_t *frame, int x_begin, int x_end, int y, colour_t *out);
+
+// Renders rows y_top, y_top - 1, ..., y_top - rows + 1 of the pixels [x_begin, x_end), i.e. a tile in the order it's
+// written out, row r going to out + r * row_stride. Without wavefront it's rt_integrator_row_colour for every row.
+//
+// The wavefront integrator takes one sample of every pixel of the tile at a time and follows all these paths together,
+// one bounce after another: the queue of rays of the bounce is intersected with the world (in packets with
+// trace_packets), the hits are bucketed by the type of material they've hit and shaded one material after another,
+// and the paths that scatter form the queue of the next bounce. So instead of walking a path from start to end through
+// every kind of geometry and material, the tile runs the same code over long runs of rays. Every path keeps its own
+// random stream, the pixels come out the same as with the other modes.
+//
+// With sort_rays the queue of every bounce after the first one is radix sorted by the octant of the rays' directions
+// and the Morton code of their origins (quantized within the bounds of the world) instead of being kept in pixel
+// order. Rays next to each other in the queue, and so in a packet, then tend to visit the same BVH nodes.
+void rt_integrator_tile_colour(const rt_integrator_frame_t *frame, int x_begin, int x_end, int y_top, int rows,
+                               colour_t *out, size_t row_stride);
+
+// Number of pixels rendered and samples taken by them so far
+void rt_integrator_get_stats(rt_integrator_stats_t *stats);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_INTEGRATOR_H
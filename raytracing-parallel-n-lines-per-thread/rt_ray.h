@@ -13,11 +13,26 @@ typedef struct ray_s
     point3_t origin;
     vec3_t direction;
     double time;
+
+    // Derived from direction by ray_init, so a ray must not be modified in place after creation.
+    // sign[axis] is 1 if the ray points into negative direction along the axis: it's the index of the slab plane
+    // (0 - min, 1 - max) the ray enters first.
+    vec3_t inv_direction;
+    int sign[3];
 } ray_t;
 
 static inline ray_t ray_init(vec3_t origin, vec3_t direction, double time)
 {
-    ray_t result = {origin, direction, time};
+    ray_t result = {
+        .origin = origin,
+        .direction = direction,
+        .time = time,
+        .inv_direction = vec3(1 / direction.x, 1 / direction.y, 1 / direction.z),
+    };
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        result.sign[axis] = result.inv_direction.components[axis] < 0;
+    }
     return result;
 }
 
@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include "rt_ray_packet.h"
+
+// The AVX lane tests work on doubles, a single precision build would get different distances from them
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(RT_SINGLE_PRECISION)
+#define RT_RAY_PACKET_X86
+#include <immintrin.h>
+#endif
+
+/* The lane tests have to agree with the single ray ones to the last bit, otherwise an image would depend on whether
+ * its camera rays were traced in packets. So they do exactly the same operations in the same order, the vector
+ * versions are built without FMA, and rejections are written as "any of the comparisons is true" just like in the
+ * scalar code, which keeps NaNs (rays parallel to a rectangle etc.) behaving the same way. */
+
+typedef unsigned (*sphere_test_fn)(const rt_ray_packet_t *packet, unsigned mask, point3_t center, double radius,
+                                   double t_min, const double *t_max, double *t);
+typedef unsigned (*rect_test_fn)(const rt_ray_packet_t *packet, unsigned mask, int axis_k, double k, int axis_1,
+                                 double min_1, double max_1, int axis_2, double min_2, double max_2, double t_min,
+                                 const double *t_max, double *t);
+
+static unsigned sphere_test_scalar(const rt_ray_packet_t *packet, unsigned mask, point3_t center, double radius,
+                                   double t_min, const double *t_max, double *t);
+static unsigned rect_test_scalar(const rt_ray_packet_t *packet, unsigned mask, int axis_k, double k, int axis_1,
+                                 double min_1, double max_1, int axis_2, double min_2, double max_2, double t_min,
+                                 const double *t_max, double *t);
+
+static sphere_test_fn gs_sphere_test = sphere_test_scalar;
+static rect_test_fn gs_rect_test = rect_test_scalar;
+static const char *gs_simd_name = "scalar";
+
+void rt_ray_packet_prepare(rt_ray_packet_t *packet, unsigned mask)
+{
+    assert(NULL != packet);
+
+    // Unused lanes are zeroed, so the vector tests never work on uninitialized memory
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        bool used = 0 != (mask & (1u << lane));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            packet->origin[axis][lane] = used ? packet->rays[lane].origin.components[axis] : 0.0;
+            packet->direction[axis][lane] = used ? packet->rays[lane].direction.components[axis] : 0.0;
+        }
+    }
+}
+
+unsigned rt_ray_packet_sphere_test(const rt_ray_packet_t *packet, unsigned mask, point3_t center, double radius,
+                                   double t_min, const double *t_max, double *t)
+{
+    assert(NULL != packet);
+    assert(NULL != t_max);
+    assert(NULL != t);
+
+    return gs_sphere_test(packet, mask, center, radius, t_min, t_max, t);
+}
+
+unsigned rt_ray_packet_rect_test(const rt_ray_packet_t *packet, unsigned mask, int axis_k, double k, int axis_1,
+                                 double min_1, double max_1, int axis_2, double min_2, double max_2, double t_min,
+                                 const double *t_max, double *t)
+{
+    assert(NULL != packet);
+    assert(NULL != t_max);
+    assert(NULL != t);
+
+    return gs_rect_test(packet, mask, axis_k, k, axis_1, min_1, max_1, axis_2, min_2, max_2, t_min, t_max, t);
+}
+
+static unsigned sphere_test_scalar(const rt_ray_packet_t *packet, unsigned mask, point3_t center, double radius,
+                                   double t_min, const double *t_max, double *t)
+{
+    unsigned result = 0;
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        const ray_t *ray = &packet->rays[lane];
+        vec3_t ac = vec3_diff(ray->origin, center);
+        double a = vec3_length_squared(ray->direction);
+        double half_b = vec3_dot(ray->direction, ac);
+        double c = vec3_length_squared(ac) - radius * radius;
+
+        double discriminant_4 = half_b * half_b - a * c;
+        if (discriminant_4 < 0)
+        {
+            continue;
+        }
+
+        double disc_root = sqrt(discriminant_4);
+        double root = (-half_b - disc_root) / a;
+        if (root >= t_max[lane] || root <= t_min)
+        {
+            root = (-half_b + disc_root) / a;
+            if (root >= t_max[lane] || root <= t_min)
+            {
+                continue;
+            }
+        }
+
+        t[lane] = root;
+        result |= 1u << lane;
+    }
+    return result;
+}
+
+static unsigned rect_test_scalar(const rt_ray_packet_t *packet, unsigned mask, int axis_k, double k, int axis_1,
+                                 double min_1, double max_1, int axis_2, double min_2, double max_2, double t_min,
+                                 const double *t_max, double *t)
+{
+    unsigned result = 0;
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        const ray_t *ray = &packet->rays[lane];
+        double root = (k - ray->origin.components[axis_k]) / ray->direction.components[axis_k];
+        if (root >= t_max[lane] || root <= t_min)
+        {
+            continue;
+        }
+
+        double hit_1 = ray->origin.components[axis_1] + ray->direction.components[axis_1] * root;
+        double hit_2 = ray->origin.components[axis_2] + ray->direction.components[axis_2] * root;
+        if (hit_1 < min_1 || hit_1 > max_1 || hit_2 < min_2 || hit_2 > max_2)
+        {
+            continue;
+        }
+
+        t[lane] = root;
+        result |= 1u << lane;
+    }
+    return result;
+}
+
+#ifdef RT_RAY_PACKET_X86
+
+_Static_assert(4 == RT_RAY_PACKET_SIZE, "AVX lane tests expect 4 lanes");
+
+__attribute__((target("avx"))) static unsigned sphere_test_avx(const rt_ray_packet_t *packet, unsigned mask,
+                                                               point3_t center, double radius, double t_min,
+                                                               const double *t_max, double *t)
+{
+    __m256d dx = _mm256_loadu_pd(packet->direction[0]);
+    __m256d dy = _mm256_loadu_pd(packet->direction[1]);
+    __m256d dz = _mm256_loadu_pd(packet->direction[2]);
+    __m256d acx = _mm256_sub_pd(_mm256_loadu_pd(packet->origin[0]), _mm256_set1_pd(center.x));
+    __m256d acy = _mm256_sub_pd(_mm256_loadu_pd(packet->origin[1]), _mm256_set1_pd(center.y));
+    __m256d acz = _mm256_sub_pd(_mm256_loadu_pd(packet->origin[2]), _mm256_set1_pd(center.z));
+
+    __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+    __m256d half_b =
+        _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, acx), _mm256_mul_pd(dy, acy)), _mm256_mul_pd(dz, acz));
+    __m256d c = _mm256_sub_pd(
+        _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(acx, acx), _mm256_mul_pd(acy, acy)), _mm256_mul_pd(acz, acz)),
+        _mm256_set1_pd(radius * radius));
+    __m256d discriminant_4 = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+    unsigned missed = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(discriminant_4, _mm256_setzero_pd(), _CMP_LT_OQ));
+    mask &= ~missed;
+    if (0 == mask)
+    {
+        return 0;
+    }
+
+    __m256d disc_root = _mm256_sqrt_pd(discriminant_4);
+    __m256d minus_half_b = _mm256_xor_pd(half_b, _mm256_set1_pd(-0.0));
+    __m256d lo = _mm256_set1_pd(t_min);
+    __m256d hi = _mm256_loadu_pd(t_max);
+
+    __m256d near = _mm256_div_pd(_mm256_sub_pd(minus_half_b, disc_root), a);
+    __m256d near_out = _mm256_or_pd(_mm256_cmp_pd(near, hi, _CMP_GE_OQ), _mm256_cmp_pd(near, lo, _CMP_LE_OQ));
+    __m256d far = _mm256_div_pd(_mm256_add_pd(minus_half_b, disc_root), a);
+    __m256d far_out = _mm256_or_pd(_mm256_cmp_pd(far, hi, _CMP_GE_OQ), _mm256_cmp_pd(far, lo, _CMP_LE_OQ));
+
+    _mm256_storeu_pd(t, _mm256_blendv_pd(near, far, near_out));
+    return mask & ~(unsigned)_mm256_movemask_pd(_mm256_and_pd(near_out, far_out));
+}
+
+__attribute__((target("avx"))) static unsigned rect_test_avx(const rt_ray_packet_t *packet, unsigned mask, int axis_k,
+                                                             double k, int axis_1, double min_1, double max_1,
+                                                             int axis_2, double min_2, double max_2, double t_min,
+                                                             const double *t_max, double *t)
+{
+    __m256d root = _mm256_div_pd(_mm256_sub_pd(_mm256_set1_pd(k), _mm256_loadu_pd(packet->origin[axis_k])),
+                                 _mm256_loadu_pd(packet->direction[axis_k]));
+    __m256d out = _mm256_or_pd(_mm256_cmp_pd(root, _mm256_loadu_pd(t_max), _CMP_GE_OQ),
+                               _mm256_cmp_pd(root, _mm256_set1_pd(t_min), _CMP_LE_OQ));
+
+    __m256d hit_1 = _mm256_add_pd(_mm256_loadu_pd(packet->origin[axis_1]),
+                                  _mm256_mul_pd(_mm256_loadu_pd(packet->direction[axis_1]), root));
+    __m256d hit_2 = _mm256_add_pd(_mm256_loadu_pd(packet->origin[axis_2]),
+                                  _mm256_mul_pd(_mm256_loadu_pd(packet->direction[axis_2]), root));
+    out = _mm256_or_pd(out, _mm256_cmp_pd(hit_1, _mm256_set1_pd(min_1), _CMP_LT_OQ));
+    out = _mm256_or_pd(out, _mm256_cmp_pd(hit_1, _mm256_set1_pd(max_1), _CMP_GT_OQ));
+    out = _mm256_or_pd(out, _mm256_cmp_pd(hit_2, _mm256_set1_pd(min_2), _CMP_LT_OQ));
+    out = _mm256_or_pd(out, _mm256_cmp_pd(hit_2, _mm256_set1_pd(max_2), _CMP_GT_OQ));
+
+    _mm256_storeu_pd(t, root);
+    return mask & ~(unsigned)_mm256_movemask_pd(out);
+}
+
+#endif // RT_RAY_PACKET_X86
+
+void rt_ray_packet_set_simd(bool allow_simd)
+{
+    gs_sphere_test = sphere_test_scalar;
+    gs_rect_test = rect_test_scalar;
+    gs_simd_name = "scalar";
+
+#ifdef RT_RAY_PACKET_X86
+    if (allow_simd && __builtin_cpu_supports("avx"))
+    {
+        gs_sphere_test = sphere_test_avx;
+        gs_rect_test = rect_test_avx;
+        gs_simd_name = "avx";
+    }
+#else
+    (void)allow_simd;
+#endif
+}
+
+const char *rt_ray_packet_get_simd_name(void)
+{
+    return gs_simd_name;
+}
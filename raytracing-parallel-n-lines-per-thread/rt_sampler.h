@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_SAMPLER_H
+#define RAY_TRACING_ONE_WEEK_RT_SAMPLER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "rt_camera.h"
+
+typedef enum rt_sampler_type_e
+{
+    RT_SAMPLER_NONE = -1,
+    RT_SAMPLER_RANDOM,
+    RT_SAMPLER_SOBOL,
+    RT_SAMPLER_R2,
+} rt_sampler_type_t;
+
+typedef struct rt_sampler_s rt_sampler_t;
+
+// Creates a sampler of the given type. Samplers hold no mutable state, so one sampler may be shared by all workers.
+rt_sampler_t *rt_sampler_new(rt_sampler_type_t type, uint64_t seed);
+
+// Fills in the sample_index-th camera sample of a pixel: offset within the pixel, position on the lens and time. Every
+// sampler returns a pure function of the seed, the pixel and the sample index.
+void rt_sampler_get_camera_sample(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                                  rt_camera_sample_t *sample);
+
+// Makes the first draws of the first bounces of every path (see rt_random_set_pattern) come from the sampler as well,
+// so the directions and the light samples of those bounces are stratified across the samples of a pixel. The random
+// sampler leaves them to the generator. NULL turns it off.
+void rt_sampler_use_for_bounces(const rt_sampler_t *sampler);
+
+rt_sampler_type_t rt_sampler_get_type_by_name(const char *name);
+
+const char *rt_sampler_get_name_by_type(rt_sampler_type_t type);
+
+void rt_sampler_print_samplers_info(FILE *to);
+
+void rt_sampler_delete(rt_sampler_t *sampler);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_SAMPLER_H
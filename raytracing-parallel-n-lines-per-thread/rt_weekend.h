@@ -11,7 +11,8 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <math.h>
-#include <pthread.h>
+
+#include "rt_random.h"
 
 #ifdef M_PI
 #define PI M_PI
@@ -21,14 +22,6 @@
 
 #define RT_DEG_TO_RAD(deg) (((deg)*PI) / 180.0)
 
-static inline double rt_random_double(double min, double max)
-{
-    static unsigned int dummy=0; if (dummy==0) dummy=pthread_self();    
-    return min + (max - min) * rand_r(&dummy) / (RAND_MAX + 1.0);
-    
-    // return min + (max - min) * rand() / (RAND_MAX + 1.0);
-}
-
 static inline double rt_clamp(double x, double min, double max)
 {
     if (x < min)
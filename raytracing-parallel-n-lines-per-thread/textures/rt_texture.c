@@ -10,12 +10,24 @@
 
 static colour_t rt_texture_value_default(const rt_texture_t *texture, double u, double v, const vec3_t *p);
 static void rt_texture_delete_default(rt_texture_t *texture);
+static void release_shared(void *data);
 
 rt_texture_t *rt_texture_claim(rt_texture_t *texture)
 {
     assert(NULL != texture);
 
+    if (RT_ARENA_REFCOUNT == texture->refcount)
+    {
+        return texture;
+    }
     texture->refcount++;
+
+    // Same as for hittables, see rt_hittable_claim
+    rt_arena_t *arena = rt_arena_get_current();
+    if (NULL != arena)
+    {
+        rt_arena_add_cleanup(arena, release_shared, texture);
+    }
     return texture;
 }
 
@@ -23,7 +35,7 @@ void rt_texture_init(rt_texture_t *texture, rt_texture_type_t type, rt_texture_v
                      rt_texture_free_fn free_fn)
 {
     assert(NULL != texture);
-    texture->refcount = 1;
+    texture->refcount = NULL != rt_arena_get_current() ? RT_ARENA_REFCOUNT : 1;
     texture->type = type;
 
     if (NULL == value_fn)
@@ -48,7 +60,7 @@ colour_t rt_texture_value(const rt_texture_t *texture, double u, double v, const
 
 void rt_texture_delete(rt_texture_t *texture)
 {
-    if (NULL != texture && --texture->refcount > 0)
+    if (NULL == texture || RT_ARENA_REFCOUNT == texture->refcount || --texture->refcount > 0)
     {
         return;
     }
@@ -64,3 +76,8 @@ static void rt_texture_delete_default(rt_texture_t *texture)
 {
     assert(0);
 }
+
+static void release_shared(void *data)
+{
+    rt_texture_delete(data);
+}
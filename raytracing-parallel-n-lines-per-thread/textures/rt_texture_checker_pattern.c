@@ -28,7 +28,7 @@ rt_texture_t *rt_texture_cp_new_with_textures(rt_texture_t *even, rt_texture_t *
     assert(NULL != even);
     assert(NULL != odd);
 
-    rt_texture_cp_t *result = calloc(1, sizeof(rt_texture_cp_t));
+    rt_texture_cp_t *result = rt_arena_calloc(sizeof(rt_texture_cp_t));
     assert(NULL != result);
 
     result->even = even;
@@ -5,130 +5,1335 @@
  * LICENSE file in the root directory of this source tree.
  */
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 #include "rt_bvh.h"
+#include "rt_bvh_simd.h"
 #include "rt_hittable_shared.h"
-#include <pthread.h>
 
-typedef struct rt_bvh_node_s
+// Number of buckets the centroids are binned into when looking for the cheapest split
+#define RT_BVH_NUMBER_OF_BINS (16)
+// Leaves never hold more primitives than that, even if the SAH says it would be cheaper
+#define RT_BVH_MAX_LEAF_SIZE (4)
+// Cost of visiting a node relative to the cost of intersecting one primitive
+#define RT_BVH_TRAVERSAL_COST (1.0)
+#define RT_BVH_INTERSECTION_COST (1.0)
+// Past this depth the builder splits ranges at their median centroid instead of using the SAH, which halves them at
+// every level and keeps the whole tree within the traversal stack
+#define RT_BVH_MAX_SAH_DEPTH (32)
+// Wide nodes have up to 8 children, every one of them but the nearest may end up on the stack
+#define RT_BVH_MAX_WIDTH (8)
+#define RT_BVH_WIDE_STACK_SIZE (RT_BVH_STACK_SIZE * (RT_BVH_MAX_WIDTH - 1))
+// Subtrees with fewer primitives than that are built by the task that reached them instead of a new one
+#define RT_BVH_PARALLEL_BUILD_THRESHOLD (4096)
+// Number of primitives whose bounding boxes are gathered by a single job
+#define RT_BVH_BOUNDS_CHUNK_SIZE (4096)
+
+// Node of the tree while it is being built
+typedef struct bvh_build_node_s
+{
+    rt_aabb_t box;
+
+    // Inner nodes have two children, leaves hold primitives [first_primitive, first_primitive + number_of_primitives)
+    struct bvh_build_node_s *children[2];
+    size_t first_primitive;
+    size_t number_of_primitives;
+    int axis;
+} bvh_build_node_t;
+
+/* Wide (4 or 8 children) nodes are laid out as
+ *     float bounds[6][width];    min x, y, z and max x, y, z of every child, so one vector load covers all children
+ *     uint32_t child[width];     leaves: index of the first primitive, inner nodes: index of the wide node
+ *     uint16_t count[width];     number of primitives of a leaf, 0 for inner nodes
+ *     uint8_t mask;              bit i is set if child i is used
+ * and padded to a multiple of the cache line size. */
+#define RT_BVH_WIDE_CHILD_OFFSET(width) (6 * sizeof(float) * (width))
+#define RT_BVH_WIDE_COUNT_OFFSET(width) (RT_BVH_WIDE_CHILD_OFFSET(width) + sizeof(uint32_t) * (width))
+#define RT_BVH_WIDE_MASK_OFFSET(width) (RT_BVH_WIDE_COUNT_OFFSET(width) + sizeof(uint16_t) * (width))
+#define RT_BVH_WIDE_NODE_SIZE(width) ((RT_BVH_WIDE_MASK_OFFSET(width) + 1 + 63) & ~(size_t)63)
+
+typedef struct rt_bvh_s
 {
     rt_hittable_t base;
 
     rt_aabb_t box;
+    rt_bvh_node_t *nodes;
+    size_t number_of_nodes;
+
+    // Used instead of nodes when the tree is collapsed into a wide one
+    int width;
+    uint8_t *wide_nodes;
+    size_t wide_node_size;
+    rt_bvh_simd_box_test_fn box_test;
+    rt_bvh_simd_packet_box_test_fn packet_box_test;
 
-    rt_hittable_t *left;
-    rt_hittable_t *right;
-} rt_bvh_node_t;
+    // Primitives are stored in leaf order, so every leaf refers to a contiguous range
+    rt_hittable_t **primitives;
+    size_t number_of_primitives;
+} rt_bvh_t;
 
-static rt_hittable_t *bvh_make_node(rt_hittable_t **hittable_array, size_t start, size_t end, double time0,
-                                    double time1);
-static bool rt_bvh_node_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+// Per-primitive data used while building
+typedef struct bvh_build_context_s
+{
+    rt_aabb_t *bounds;
+    point3_t *centroids;
+    size_t *indices;
+
+    // Pool the subtrees are built on, NULL to build on the calling thread
+    rt_thread_pool_t *pool;
+} bvh_build_context_t;
+
+// Builds the subtree of indices[start, end) on a worker and stores its root to *out_node
+typedef struct bvh_build_task_s
+{
+    const bvh_build_context_t *context;
+    bvh_build_node_t **out_node;
+    size_t start;
+    size_t end;
+    int depth;
+} bvh_build_task_t;
+
+// Gathers bounds and centroids of hittables[start, end)
+typedef struct bvh_bounds_task_s
+{
+    const bvh_build_context_t *context;
+    rt_hittable_t **hittables;
+    size_t start;
+    size_t end;
+    double time0;
+    double time1;
+} bvh_bounds_task_t;
+
+typedef struct bvh_bin_s
+{
+    rt_aabb_t box;
+    size_t count;
+} bvh_bin_t;
+
+static bvh_build_node_t *bvh_build(const bvh_build_context_t *context, size_t start, size_t end, int depth);
+static void bvh_build_task(void *arg);
+static void bvh_bounds_task(void *arg);
+static void bvh_select(const bvh_build_context_t *context, size_t start, size_t end, size_t nth, int axis);
+static bool bvh_find_split(const bvh_build_context_t *context, size_t start, size_t end, const rt_aabb_t *box,
+                           int depth, size_t *out_middle, int *out_axis);
+static size_t bvh_count_nodes(const bvh_build_node_t *node);
+static size_t bvh_flatten(rt_bvh_node_t *nodes, const bvh_build_node_t *node, size_t *next_node);
+static void bvh_delete_build_nodes(bvh_build_node_t *node);
+static void *bvh_alloc_aligned(size_t size);
+
+static size_t bvh_collapse(rt_bvh_t *bvh, const bvh_build_node_t *node, size_t *next_node);
+static void bvh_resolve_layout(void);
+
+static bool rt_bvh_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+                       rt_hit_record_t *record);
+static bool rt_bvh_wide_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                             rt_hit_record_t *record);
-static bool rt_bvh_node_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
-static void rt_bvh_node_delete(rt_hittable_t *hittable);
+static bool rt_bvh_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
+static void rt_bvh_delete(rt_hittable_t *hittable);
+static void rt_bvh_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights);
+static bool rt_bvh_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static bool rt_bvh_wide_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static unsigned rt_bvh_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                  double *t_max, rt_hit_record_t *records);
+static unsigned rt_bvh_wide_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                       double t_min, double *t_max, rt_hit_record_t *records);
 
-rt_hittable_t *rt_bvh_node_new(const rt_hittable_list_t *hittable_list, double time0, double time1)
+typedef struct rt_bvh_layouts_s
+{
+    rt_bvh_layout_t layout;
+    const char *name;
+    const char *desc;
+} rt_bvh_layouts_t;
+
+static rt_bvh_layouts_t gs_layouts[] = {
+    {RT_BVH_LAYOUT_AUTO, "auto", "Widest tree the CPU has vector box tests for"},
+    {RT_BVH_LAYOUT_BINARY, "binary", "Binary tree of 32-byte nodes"},
+    {RT_BVH_LAYOUT_BVH4, "bvh4", "4-wide tree, SSE box tests"},
+    {RT_BVH_LAYOUT_BVH8, "bvh8", "8-wide tree, AVX2 box tests"},
+};
+
+// Layout of the trees built from now on, resolved on the first build if nobody has set it
+static rt_bvh_layout_t gs_layout = RT_BVH_LAYOUT_AUTO;
+static bool gs_allow_simd = true;
+static int gs_width = 0;
+static rt_bvh_simd_box_test_fn gs_box_test = NULL;
+static rt_bvh_simd_packet_box_test_fn gs_packet_box_test = NULL;
+static char gs_layout_description[64];
+static rt_thread_pool_t *gs_build_pool = NULL;
+
+void rt_bvh_set_build_pool(rt_thread_pool_t *pool)
+{
+    gs_build_pool = pool;
+}
+
+void rt_bvh_set_layout(rt_bvh_layout_t layout, bool allow_simd)
+{
+    assert(RT_BVH_LAYOUT_NONE != layout);
+
+    gs_layout = layout;
+    gs_allow_simd = allow_simd;
+    bvh_resolve_layout();
+}
+
+const char *rt_bvh_get_layout_description(void)
+{
+    if (0 == gs_width)
+    {
+        bvh_resolve_layout();
+    }
+    return gs_layout_description;
+}
+
+rt_bvh_layout_t rt_bvh_get_layout_by_name(const char *name)
+{
+    if (NULL == name)
+    {
+        return RT_BVH_LAYOUT_NONE;
+    }
+
+    for (size_t i = 0; i < sizeof(gs_layouts) / sizeof(gs_layouts[0]); ++i)
+    {
+        if (0 == strcmp(gs_layouts[i].name, name))
+        {
+            return gs_layouts[i].layout;
+        }
+    }
+
+    return RT_BVH_LAYOUT_NONE;
+}
+
+void rt_bvh_print_layouts_info(FILE *to)
+{
+    assert(NULL != to);
+
+    for (size_t i = 0; i < sizeof(gs_layouts) / sizeof(gs_layouts[0]); ++i)
+    {
+        fprintf(to, "\t%-30s  %s\n", gs_layouts[i].name, gs_layouts[i].desc);
+    }
+}
+
+static void bvh_resolve_layout(void)
 {
-    return bvh_make_node(rt_hittable_list_get_underlying_container(hittable_list), 0,
-                         rt_hittable_list_get_size(hittable_list), time0, time1);
+    const char *box_test_name = NULL;
+    switch (gs_layout)
+    {
+        case RT_BVH_LAYOUT_AUTO:
+            // Wide trees only pay off if all the children are tested at once
+            gs_width = 2;
+            gs_box_test = NULL;
+            for (int width = RT_BVH_MAX_WIDTH; width > 2 && 2 == gs_width; width /= 2)
+            {
+                rt_bvh_simd_box_test_fn box_test = rt_bvh_simd_select_box_test(width, gs_allow_simd, &box_test_name);
+                if (0 != strcmp(box_test_name, "scalar"))
+                {
+                    gs_width = width;
+                    gs_box_test = box_test;
+                }
+            }
+            break;
+
+        case RT_BVH_LAYOUT_BVH4:
+            gs_width = 4;
+            gs_box_test = rt_bvh_simd_select_box_test(gs_width, gs_allow_simd, &box_test_name);
+            break;
+
+        case RT_BVH_LAYOUT_BVH8:
+            gs_width = 8;
+            gs_box_test = rt_bvh_simd_select_box_test(gs_width, gs_allow_simd, &box_test_name);
+            break;
+
+        default:
+            gs_width = 2;
+            gs_box_test = NULL;
+            break;
+    }
+
+    gs_packet_box_test = rt_bvh_simd_select_packet_box_test(gs_allow_simd, NULL);
+
+    if (2 == gs_width)
+    {
+        snprintf(gs_layout_description, sizeof(gs_layout_description), "binary");
+    }
+    else
+    {
+        snprintf(gs_layout_description, sizeof(gs_layout_description), "bvh%d (%s box test)", gs_width,
+                 box_test_name);
+    }
 }
 
-static rt_hittable_t *bvh_make_node(rt_hittable_t **hittable_array, size_t start, size_t end, double time0,
-                                    double time1)
+rt_hittable_t *rt_bvh_node_new(const rt_hittable_list_t *hittable_list, double time0, double time1)
 {
-    static unsigned int dummy=0; if (dummy==0) dummy=pthread_self();
+    assert(NULL != hittable_list);
 
-    assert(NULL != hittable_array);
+    rt_hittable_t **hittable_array = rt_hittable_list_get_underlying_container(hittable_list);
+    size_t number_of_objects = rt_hittable_list_get_size(hittable_list);
+    assert(number_of_objects > 0);
 
-    rt_bvh_node_t *result = calloc(1, sizeof(rt_bvh_node_t));
+    rt_bvh_t *result = rt_arena_calloc(sizeof(rt_bvh_t));
     assert(NULL != result);
 
-    size_t number_of_objects = end - start;
+    bvh_build_context_t context = {
+        .bounds = calloc(number_of_objects, sizeof(rt_aabb_t)),
+        .centroids = calloc(number_of_objects, sizeof(point3_t)),
+        .indices = calloc(number_of_objects, sizeof(size_t)),
+        .pool = gs_build_pool,
+    };
+    assert(NULL != context.bounds && NULL != context.centroids && NULL != context.indices);
+
+    // Bounding boxes are queried once, the builder itself never goes through the vtable
+    size_t number_of_chunks = (number_of_objects + RT_BVH_BOUNDS_CHUNK_SIZE - 1) / RT_BVH_BOUNDS_CHUNK_SIZE;
+    bvh_bounds_task_t *bounds_tasks = calloc(number_of_chunks, sizeof(bvh_bounds_task_t));
+    assert(NULL != bounds_tasks);
+    for (size_t chunk = 0; chunk < number_of_chunks; ++chunk)
+    {
+        bvh_bounds_task_t *task = &bounds_tasks[chunk];
+        task->context = &context;
+        task->hittables = hittable_array;
+        task->start = chunk * RT_BVH_BOUNDS_CHUNK_SIZE;
+        task->end = task->start + RT_BVH_BOUNDS_CHUNK_SIZE < number_of_objects ? task->start + RT_BVH_BOUNDS_CHUNK_SIZE
+                                                                                : number_of_objects;
+        task->time0 = time0;
+        task->time1 = time1;
+
+        if (NULL != context.pool && number_of_chunks > 1)
+        {
+            rt_thread_pool_submit(context.pool, bvh_bounds_task, task);
+        }
+        else
+        {
+            bvh_bounds_task(task);
+        }
+    }
+    if (NULL != context.pool)
+    {
+        rt_thread_pool_wait(context.pool);
+    }
+    free(bounds_tasks);
+
+    // Large subtrees are handed to the pool as they come up, waiting for the pool to drain waits for all of them
+    bvh_build_node_t *root = bvh_build(&context, 0, number_of_objects, 0);
+    if (NULL != context.pool)
+    {
+        rt_thread_pool_wait(context.pool);
+    }
+    result->box = root->box;
 
-    int axis = rand_r(&dummy) % 3;
+    if (0 == gs_width)
+    {
+        bvh_resolve_layout();
+    }
+    result->width = gs_width;
+    result->packet_box_test = gs_packet_box_test;
 
-    rt_hittable_compare_fn cmp = rt_hittable_box_cmp_x;
-    if (axis == 1)
+    // Flatten the tree into one cache-aligned array
+    size_t next_node = 0;
+    if (2 == result->width)
     {
-        cmp = rt_hittable_box_cmp_y;
+        result->number_of_nodes = bvh_count_nodes(root);
+        result->nodes = bvh_alloc_aligned(result->number_of_nodes * sizeof(rt_bvh_node_t));
+        bvh_flatten(result->nodes, root, &next_node);
     }
-    else if (axis == 2)
+    else
     {
-        cmp = rt_hittable_box_cmp_z;
+        // Every wide node swallows at least one inner binary node, so the binary node count is an upper bound
+        result->box_test = gs_box_test;
+        result->wide_node_size = RT_BVH_WIDE_NODE_SIZE(result->width);
+        result->wide_nodes = bvh_alloc_aligned(bvh_count_nodes(root) * result->wide_node_size);
+        bvh_collapse(result, root, &next_node);
+        result->number_of_nodes = next_node;
     }
+    bvh_delete_build_nodes(root);
 
-    if (number_of_objects == 1)
+    result->primitives = rt_arena_calloc(number_of_objects * sizeof(rt_hittable_t *));
+    assert(NULL != result->primitives);
+    for (size_t i = 0; i < number_of_objects; ++i)
     {
-        result->left = result->right = rt_hittable_claim(hittable_array[start]);
+        result->primitives[i] = rt_hittable_claim(hittable_array[context.indices[i]]);
     }
-    else if (number_of_objects == 2)
+    result->number_of_primitives = number_of_objects;
+
+    free(context.indices);
+    free(context.centroids);
+    free(context.bounds);
+
+    rt_hittable_init(&result->base, RT_HITTABLE_TYPE_BVH_NODE, 2 == result->width ? rt_bvh_hit : rt_bvh_wide_hit,
+                     rt_bvh_bb, rt_bvh_delete);
+    result->base.occluded = 2 == result->width ? rt_bvh_occluded : rt_bvh_wide_occluded;
+    result->base.hit_packet = 2 == result->width ? rt_bvh_hit_packet : rt_bvh_wide_hit_packet;
+    rt_hittable_init_light_sampling(&result->base, NULL, NULL, rt_bvh_collect_lights);
+    return (rt_hittable_t *)result;
+}
+
+rt_bvh_node_t *rt_bvh_build_nodes(const rt_aabb_t *bounds, size_t number_of_primitives, uint32_t *out_order,
+                                  size_t *out_number_of_nodes)
+{
+    assert(NULL != bounds);
+    assert(NULL != out_order);
+    assert(NULL != out_number_of_nodes);
+    assert(number_of_primitives > 0 && number_of_primitives <= UINT32_MAX);
+
+    bvh_build_context_t context = {
+        .bounds = calloc(number_of_primitives, sizeof(rt_aabb_t)),
+        .centroids = calloc(number_of_primitives, sizeof(point3_t)),
+        .indices = calloc(number_of_primitives, sizeof(size_t)),
+        .pool = gs_build_pool,
+    };
+    assert(NULL != context.bounds && NULL != context.centroids && NULL != context.indices);
+
+    for (size_t i = 0; i < number_of_primitives; ++i)
+    {
+        context.bounds[i] = bounds[i];
+        context.centroids[i] = rt_aabb_centroid(&bounds[i]);
+        context.indices[i] = i;
+    }
+
+    bvh_build_node_t *root = bvh_build(&context, 0, number_of_primitives, 0);
+    if (NULL != context.pool)
     {
-        if (cmp(hittable_array + start, hittable_array + start + 1) < 0)
+        rt_thread_pool_wait(context.pool);
+    }
+
+    size_t number_of_nodes = bvh_count_nodes(root);
+    rt_bvh_node_t *nodes = bvh_alloc_aligned(number_of_nodes * sizeof(rt_bvh_node_t));
+    size_t next_node = 0;
+    bvh_flatten(nodes, root, &next_node);
+    bvh_delete_build_nodes(root);
+
+    for (size_t i = 0; i < number_of_primitives; ++i)
+    {
+        out_order[i] = (uint32_t)context.indices[i];
+    }
+    *out_number_of_nodes = number_of_nodes;
+
+    free(context.indices);
+    free(context.centroids);
+    free(context.bounds);
+    return nodes;
+}
+
+static bvh_build_node_t *bvh_build(const bvh_build_context_t *context, size_t start, size_t end, int depth)
+{
+    bvh_build_node_t *node = calloc(1, sizeof(bvh_build_node_t));
+    assert(NULL != node);
+
+    node->box = context->bounds[context->indices[start]];
+    for (size_t i = start + 1; i < end; ++i)
+    {
+        node->box = rt_aabb_surrounding_bb(node->box, context->bounds[context->indices[i]]);
+    }
+
+    size_t middle;
+    if (!bvh_find_split(context, start, end, &node->box, depth, &middle, &node->axis))
+    {
+        node->first_primitive = start;
+        node->number_of_primitives = end - start;
+        return node;
+    }
+
+    // Children write to disjoint parts of indices, so they can be built independently
+    if (NULL != context->pool && end - middle >= RT_BVH_PARALLEL_BUILD_THRESHOLD)
+    {
+        bvh_build_task_t *task = calloc(1, sizeof(bvh_build_task_t));
+        assert(NULL != task);
+        task->context = context;
+        task->out_node = &node->children[1];
+        task->start = middle;
+        task->end = end;
+        task->depth = depth + 1;
+        rt_thread_pool_submit(context->pool, bvh_build_task, task);
+    }
+    else
+    {
+        node->children[1] = bvh_build(context, middle, end, depth + 1);
+    }
+    node->children[0] = bvh_build(context, start, middle, depth + 1);
+    return node;
+}
+
+static void bvh_build_task(void *arg)
+{
+    bvh_build_task_t *task = arg;
+    assert(NULL != task);
+
+    *task->out_node = bvh_build(task->context, task->start, task->end, task->depth);
+    free(task);
+}
+
+static void bvh_bounds_task(void *arg)
+{
+    bvh_bounds_task_t *task = arg;
+    assert(NULL != task);
+
+    const bvh_build_context_t *context = task->context;
+    for (size_t i = task->start; i < task->end; ++i)
+    {
+        if (!rt_hittable_bb(task->hittables[i], task->time0, task->time1, &context->bounds[i]))
+        {
+            assert(0);
+        }
+        context->centroids[i] = rt_aabb_centroid(&context->bounds[i]);
+        context->indices[i] = i;
+    }
+}
+
+static inline int bvh_bin_index(double centroid, double min, double scale)
+{
+    int bin = (int)((centroid - min) * scale);
+    return bin < RT_BVH_NUMBER_OF_BINS - 1 ? bin : RT_BVH_NUMBER_OF_BINS - 1;
+}
+
+// Quickselect: reorders indices[start, end) so that the nth one is where sorting by the centroid along axis would put
+// it, with no larger centroids before it and no smaller ones after it
+static void bvh_select(const bvh_build_context_t *context, size_t start, size_t end, size_t nth, int axis)
+{
+    size_t *indices = context->indices;
+    while (end - start > 1)
+    {
+        double pivot = context->centroids[indices[start + (end - start) / 2]].components[axis];
+
+        // Three-way partition into [start, less) < pivot, [less, greater) == pivot and [greater, end) > pivot
+        size_t less = start, i = start, greater = end;
+        while (i < greater)
+        {
+            double c = context->centroids[indices[i]].components[axis];
+            size_t tmp = indices[i];
+            if (c < pivot)
+            {
+                indices[i++] = indices[less];
+                indices[less++] = tmp;
+            }
+            else if (c > pivot)
+            {
+                indices[i] = indices[--greater];
+                indices[greater] = tmp;
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        if (nth < less)
         {
-            result->left = rt_hittable_claim(hittable_array[start]);
-            result->right = rt_hittable_claim(hittable_array[start + 1]);
+            end = less;
+        }
+        else if (nth >= greater)
+        {
+            start = greater;
         }
         else
         {
-            result->left = rt_hittable_claim(hittable_array[start + 1]);
-            result->right = rt_hittable_claim(hittable_array[start]);
+            return;
         }
     }
+}
+
+// Bins centroids along every axis and picks the split with the lowest surface area heuristic cost. Returns false
+// if the range is better off as a leaf, otherwise partitions indices[start, end) around *out_middle.
+static bool bvh_find_split(const bvh_build_context_t *context, size_t start, size_t end, const rt_aabb_t *box,
+                           int depth, size_t *out_middle, int *out_axis)
+{
+    size_t count = end - start;
+    if (1 == count)
+    {
+        return false;
+    }
+
+    point3_t centroid_min = context->centroids[context->indices[start]];
+    point3_t centroid_max = centroid_min;
+    for (size_t i = start + 1; i < end; ++i)
+    {
+        point3_t c = context->centroids[context->indices[i]];
+        centroid_min = point3(fmin(centroid_min.x, c.x), fmin(centroid_min.y, c.y), fmin(centroid_min.z, c.z));
+        centroid_max = point3(fmax(centroid_max.x, c.x), fmax(centroid_max.y, c.y), fmax(centroid_max.z, c.z));
+    }
+
+    double best_cost = INFINITY;
+    int best_axis = -1, best_split = 0;
+    for (vec3_axis_t axis = VEC3_AXIS_X; axis <= VEC3_AXIS_Z; axis++)
+    {
+        double extent = centroid_max.components[axis] - centroid_min.components[axis];
+        if (extent <= 0)
+        {
+            continue;
+        }
+        double scale = RT_BVH_NUMBER_OF_BINS / extent;
+
+        bvh_bin_t bins[RT_BVH_NUMBER_OF_BINS] = {0};
+        for (size_t i = start; i < end; ++i)
+        {
+            size_t index = context->indices[i];
+            bvh_bin_t *bin =
+                &bins[bvh_bin_index(context->centroids[index].components[axis], centroid_min.components[axis], scale)];
+            bin->box =
+                0 == bin->count ? context->bounds[index] : rt_aabb_surrounding_bb(bin->box, context->bounds[index]);
+            bin->count++;
+        }
+
+        // Sweep from the right to get the cost of everything past each split plane, then from the left
+        double right_area[RT_BVH_NUMBER_OF_BINS] = {0};
+        size_t right_count[RT_BVH_NUMBER_OF_BINS] = {0};
+        rt_aabb_t accumulated = {0};
+        size_t accumulated_count = 0;
+        for (int b = RT_BVH_NUMBER_OF_BINS - 1; b > 0; --b)
+        {
+            if (bins[b].count > 0)
+            {
+                accumulated = 0 == accumulated_count ? bins[b].box : rt_aabb_surrounding_bb(accumulated, bins[b].box);
+                accumulated_count += bins[b].count;
+            }
+            right_count[b] = accumulated_count;
+            right_area[b] = accumulated_count > 0 ? rt_aabb_surface_area(&accumulated) : 0;
+        }
+
+        accumulated_count = 0;
+        for (int b = 0; b < RT_BVH_NUMBER_OF_BINS - 1; ++b)
+        {
+            if (bins[b].count > 0)
+            {
+                accumulated = 0 == accumulated_count ? bins[b].box : rt_aabb_surrounding_bb(accumulated, bins[b].box);
+                accumulated_count += bins[b].count;
+            }
+            if (0 == accumulated_count || 0 == right_count[b + 1])
+            {
+                continue;
+            }
+
+            double cost = rt_aabb_surface_area(&accumulated) * (double)accumulated_count +
+                          right_area[b + 1] * (double)right_count[b + 1];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    // SAH cost of the split relative to the cost of just intersecting everything in a single leaf
+    double area = rt_aabb_surface_area(box);
+    double leaf_cost = RT_BVH_INTERSECTION_COST * (double)count;
+    double split_cost = area > 0 ? RT_BVH_TRAVERSAL_COST + RT_BVH_INTERSECTION_COST * best_cost / area : INFINITY;
+
+    if (best_axis < 0 || depth >= RT_BVH_MAX_SAH_DEPTH)
+    {
+        // Either all centroids coincide and binning can't separate them, so any two halves are as good as the other,
+        // or the tree got too deep and the range is split at its median centroid along the best axis
+        if (count <= RT_BVH_MAX_LEAF_SIZE)
+        {
+            return false;
+        }
+        *out_middle = start + count / 2;
+        *out_axis = best_axis < 0 ? VEC3_AXIS_X : best_axis;
+        if (best_axis >= 0)
+        {
+            bvh_select(context, start, end, *out_middle, best_axis);
+        }
+        return true;
+    }
+    if (count <= RT_BVH_MAX_LEAF_SIZE && leaf_cost <= split_cost)
+    {
+        return false;
+    }
+
+    double scale = RT_BVH_NUMBER_OF_BINS / (centroid_max.components[best_axis] - centroid_min.components[best_axis]);
+    size_t left = start, right = end;
+    while (left < right)
+    {
+        double c = context->centroids[context->indices[left]].components[best_axis];
+        if (bvh_bin_index(c, centroid_min.components[best_axis], scale) <= best_split)
+        {
+            left++;
+        }
+        else
+        {
+            size_t tmp = context->indices[left];
+            context->indices[left] = context->indices[--right];
+            context->indices[right] = tmp;
+        }
+    }
+
+    *out_middle = left;
+    *out_axis = best_axis;
+    return true;
+}
+
+static size_t bvh_count_nodes(const bvh_build_node_t *node)
+{
+    if (NULL == node->children[0])
+    {
+        return 1;
+    }
+    return 1 + bvh_count_nodes(node->children[0]) + bvh_count_nodes(node->children[1]);
+}
+
+static inline float round_down(double x)
+{
+    float result = (float)x;
+    return (double)result > x ? nextafterf(result, -INFINITY) : result;
+}
+
+static inline float round_up(double x)
+{
+    float result = (float)x;
+    return (double)result < x ? nextafterf(result, INFINITY) : result;
+}
+
+// Writes the subtree in depth-first order starting at *next_node, returns the index of its root
+static size_t bvh_flatten(rt_bvh_node_t *nodes, const bvh_build_node_t *node, size_t *next_node)
+{
+    size_t index = (*next_node)++;
+    rt_bvh_node_t *linear = &nodes[index];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        linear->min[axis] = round_down(node->box.min.components[axis]);
+        linear->max[axis] = round_up(node->box.max.components[axis]);
+    }
+    linear->pad = 0;
+
+    if (NULL == node->children[0])
+    {
+        assert(node->first_primitive <= UINT32_MAX && node->number_of_primitives <= UINT16_MAX);
+        linear->offset = (uint32_t)node->first_primitive;
+        linear->number_of_primitives = (uint16_t)node->number_of_primitives;
+        linear->axis = 0;
+    }
     else
     {
-        qsort(hittable_array + start, number_of_objects, sizeof(rt_hittable_t *), cmp);
-        size_t middle = start + number_of_objects / 2;
+        linear->number_of_primitives = 0;
+        linear->axis = (uint8_t)node->axis;
+        bvh_flatten(nodes, node->children[0], next_node);
+        size_t second_child = bvh_flatten(nodes, node->children[1], next_node);
+        assert(second_child <= UINT32_MAX);
+        linear->offset = (uint32_t)second_child;
+    }
 
-        result->left = bvh_make_node(hittable_array, start, middle, time0, time1);
-        result->right = bvh_make_node(hittable_array, middle, end, time0, time1);
+    return index;
+}
+
+// Turns the subtree into wide nodes: starting from the node's children, keeps replacing the inner child with the
+// largest surface area by its own two children until there are width of them. Returns the index of the wide node.
+static size_t bvh_collapse(rt_bvh_t *bvh, const bvh_build_node_t *node, size_t *next_node)
+{
+    const bvh_build_node_t *children[RT_BVH_MAX_WIDTH];
+    int number_of_children = 0;
+    if (NULL == node->children[0])
+    {
+        children[number_of_children++] = node;
+    }
+    else
+    {
+        children[number_of_children++] = node->children[0];
+        children[number_of_children++] = node->children[1];
     }
 
-    rt_aabb_t box_left = {0}, box_right = {0};
-    if (!rt_hittable_bb(result->left, time0, time1, &box_left) ||
-        !rt_hittable_bb(result->right, time0, time1, &box_right))
+    while (number_of_children < bvh->width)
     {
-        assert(0);
+        int largest = -1;
+        double largest_area = -1;
+        for (int i = 0; i < number_of_children; ++i)
+        {
+            double area = rt_aabb_surface_area(&children[i]->box);
+            if (NULL != children[i]->children[0] && area > largest_area)
+            {
+                largest = i;
+                largest_area = area;
+            }
+        }
+        if (largest < 0)
+        {
+            break;
+        }
+
+        const bvh_build_node_t *expanded = children[largest];
+        children[largest] = expanded->children[0];
+        children[number_of_children++] = expanded->children[1];
     }
 
-    result->box = rt_aabb_surrounding_bb(box_left, box_right);
-    rt_hittable_init(&result->base, RT_HITTABLE_TYPE_BVH_NODE, rt_bvh_node_hit, rt_bvh_node_bb, rt_bvh_node_delete);
+    size_t index = (*next_node)++;
+    int width = bvh->width;
+    uint8_t *wide = bvh->wide_nodes + index * bvh->wide_node_size;
+    memset(wide, 0, bvh->wide_node_size);
 
-    return (rt_hittable_t *)result;
+    float *bounds = (float *)wide;
+    uint32_t *child = (uint32_t *)(wide + RT_BVH_WIDE_CHILD_OFFSET(width));
+    uint16_t *count = (uint16_t *)(wide + RT_BVH_WIDE_COUNT_OFFSET(width));
+    wide[RT_BVH_WIDE_MASK_OFFSET(width)] = (uint8_t)((1u << number_of_children) - 1);
+
+    for (int i = 0; i < number_of_children; ++i)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            bounds[axis * width + i] = round_down(children[i]->box.min.components[axis]);
+            bounds[(axis + 3) * width + i] = round_up(children[i]->box.max.components[axis]);
+        }
+
+        if (NULL == children[i]->children[0])
+        {
+            assert(children[i]->first_primitive <= UINT32_MAX && children[i]->number_of_primitives <= UINT16_MAX);
+            child[i] = (uint32_t)children[i]->first_primitive;
+            count[i] = (uint16_t)children[i]->number_of_primitives;
+        }
+        else
+        {
+            size_t child_index = bvh_collapse(bvh, children[i], next_node);
+            assert(child_index <= UINT32_MAX);
+            child[i] = (uint32_t)child_index;
+        }
+    }
+
+    return index;
 }
 
-static bool rt_bvh_node_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+static bool rt_bvh_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
+                       rt_hit_record_t *record)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+
+    bool hit_anything = false;
+    uint32_t stack[RT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const rt_bvh_node_t *node = &bvh->nodes[current];
+        if (rt_bvh_node_box_hit(node, ray, t_min, t_max))
+        {
+            if (node->number_of_primitives > 0)
+            {
+                for (uint32_t i = 0; i < node->number_of_primitives; ++i)
+                {
+                    if (rt_hittable_hit(bvh->primitives[node->offset + i], ray, t_min, t_max, record))
+                    {
+                        hit_anything = true;
+                        t_max = record->t;
+                    }
+                }
+            }
+            else
+            {
+                // Visit the child nearer to the ray origin first, so the far one is likely culled by the closer hit
+                assert(stack_size < RT_BVH_STACK_SIZE);
+                if (ray->sign[node->axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node->offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node->offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// Same traversal as rt_bvh_hit, except that any intersection ends it
+static bool rt_bvh_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+
+    uint32_t stack[RT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const rt_bvh_node_t *node = &bvh->nodes[current];
+        if (rt_bvh_node_box_hit(node, ray, t_min, t_max))
+        {
+            if (node->number_of_primitives > 0)
+            {
+                for (uint32_t i = 0; i < node->number_of_primitives; ++i)
+                {
+                    if (rt_hittable_occluded(bvh->primitives[node->offset + i], ray, t_min, t_max))
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                assert(stack_size < RT_BVH_STACK_SIZE);
+                if (ray->sign[node->axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node->offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node->offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    return false;
+}
+
+typedef struct bvh_wide_stack_entry_s
+{
+    uint32_t node;
+    float t_near;
+} bvh_wide_stack_entry_t;
+
+static bool rt_bvh_wide_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                             rt_hit_record_t *record)
 {
     assert(NULL != hittable);
     assert(NULL != ray);
 
     assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
-    rt_bvh_node_t *bvh_node = (rt_bvh_node_t *)hittable;
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+    const int width = bvh->width;
 
-    if (!rt_aabb_hit(&bvh_node->box, t_min, t_max, ray))
+    rt_bvh_simd_ray_t simd_ray;
+    for (int axis = 0; axis < 3; ++axis)
     {
-        return false;
+        simd_ray.origin[axis] = (float)ray->origin.components[axis];
+        simd_ray.inv_direction[axis] = (float)ray->inv_direction.components[axis];
+    }
+    float t_min_f = round_down(t_min), t_max_f = round_up(t_max);
+
+    bool hit_anything = false;
+    bvh_wide_stack_entry_t stack[RT_BVH_WIDE_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const uint8_t *wide = bvh->wide_nodes + current * bvh->wide_node_size;
+        const uint32_t *child = (const uint32_t *)(wide + RT_BVH_WIDE_CHILD_OFFSET(width));
+        const uint16_t *count = (const uint16_t *)(wide + RT_BVH_WIDE_COUNT_OFFSET(width));
+
+        float t_near[RT_BVH_MAX_WIDTH];
+        unsigned mask = bvh->box_test((const float *)wide, &simd_ray, t_min_f, t_max_f, t_near);
+        mask &= wide[RT_BVH_WIDE_MASK_OFFSET(width)];
+
+        // Sort the children that were hit front to back
+        int order[RT_BVH_MAX_WIDTH], number_of_hits = 0;
+        for (int i = 0; i < width; ++i)
+        {
+            if (mask & (1u << i))
+            {
+                int j = number_of_hits++;
+                for (; j > 0 && t_near[order[j - 1]] > t_near[i]; --j)
+                {
+                    order[j] = order[j - 1];
+                }
+                order[j] = i;
+            }
+        }
+
+        // Leaves are intersected right away, inner nodes are pushed far to near so the nearest one is visited next
+        for (int k = 0; k < number_of_hits; ++k)
+        {
+            int i = order[k];
+            if (0 == count[i] || t_near[i] > t_max_f)
+            {
+                continue;
+            }
+            for (uint32_t p = 0; p < count[i]; ++p)
+            {
+                if (rt_hittable_hit(bvh->primitives[child[i] + p], ray, t_min, t_max, record))
+                {
+                    hit_anything = true;
+                    t_max = record->t;
+                    t_max_f = round_up(t_max);
+                }
+            }
+        }
+        for (int k = number_of_hits - 1; k >= 0; --k)
+        {
+            int i = order[k];
+            if (0 == count[i])
+            {
+                assert(stack_size < RT_BVH_WIDE_STACK_SIZE);
+                stack[stack_size].node = child[i];
+                stack[stack_size].t_near = t_near[i];
+                stack_size++;
+            }
+        }
+
+        // Skip the nodes that are farther than the closest hit found since they were pushed
+        while (stack_size > 0 && stack[stack_size - 1].t_near > t_max_f)
+        {
+            stack_size--;
+        }
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size].node;
+    }
+
+    return hit_anything;
+}
+
+// Any-hit version of rt_bvh_wide_hit: the interval never shrinks, so there's no point in sorting the children
+static bool rt_bvh_wide_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+    const int width = bvh->width;
+
+    rt_bvh_simd_ray_t simd_ray;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        simd_ray.origin[axis] = (float)ray->origin.components[axis];
+        simd_ray.inv_direction[axis] = (float)ray->inv_direction.components[axis];
+    }
+    float t_min_f = round_down(t_min), t_max_f = round_up(t_max);
+
+    uint32_t stack[RT_BVH_WIDE_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const uint8_t *wide = bvh->wide_nodes + current * bvh->wide_node_size;
+        const uint32_t *child = (const uint32_t *)(wide + RT_BVH_WIDE_CHILD_OFFSET(width));
+        const uint16_t *count = (const uint16_t *)(wide + RT_BVH_WIDE_COUNT_OFFSET(width));
+
+        float t_near[RT_BVH_MAX_WIDTH];
+        unsigned mask = bvh->box_test((const float *)wide, &simd_ray, t_min_f, t_max_f, t_near);
+        mask &= wide[RT_BVH_WIDE_MASK_OFFSET(width)];
+
+        for (int i = 0; i < width; ++i)
+        {
+            if (0 == (mask & (1u << i)))
+            {
+                continue;
+            }
+            if (0 == count[i])
+            {
+                assert(stack_size < RT_BVH_WIDE_STACK_SIZE);
+                stack[stack_size++] = child[i];
+                continue;
+            }
+            for (uint32_t p = 0; p < count[i]; ++p)
+            {
+                if (rt_hittable_occluded(bvh->primitives[child[i] + p], ray, t_min, t_max))
+                {
+                    return true;
+                }
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    return false;
+}
+
+_Static_assert(RT_RAY_PACKET_SIZE == RT_BVH_SIMD_PACKET_SIZE, "Packet box tests expect one lane per packet ray");
+
+// Single precision copy of the rays in mask for the packet box tests. The interval of the other lanes is left empty,
+// so they never hit a box.
+static void bvh_packet_prepare(const rt_ray_packet_t *packet, unsigned mask, const double *t_max,
+                               rt_bvh_simd_packet_t *simd_packet, float *t_max_f)
+{
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        bool used = 0 != (mask & (1u << lane));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            simd_packet->origin[axis][lane] = used ? (float)packet->rays[lane].origin.components[axis] : 0.0f;
+            simd_packet->inv_direction[axis][lane] =
+                used ? (float)packet->rays[lane].inv_direction.components[axis] : 0.0f;
+        }
+        t_max_f[lane] = used ? round_up(t_max[lane]) : -INFINITY;
+    }
+}
+
+// Intersects the rays of the lanes in mask with the primitives of a leaf and shrinks the intervals of the lanes that hit
+static inline unsigned bvh_packet_leaf_hit(const rt_bvh_t *bvh, uint32_t first, uint32_t count,
+                                           rt_ray_packet_t *packet, unsigned mask, double t_min, double *t_max,
+                                           float *t_max_f, rt_hit_record_t *records)
+{
+    unsigned result = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        result |= rt_hittable_hit_packet(bvh->primitives[first + i], packet, mask, t_min, t_max, records);
+    }
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (result & (1u << lane))
+        {
+            t_max_f[lane] = round_up(t_max[lane]);
+        }
+    }
+    return result;
+}
+
+static inline float bvh_packet_farthest(const float *t_max_f)
+{
+    float result = t_max_f[0];
+    for (int lane = 1; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        result = t_max_f[lane] > result ? t_max_f[lane] : result;
     }
+    return result;
+}
+
+// Packet version of rt_bvh_hit: the lanes share one traversal stack. A node is entered if any of the lanes hits its
+// box and only those lanes are tested against its primitives. Children are visited in the order of the first lane,
+// which is right for the other lanes as well as long as the rays are coherent.
+static unsigned rt_bvh_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                  double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+    if (0 == mask)
+    {
+        return 0;
+    }
+
+    rt_bvh_simd_packet_t simd_packet;
+    float t_max_f[RT_RAY_PACKET_SIZE];
+    bvh_packet_prepare(packet, mask, t_max, &simd_packet, t_max_f);
+    float t_min_f = round_down(t_min);
 
-    bool hit_left = rt_hittable_hit(bvh_node->left, ray, t_min, t_max, record);
-    bool hit_right = rt_hittable_hit(bvh_node->right, ray, t_min, hit_left ? record->t : t_max, record);
+    const ray_t *leader = &packet->rays[__builtin_ctz(mask)];
 
-    return hit_left || hit_right;
+    unsigned result = 0;
+    uint32_t stack[RT_BVH_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const rt_bvh_node_t *node = &bvh->nodes[current];
+        const float bounds[6] = {node->min[0], node->min[1], node->min[2], node->max[0], node->max[1], node->max[2]};
+        float t_near[RT_RAY_PACKET_SIZE];
+        unsigned lanes = mask & bvh->packet_box_test(bounds, 1, &simd_packet, t_min_f, t_max_f, t_near);
+        if (0 != lanes)
+        {
+            if (node->number_of_primitives > 0)
+            {
+                result |= bvh_packet_leaf_hit(bvh, node->offset, node->number_of_primitives, packet, lanes, t_min,
+                                              t_max, t_max_f, records);
+            }
+            else
+            {
+                assert(stack_size < RT_BVH_STACK_SIZE);
+                if (leader->sign[node->axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node->offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node->offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+
+    return result;
 }
 
-static bool rt_bvh_node_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
+// Packet version of rt_bvh_wide_hit. Children are tested one at a time against all lanes and ordered by the nearest
+// entry distance of any lane.
+static unsigned rt_bvh_wide_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                       double t_min, double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+    const int width = bvh->width;
+    if (0 == mask)
+    {
+        return 0;
+    }
+
+    rt_bvh_simd_packet_t simd_packet;
+    float t_max_f[RT_RAY_PACKET_SIZE];
+    bvh_packet_prepare(packet, mask, t_max, &simd_packet, t_max_f);
+    float t_min_f = round_down(t_min);
+
+    unsigned result = 0;
+    bvh_wide_stack_entry_t stack[RT_BVH_WIDE_STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const uint8_t *wide = bvh->wide_nodes + current * bvh->wide_node_size;
+        const uint32_t *child = (const uint32_t *)(wide + RT_BVH_WIDE_CHILD_OFFSET(width));
+        const uint16_t *count = (const uint16_t *)(wide + RT_BVH_WIDE_COUNT_OFFSET(width));
+        unsigned used = wide[RT_BVH_WIDE_MASK_OFFSET(width)];
+
+        // Lanes that hit every child and the nearest entry distance among them, children that were hit sorted front
+        // to back
+        unsigned lanes[RT_BVH_MAX_WIDTH];
+        float child_near[RT_BVH_MAX_WIDTH];
+        int order[RT_BVH_MAX_WIDTH], number_of_hits = 0;
+        for (int i = 0; i < width; ++i)
+        {
+            if (0 == (used & (1u << i)))
+            {
+                continue;
+            }
+
+            float t_near[RT_RAY_PACKET_SIZE];
+            lanes[i] = mask & bvh->packet_box_test((const float *)wide + i, width, &simd_packet, t_min_f, t_max_f,
+                                                   t_near);
+            if (0 == lanes[i])
+            {
+                continue;
+            }
+
+            child_near[i] = INFINITY;
+            for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+            {
+                if ((lanes[i] & (1u << lane)) && t_near[lane] < child_near[i])
+                {
+                    child_near[i] = t_near[lane];
+                }
+            }
+
+            int j = number_of_hits++;
+            for (; j > 0 && child_near[order[j - 1]] > child_near[i]; --j)
+            {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+
+        for (int k = 0; k < number_of_hits; ++k)
+        {
+            int i = order[k];
+            if (0 != count[i])
+            {
+                result |= bvh_packet_leaf_hit(bvh, child[i], count[i], packet, lanes[i], t_min, t_max, t_max_f,
+                                              records);
+            }
+        }
+        for (int k = number_of_hits - 1; k >= 0; --k)
+        {
+            int i = order[k];
+            if (0 == count[i])
+            {
+                assert(stack_size < RT_BVH_WIDE_STACK_SIZE);
+                stack[stack_size].node = child[i];
+                stack[stack_size].t_near = child_near[i];
+                stack_size++;
+            }
+        }
+
+        // Skip the nodes that are farther than the closest hits of all lanes found since they were pushed
+        float farthest = bvh_packet_farthest(t_max_f);
+        while (stack_size > 0 && stack[stack_size - 1].t_near > farthest)
+        {
+            stack_size--;
+        }
+        if (0 == stack_size)
+        {
+            break;
+        }
+        current = stack[--stack_size].node;
+    }
+
+    return result;
+}
+
+static bool rt_bvh_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != hittable);
     assert(NULL != out_bb);
 
     assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
-    rt_bvh_node_t *bvh_node = (rt_bvh_node_t *)hittable;
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
 
-    *out_bb = bvh_node->box;
+    *out_bb = bvh->box;
 
     return true;
 }
 
-static void rt_bvh_node_delete(rt_hittable_t *hittable)
+static void rt_bvh_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights)
+{
+    assert(NULL != hittable);
+    assert(NULL != lights);
+
+    assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
+    const rt_bvh_t *bvh = (const rt_bvh_t *)hittable;
+
+    for (size_t i = 0; i < bvh->number_of_primitives; ++i)
+    {
+        rt_hittable_collect_lights(bvh->primitives[i], lights);
+    }
+}
+
+static void bvh_delete_build_nodes(bvh_build_node_t *node)
+{
+    if (NULL == node)
+    {
+        return;
+    }
+
+    bvh_delete_build_nodes(node->children[0]);
+    bvh_delete_build_nodes(node->children[1]);
+    free(node);
+}
+
+// Node arrays start on a cache line, they come from the current arena like the rest of the BVH
+static void *bvh_alloc_aligned(size_t size)
+{
+    rt_arena_t *arena = rt_arena_get_current();
+    if (NULL != arena)
+    {
+        return rt_arena_alloc(arena, size, 64);
+    }
+
+    void *result = aligned_alloc(64, (size + 63) & ~(size_t)63);
+    assert(NULL != result);
+    return result;
+}
+
+static void rt_bvh_delete(rt_hittable_t *hittable)
 {
     if (NULL == hittable)
     {
@@ -136,13 +1341,15 @@ static void rt_bvh_node_delete(rt_hittable_t *hittable)
     }
 
     assert(RT_HITTABLE_TYPE_BVH_NODE == hittable->type);
-    rt_bvh_node_t *bvh_node = (rt_bvh_node_t *)hittable;
+    rt_bvh_t *bvh = (rt_bvh_t *)hittable;
 
-    if (bvh_node->left != bvh_node->right)
+    for (size_t i = 0; i < bvh->number_of_primitives; ++i)
     {
-        rt_hittable_delete(bvh_node->right);
+        rt_hittable_delete(bvh->primitives[i]);
     }
-    rt_hittable_delete(bvh_node->left);
+    free(bvh->primitives);
+    free(bvh->nodes);
+    free(bvh->wide_nodes);
 
-    free(bvh_node);
-}
\ No newline at end of file
+    free(bvh);
+}
@@ -8,9 +8,80 @@
 #define RAY_TRACING_ONE_WEEK_RT_BVH_H
 
 #include <rt_weekend.h>
+#include <rt_aabb.h>
 #include <rt_hittable_list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <rt_thread_pool.h>
+
+typedef enum rt_bvh_layout_e
+{
+    RT_BVH_LAYOUT_NONE = -1,
+    RT_BVH_LAYOUT_AUTO,
+    RT_BVH_LAYOUT_BINARY,
+    RT_BVH_LAYOUT_BVH4,
+    RT_BVH_LAYOUT_BVH8,
+} rt_bvh_layout_t;
+
+// Node of a flattened binary BVH. Nodes are stored in depth-first order, so the first child of an inner node always
+// follows it, and the bounds are rounded outwards to float so that a node fits in half a cache line.
+typedef struct rt_bvh_node_s
+{
+    float min[3];
+    float max[3];
+    // Leaves: index of the first primitive. Inner nodes: index of the second child.
+    uint32_t offset;
+    uint16_t number_of_primitives;
+    // Split axis of an inner node, children are visited in the order the ray goes along it
+    uint8_t axis;
+    uint8_t pad;
+} rt_bvh_node_t;
+
+_Static_assert(sizeof(rt_bvh_node_t) == 32, "BVH nodes are expected to be 32 bytes long");
+
+// Traversal stack size that is enough for any tree the builder makes
+#define RT_BVH_STACK_SIZE (64)
 
 rt_hittable_t *rt_bvh_node_new(const rt_hittable_list_t *hittable_list, double time0, double time1);
 
+// Builds a binary BVH over primitives that aren't hittables of their own, e.g. the triangles of a mesh, with the same
+// builder rt_bvh_node_new uses. Leaves refer to ranges of primitives in the order written to out_order: out_order[i]
+// is the index (into bounds) of the i-th primitive. Nodes come from the current arena, or from the heap if there's
+// none, in which case they are released with free().
+rt_bvh_node_t *rt_bvh_build_nodes(const rt_aabb_t *bounds, size_t number_of_primitives, uint32_t *out_order,
+                                  size_t *out_number_of_nodes);
+
+// Slab test against float bounds using the ray's precomputed reciprocal direction and sign
+static inline bool rt_bvh_node_box_hit(const rt_bvh_node_t *node, const ray_t *ray, double t_min, double t_max)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float *near = ray->sign[axis] ? node->max : node->min;
+        const float *far = ray->sign[axis] ? node->min : node->max;
+        double t0 = (near[axis] - ray->origin.components[axis]) * ray->inv_direction.components[axis];
+        double t1 = (far[axis] - ray->origin.components[axis]) * ray->inv_direction.components[axis];
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+    }
+    return t_min < t_max;
+}
+
+// Pool the BVHs are built on from now on: bounding boxes are gathered in chunks and large subtrees become tasks of
+// their own. rt_bvh_node_new waits for the pool to drain, so it must not be called from a job of the same pool while a
+// pool is set. NULL (the default) builds on the calling thread.
+void rt_bvh_set_build_pool(rt_thread_pool_t *pool);
+
+// Layout of the BVHs built after this call. Wide layouts collapse the binary tree so that every node has up to 4 or 8
+// children whose boxes are tested at once, with SSE or AVX2 if the CPU supports it and with scalar code otherwise or
+// if allow_simd is false. RT_BVH_LAYOUT_AUTO (the default) picks the widest layout that has a vector box test.
+void rt_bvh_set_layout(rt_bvh_layout_t layout, bool allow_simd);
+
+// Human-readable description of the layout in use, e.g. "bvh8 (avx2 box test)"
+const char *rt_bvh_get_layout_description(void);
+
+rt_bvh_layout_t rt_bvh_get_layout_by_name(const char *name);
+
+void rt_bvh_print_layouts_info(FILE *to);
+
 #endif // RAY_TRACING_ONE_WEEK_RT_BVH_H
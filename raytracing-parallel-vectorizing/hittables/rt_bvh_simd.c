@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <float.h>
+#include <stddef.h>
+#include "rt_bvh_simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RT_BVH_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Exit distances are scaled up by a few ulps so that rounding in the single precision test never culls a box the ray
+// actually touches (see Pharr et al., "Physically Based Rendering", 3rd ed., section 3.9.2)
+#define RT_BVH_SIMD_ROBUST_SCALE (1.0f + 4 * FLT_EPSILON)
+
+static inline unsigned box_test_scalar(int width, const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min,
+                                       float t_max, float *t_near)
+{
+    unsigned mask = 0;
+    for (int child = 0; child < width; ++child)
+    {
+        float near = t_min, far = t_max;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (bounds[axis * width + child] - ray->origin[axis]) * ray->inv_direction[axis];
+            float t1 = (bounds[(axis + 3) * width + child] - ray->origin[axis]) * ray->inv_direction[axis];
+            if (t0 > t1)
+            {
+                float tmp = t0;
+                t0 = t1;
+                t1 = tmp;
+            }
+            near = t0 > near ? t0 : near;
+            far = t1 * RT_BVH_SIMD_ROBUST_SCALE < far ? t1 * RT_BVH_SIMD_ROBUST_SCALE : far;
+        }
+        t_near[child] = near;
+        mask |= (unsigned)(near <= far) << child;
+    }
+    return mask;
+}
+
+unsigned rt_bvh_simd_box_test4_scalar(const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min, float t_max,
+                                      float *t_near)
+{
+    return box_test_scalar(4, bounds, ray, t_min, t_max, t_near);
+}
+
+unsigned rt_bvh_simd_box_test8_scalar(const float *bounds, const rt_bvh_simd_ray_t *ray, float t_min, float t_max,
+                                      float *t_near)
+{
+    return box_test_scalar(8, bounds, ray, t_min, t_max, t_near);
+}
+
+unsigned rt_bvh_simd_packet_box_test_scalar(const float *bounds, int stride, const rt_bvh_simd_packet_t *packet,
+                                            float t_min, const float *t_max, float *t_near)
+{
+    unsigned mask = 0;
+    for (int lane = 0; lane < RT_BVH_SIMD_PACKET_SIZE; ++lane)
+    {
+        float near = t_min, far = t_max[lane];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (bounds[axis * stride] - packet->origin[axis][lane]) * packet->inv_direction[axis][lane];
+            float t1 = (bounds[(axis + 3) * stride] - packet->origin[axis][lane]) * packet->inv_direction[axis][lane];
+            if (t0 > t1)
+            {
+                float tmp = t0;
+                t0 = t1;
+                t1 = tmp;
+            }
+            near = t0 > near ? t0 : near;
+            far = t1 * RT_BVH_SIMD_ROBUST_SCALE < far ? t1 * RT_BVH_SIMD_ROBUST_SCALE : far;
+        }
+        t_near[lane] = near;
+        mask |= (unsigned)(near <= far) << lane;
+    }
+    return mask;
+}
+
+#ifdef RT_BVH_SIMD_X86
+
+__attribute__((target("sse"))) static unsigned box_test4_sse(const float *bounds, const rt_bvh_simd_ray_t *ray,
+                                                             float t_min, float t_max, float *t_near)
+{
+    __m128 near = _mm_set1_ps(t_min);
+    __m128 far = _mm_set1_ps(t_max);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        __m128 origin = _mm_set1_ps(ray->origin[axis]);
+        __m128 inv_direction = _mm_set1_ps(ray->inv_direction[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + axis * 4), origin), inv_direction);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds + (axis + 3) * 4), origin), inv_direction);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_mul_ps(_mm_max_ps(t0, t1), _mm_set1_ps(RT_BVH_SIMD_ROBUST_SCALE)));
+    }
+    _mm_storeu_ps(t_near, near);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(near, far));
+}
+
+// t = (bound - origin) * inv_direction is computed as one fused bound * inv_direction - origin * inv_direction
+__attribute__((target("avx2,fma"))) static unsigned box_test8_avx2(const float *bounds, const rt_bvh_simd_ray_t *ray,
+                                                                   float t_min, float t_max, float *t_near)
+{
+    __m256 near = _mm256_set1_ps(t_min);
+    __m256 far = _mm256_set1_ps(t_max);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        __m256 inv_direction = _mm256_set1_ps(ray->inv_direction[axis]);
+        __m256 scaled_origin = _mm256_set1_ps(ray->origin[axis] * ray->inv_direction[axis]);
+        __m256 t0 = _mm256_fmsub_ps(_mm256_loadu_ps(bounds + axis * 8), inv_direction, scaled_origin);
+        __m256 t1 = _mm256_fmsub_ps(_mm256_loadu_ps(bounds + (axis + 3) * 8), inv_direction, scaled_origin);
+        near = _mm256_max_ps(near, _mm256_min_ps(t0, t1));
+        far = _mm256_min_ps(far, _mm256_mul_ps(_mm256_max_ps(t0, t1), _mm256_set1_ps(RT_BVH_SIMD_ROBUST_SCALE)));
+    }
+    _mm256_storeu_ps(t_near, near);
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ));
+}
+
+// Same as box_test4_sse with the roles swapped: the box is broadcast and every lane holds a ray
+__attribute__((target("sse"))) static unsigned packet_box_test_sse(const float *bounds, int stride,
+                                                                   const rt_bvh_simd_packet_t *packet, float t_min,
+                                                                   const float *t_max, float *t_near)
+{
+    __m128 near = _mm_set1_ps(t_min);
+    __m128 far = _mm_loadu_ps(t_max);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        __m128 origin = _mm_loadu_ps(packet->origin[axis]);
+        __m128 inv_direction = _mm_loadu_ps(packet->inv_direction[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[axis * stride]), origin), inv_direction);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[(axis + 3) * stride]), origin), inv_direction);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_mul_ps(_mm_max_ps(t0, t1), _mm_set1_ps(RT_BVH_SIMD_ROBUST_SCALE)));
+    }
+    _mm_storeu_ps(t_near, near);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(near, far));
+}
+
+#endif // RT_BVH_SIMD_X86
+
+rt_bvh_simd_packet_box_test_fn rt_bvh_simd_select_packet_box_test(bool allow_simd, const char **out_name)
+{
+    const char *name = "scalar";
+    rt_bvh_simd_packet_box_test_fn result = rt_bvh_simd_packet_box_test_scalar;
+
+#ifdef RT_BVH_SIMD_X86
+    if (allow_simd && __builtin_cpu_supports("sse"))
+    {
+        name = "sse";
+        result = packet_box_test_sse;
+    }
+#else
+    (void)allow_simd;
+#endif
+
+    if (NULL != out_name)
+    {
+        *out_name = name;
+    }
+    return result;
+}
+
+rt_bvh_simd_box_test_fn rt_bvh_simd_select_box_test(int width, bool allow_simd, const char **out_name)
+{
+    const char *name = "scalar";
+    rt_bvh_simd_box_test_fn result = NULL;
+
+    switch (width)
+    {
+        case 4:
+            result = rt_bvh_simd_box_test4_scalar;
+#ifdef RT_BVH_SIMD_X86
+            if (allow_simd && __builtin_cpu_supports("sse"))
+            {
+                name = "sse";
+                result = box_test4_sse;
+            }
+#endif
+            break;
+
+        case 8:
+            result = rt_bvh_simd_box_test8_scalar;
+#ifdef RT_BVH_SIMD_X86
+            if (allow_simd && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            {
+                name = "avx2";
+                result = box_test8_avx2;
+            }
+#endif
+            break;
+
+        default:
+            name = NULL;
+            break;
+    }
+
+    if (NULL != out_name)
+    {
+        *out_name = name;
+    }
+    return result;
+}
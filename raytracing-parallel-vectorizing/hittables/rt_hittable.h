@@ -14,18 +14,40 @@
 #include <rt_hit.h>
 #include <rt_aabb.h>
 #include <rt_material.h>
+#include <rt_ray_packet.h>
 
 typedef struct rt_hittable_s rt_hittable_t;
+typedef struct rt_hittable_list_s rt_hittable_list_t;
 
 rt_hittable_t *rt_hittable_claim(rt_hittable_t *hittable);
 
 bool rt_hittable_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                      rt_hit_record_t *record);
 
+// Tells whether anything intersects the ray within (t_min, t_max). Unlike rt_hittable_hit it stops at the first
+// intersection found and skips normals, texture coordinates and materials, which is all shadow rays need.
+bool rt_hittable_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+
+// Packet version of rt_hittable_hit: intersects the ray of every lane in mask within (t_min, t_max[lane]). Returns the
+// lanes that hit something, their records and t_max are updated to the hit, the other lanes are left unchanged. Every
+// lane ends up with the same hit as rt_hittable_hit would find for its ray.
+unsigned rt_hittable_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask, double t_min,
+                                double *t_max, rt_hit_record_t *records);
+
 void rt_hittable_delete(rt_hittable_t *hittable);
 
 bool rt_hittable_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 
+// Returns a random direction from origin towards the hittable. Directions are distributed according to
+// rt_hittable_pdf_value, which is the density of the direction with respect to solid angle (0 if the direction misses
+// the hittable or the hittable can't be sampled).
+vec3_t rt_hittable_random(const rt_hittable_t *hittable, const point3_t *origin);
+double rt_hittable_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction);
+
+// Adds the hittable to lights (claiming it) if it emits light and can be sampled, containers recurse into their
+// children.
+void rt_hittable_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights);
+
 // Constant medium
 rt_hittable_t *rt_const_medium_new_with_texture(rt_hittable_t *boundary, double density, rt_texture_t *texture);
 rt_hittable_t *rt_const_medium_new_with_colour(rt_hittable_t *boundary, double density, colour_t colour);
@@ -25,16 +25,21 @@ typedef struct rt_instance_s
 
 static bool rt_instance_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                             rt_hit_record_t *record);
+static bool rt_instance_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static unsigned rt_instance_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                       double t_min, double *t_max, rt_hit_record_t *records);
 static bool rt_instance_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void rt_instance_delete(rt_hittable_t *instance);
 
 rt_hittable_t *rt_instance_new(rt_hittable_t *hittable)
 {
-    rt_instance_t *result = calloc(1, sizeof(rt_instance_t));
+    rt_instance_t *result = rt_arena_calloc(sizeof(rt_instance_t));
     assert(NULL != result);
 
     result->hittable = hittable;
     rt_hittable_init(&result->base, RT_HITTABLE_TYPE_INSTANCE, rt_instance_hit, rt_instance_bb, rt_instance_delete);
+    result->base.occluded = rt_instance_occluded;
+    result->base.hit_packet = rt_instance_hit_packet;
 
     result->offset = vec3(0.0, 0.0, 0.0);
     result->transform_matrix_ray = rt_matrix_identity();
@@ -73,9 +78,9 @@ static bool rt_instance_hit(const rt_hittable_t *hittable, const ray_t *ray, dou
     assert(RT_HITTABLE_TYPE_INSTANCE == hittable->type);
     rt_instance_t *instance = (rt_instance_t *)hittable;
 
-    ray_t transformed_ray = ray_init(vec3_diff(ray->origin, instance->offset), ray->direction, ray->time);
-    transformed_ray.origin = rt_mat3_mul_vec3(&instance->transform_matrix_ray, &transformed_ray.origin);
-    transformed_ray.direction = rt_mat3_mul_vec3(&instance->transform_matrix_ray, &transformed_ray.direction);
+    point3_t origin = vec3_diff(ray->origin, instance->offset);
+    ray_t transformed_ray = ray_init(rt_mat3_mul_vec3(&instance->transform_matrix_ray, &origin),
+                                     rt_mat3_mul_vec3(&instance->transform_matrix_ray, &ray->direction), ray->time);
 
     if (!rt_hittable_hit(instance->hittable, &transformed_ray, t_min, t_max, record))
     {
@@ -85,12 +90,77 @@ static bool rt_instance_hit(const rt_hittable_t *hittable, const ray_t *ray, dou
     record->p = rt_mat3_mul_vec3(&instance->transform_matrix_bb, &record->p);
     vec3_add(&record->p, instance->offset);
 
-    vec3_t new_normal = rt_mat3_mul_vec3(&instance->transform_matrix_bb, &record->normal);
-    rt_hit_record_set_front_face(record, &transformed_ray, &new_normal);
+    // The normal already faces the ray in the object's space and rotating both keeps it that way, front_face stays
+    record->normal = rt_mat3_mul_vec3(&instance->transform_matrix_bb, &record->normal);
 
     return true;
 }
 
+static bool rt_instance_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_INSTANCE == hittable->type);
+    rt_instance_t *instance = (rt_instance_t *)hittable;
+
+    point3_t origin = vec3_diff(ray->origin, instance->offset);
+    ray_t transformed_ray = ray_init(rt_mat3_mul_vec3(&instance->transform_matrix_ray, &origin),
+                                     rt_mat3_mul_vec3(&instance->transform_matrix_ray, &ray->direction), ray->time);
+
+    return rt_hittable_occluded(instance->hittable, &transformed_ray, t_min, t_max);
+}
+
+static unsigned rt_instance_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                       double t_min, double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+
+    assert(RT_HITTABLE_TYPE_INSTANCE == hittable->type);
+    rt_instance_t *instance = (rt_instance_t *)hittable;
+
+    // The lanes move to the object's space together and carry their random streams along
+    rt_ray_packet_t transformed;
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        const ray_t *ray = &packet->rays[lane];
+        point3_t origin = vec3_diff(ray->origin, instance->offset);
+        transformed.rays[lane] =
+            ray_init(rt_mat3_mul_vec3(&instance->transform_matrix_ray, &origin),
+                     rt_mat3_mul_vec3(&instance->transform_matrix_ray, &ray->direction), ray->time);
+        transformed.random[lane] = packet->random[lane];
+    }
+    rt_ray_packet_prepare(&transformed, mask);
+
+    unsigned result = rt_hittable_hit_packet(instance->hittable, &transformed, mask, t_min, t_max, records);
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (0 == (mask & (1u << lane)))
+        {
+            continue;
+        }
+
+        packet->random[lane] = transformed.random[lane];
+        if (0 == (result & (1u << lane)))
+        {
+            continue;
+        }
+
+        rt_hit_record_t *record = &records[lane];
+        record->p = rt_mat3_mul_vec3(&instance->transform_matrix_bb, &record->p);
+        vec3_add(&record->p, instance->offset);
+
+        record->normal = rt_mat3_mul_vec3(&instance->transform_matrix_bb, &record->normal);
+    }
+    return result;
+}
+
 static bool rt_instance_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != hittable);
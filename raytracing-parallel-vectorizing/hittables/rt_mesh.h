@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_MESH_H
+#define RAY_TRACING_ONE_WEEK_RT_MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <rt_weekend.h>
+#include <rt_material.h>
+#include "rt_hittable.h"
+
+// Indexed triangle mesh in structure of arrays layout: every vertex attribute is split into one array per component.
+typedef struct rt_mesh_data_s
+{
+    size_t number_of_vertices;
+    const rt_real_t *positions[3];
+    // Per-vertex normals (x, y and z arrays) and texture coordinates (u and v arrays), NULL if the mesh has none.
+    // Without normals the mesh is flat shaded, without texture coordinates u and v are the barycentric coordinates.
+    const rt_real_t *normals[3];
+    const rt_real_t *texture_coordinates[2];
+
+    // Three vertex indices per triangle. The front side is the one the vertices go counter-clockwise on.
+    size_t number_of_triangles;
+    const uint32_t *indices;
+} rt_mesh_data_t;
+
+// Copies the data and builds a BVH over the triangles. Rays are intersected with the watertight test by Woop, Benthin
+// and Wald, so they never slip through the edge shared by two triangles. Several rt_instance can share one mesh.
+rt_hittable_t *rt_mesh_new(const rt_mesh_data_t *data, rt_material_t *material);
+
+size_t rt_mesh_get_number_of_triangles(const rt_hittable_t *mesh);
+
+// Reads a Wavefront OBJ file line by line: positions, texture coordinates, normals and polygonal faces, which are
+// split into triangle fans. Everything else (groups, materials, smoothing groups) is ignored. Prints an error and
+// returns NULL if the file can't be read or has no faces, material is released in that case.
+rt_hittable_t *rt_mesh_load_obj(const char *file_name, rt_material_t *material);
+
+// Binary mesh cache: a versioned file with the vertex arrays, the triangles and the flattened BVH laid out exactly as
+// a mesh keeps them in memory. Loading maps the file and the mesh uses it in place, nothing is parsed, copied or
+// rebuilt. Files are specific to the byte order and to the precision of rt_real_t they were written with. Only meshes
+// are cached, not whole scenes: parsing OBJ files and building their BVHs is what takes time, the other primitives and
+// the materials of rt_scenes.c are built from code in milliseconds.
+bool rt_mesh_save(const rt_hittable_t *mesh, const char *file_name);
+rt_hittable_t *rt_mesh_load(const char *file_name, rt_material_t *material);
+
+// Directory where rt_mesh_load_obj keeps caches of the files it reads. A file is parsed only if it has no cache yet or
+// has changed since, the cache is written afterwards. NULL (the default) turns caching off.
+void rt_mesh_set_cache_directory(const char *directory);
+
+// Number of meshes rt_mesh_load_obj has mapped from the cache directory or written to it so far
+size_t rt_mesh_get_number_of_cached_meshes(void);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_MESH_H
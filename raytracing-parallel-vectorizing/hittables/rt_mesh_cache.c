@@ -0,0 +1,479 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+// st_mtim is POSIX.1-2008, -std=c11 hides it otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "rt_mesh_shared.h"
+
+// Bumped whenever the layout or the meaning of the header, or the layout of rt_bvh_node_t changes
+#define RT_MESH_CACHE_VERSION (2)
+#define RT_MESH_CACHE_BYTE_ORDER (0x01020304u)
+// Every array starts on a cache line, which is also what the BVH nodes are aligned to when they are built
+#define RT_MESH_CACHE_ALIGNMENT (64)
+
+typedef enum mesh_section_e
+{
+    MESH_SECTION_POSITIONS_X,
+    MESH_SECTION_POSITIONS_Y,
+    MESH_SECTION_POSITIONS_Z,
+    MESH_SECTION_NORMALS_X,
+    MESH_SECTION_NORMALS_Y,
+    MESH_SECTION_NORMALS_Z,
+    MESH_SECTION_TEXTURE_U,
+    MESH_SECTION_TEXTURE_V,
+    MESH_SECTION_INDICES,
+    MESH_SECTION_NODES,
+    MESH_SECTION_COUNT,
+} mesh_section_t;
+
+typedef struct mesh_cache_header_s
+{
+    char magic[8];
+    uint32_t version;
+    // RT_MESH_CACHE_BYTE_ORDER as the writer saw it, along with the sizes of the types the arrays are made of
+    uint32_t byte_order;
+    uint32_t real_size;
+    uint32_t node_size;
+    uint64_t file_size;
+
+    // The OBJ file the mesh was read from (modification time in nanoseconds), zero for meshes saved with rt_mesh_save
+    uint64_t source_size;
+    int64_t source_modification_time;
+
+    uint64_t number_of_vertices;
+    uint64_t number_of_triangles;
+    uint64_t number_of_nodes;
+    double box_min[3];
+    double box_max[3];
+
+    // Offsets of the arrays from the start of the file, 0 for the attributes the mesh doesn't have
+    uint64_t offsets[MESH_SECTION_COUNT];
+} mesh_cache_header_t;
+
+static const char gs_magic[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\r', '\n'};
+
+static const char *gs_cache_directory = NULL;
+static size_t gs_number_of_cached_meshes = 0;
+
+static bool mesh_cache_write(const rt_mesh_t *mesh, const char *file_name, uint64_t source_size,
+                             int64_t source_modification_time);
+static rt_hittable_t *mesh_cache_map(const char *file_name, const rt_mesh_source_t *source, bool report_errors,
+                                     rt_material_t *material);
+static const char *mesh_cache_check(const mesh_cache_header_t *header, uint64_t file_size);
+static const char *mesh_cache_check_contents(const mesh_cache_header_t *header);
+static uint64_t mesh_section_size(const mesh_cache_header_t *header, mesh_section_t section);
+static const void *mesh_section_data(const rt_mesh_t *mesh, mesh_section_t section);
+static uint64_t mesh_cache_align(uint64_t offset);
+static void mesh_cache_unmap(void *data);
+
+bool rt_mesh_save(const rt_hittable_t *mesh, const char *file_name)
+{
+    assert(NULL != mesh);
+    assert(NULL != file_name);
+
+    assert(RT_HITTABLE_TYPE_MESH == mesh->type);
+    return mesh_cache_write((const rt_mesh_t *)mesh, file_name, 0, 0);
+}
+
+rt_hittable_t *rt_mesh_load(const char *file_name, rt_material_t *material)
+{
+    assert(NULL != file_name);
+
+    rt_hittable_t *result = mesh_cache_map(file_name, NULL, true, material);
+    if (NULL == result)
+    {
+        rt_material_delete(material);
+    }
+    return result;
+}
+
+void rt_mesh_set_cache_directory(const char *directory)
+{
+    gs_cache_directory = directory;
+}
+
+size_t rt_mesh_get_number_of_cached_meshes(void)
+{
+    return gs_number_of_cached_meshes;
+}
+
+bool rt_mesh_cache_get_source(const char *obj_file_name, rt_mesh_source_t *source)
+{
+    assert(NULL != obj_file_name);
+    assert(NULL != source);
+
+    struct stat status;
+    if (NULL == gs_cache_directory || 0 != stat(obj_file_name, &status))
+    {
+        return false;
+    }
+    source->size = (uint64_t)status.st_size;
+    // Nanoseconds, so an edit within the same second that keeps the size of the file still invalidates the cache
+    source->modification_time = (int64_t)status.st_mtim.tv_sec * 1000000000 + (int64_t)status.st_mtim.tv_nsec;
+
+    // The path of the file becomes the name of its cache, so files with the same name in different directories don't
+    // share one
+    int length = snprintf(source->cache_file_name, sizeof(source->cache_file_name), "%s/%s.rtmesh",
+                          gs_cache_directory, obj_file_name);
+    if (length < 0 || (size_t)length >= sizeof(source->cache_file_name))
+    {
+        return false;
+    }
+    for (char *c = source->cache_file_name + strlen(gs_cache_directory) + 1; '\0' != *c; ++c)
+    {
+        if ('/' == *c || '\\' == *c || ':' == *c)
+        {
+            *c = '_';
+        }
+    }
+    return true;
+}
+
+rt_hittable_t *rt_mesh_cache_find(const rt_mesh_source_t *source, rt_material_t *material)
+{
+    assert(NULL != source);
+
+    rt_hittable_t *result = mesh_cache_map(source->cache_file_name, source, false, material);
+    if (NULL != result)
+    {
+        gs_number_of_cached_meshes++;
+    }
+    return result;
+}
+
+void rt_mesh_cache_store(const rt_hittable_t *mesh, const rt_mesh_source_t *source)
+{
+    assert(NULL != mesh);
+    assert(NULL != source);
+
+    assert(RT_HITTABLE_TYPE_MESH == mesh->type);
+    if (0 != mkdir(gs_cache_directory, 0777) && EEXIST != errno)
+    {
+        fprintf(stderr, "Failed to create mesh cache directory %s: %s\n", gs_cache_directory, strerror(errno));
+        return;
+    }
+    if (mesh_cache_write((const rt_mesh_t *)mesh, source->cache_file_name, source->size, source->modification_time))
+    {
+        gs_number_of_cached_meshes++;
+    }
+}
+
+static bool mesh_cache_write(const rt_mesh_t *mesh, const char *file_name, uint64_t source_size,
+                             int64_t source_modification_time)
+{
+    mesh_cache_header_t header = {
+        .version = RT_MESH_CACHE_VERSION,
+        .byte_order = RT_MESH_CACHE_BYTE_ORDER,
+        .real_size = sizeof(rt_real_t),
+        .node_size = sizeof(rt_bvh_node_t),
+        .source_size = source_size,
+        .source_modification_time = source_modification_time,
+        .number_of_vertices = mesh->number_of_vertices,
+        .number_of_triangles = mesh->number_of_triangles,
+        .number_of_nodes = mesh->number_of_nodes,
+    };
+    memcpy(header.magic, gs_magic, sizeof(gs_magic));
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        header.box_min[axis] = mesh->box.min.components[axis];
+        header.box_max[axis] = mesh->box.max.components[axis];
+    }
+
+    uint64_t offset = mesh_cache_align(sizeof(header));
+    for (int section = 0; section < MESH_SECTION_COUNT; ++section)
+    {
+        if (NULL != mesh_section_data(mesh, section))
+        {
+            header.offsets[section] = offset;
+            offset = mesh_cache_align(offset + mesh_section_size(&header, section));
+        }
+    }
+    header.file_size = offset;
+
+    // Written next to the final file and renamed over it, so a concurrent render never maps a half-written cache
+    char temporary_name[1100];
+    snprintf(temporary_name, sizeof(temporary_name), "%s.%ld.tmp", file_name, (long)getpid());
+    FILE *file = fopen(temporary_name, "wb");
+    if (NULL == file)
+    {
+        fprintf(stderr, "Failed to write mesh cache %s: %s\n", file_name, strerror(errno));
+        return false;
+    }
+
+    static const unsigned char padding[RT_MESH_CACHE_ALIGNMENT] = {0};
+    bool ok = 1 == fwrite(&header, sizeof(header), 1, file);
+    uint64_t written = sizeof(header);
+    for (int section = 0; ok && section < MESH_SECTION_COUNT; ++section)
+    {
+        if (0 == header.offsets[section])
+        {
+            continue;
+        }
+        ok = header.offsets[section] - written == fwrite(padding, 1, header.offsets[section] - written, file);
+        uint64_t size = mesh_section_size(&header, section);
+        ok = ok && size == fwrite(mesh_section_data(mesh, section), 1, size, file);
+        written = header.offsets[section] + size;
+    }
+    ok = ok && header.file_size - written == fwrite(padding, 1, header.file_size - written, file);
+    ok = (0 == fclose(file)) && ok;
+    if (!ok || 0 != rename(temporary_name, file_name))
+    {
+        fprintf(stderr, "Failed to write mesh cache %s: %s\n", file_name, strerror(errno));
+        remove(temporary_name);
+        return false;
+    }
+    return true;
+}
+
+static rt_hittable_t *mesh_cache_map(const char *file_name, const rt_mesh_source_t *source, bool report_errors,
+                                     rt_material_t *material)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+    {
+        if (report_errors)
+        {
+            fprintf(stderr, "Failed to open mesh cache %s: %s\n", file_name, strerror(errno));
+        }
+        return NULL;
+    }
+
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (0 == fstat(fd, &status) && (uint64_t)status.st_size >= sizeof(mesh_cache_header_t))
+    {
+        mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    const char *error = MAP_FAILED == mapping ? "can't be mapped" : mesh_cache_check(mapping, status.st_size);
+    if (NULL == error && NULL != source)
+    {
+        const mesh_cache_header_t *header = mapping;
+        if (header->source_size != source->size || header->source_modification_time != source->modification_time)
+        {
+            error = "outdated";
+        }
+    }
+    if (NULL == error)
+    {
+        error = mesh_cache_check_contents(mapping);
+    }
+    if (NULL != error)
+    {
+        if (report_errors)
+        {
+            fprintf(stderr, "Invalid mesh cache %s: %s\n", file_name, error);
+        }
+        if (MAP_FAILED != mapping)
+        {
+            munmap(mapping, (size_t)status.st_size);
+        }
+        return NULL;
+    }
+
+    const mesh_cache_header_t *header = mapping;
+    const unsigned char *bytes = mapping;
+    rt_mesh_t *result = rt_arena_calloc(sizeof(rt_mesh_t));
+    assert(NULL != result);
+
+    result->material = material;
+    result->number_of_vertices = (size_t)header->number_of_vertices;
+    result->number_of_triangles = (size_t)header->number_of_triangles;
+    result->number_of_nodes = (size_t)header->number_of_nodes;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        result->positions[axis] = (rt_real_t *)(bytes + header->offsets[MESH_SECTION_POSITIONS_X + axis]);
+        if (0 != header->offsets[MESH_SECTION_NORMALS_X])
+        {
+            result->normals[axis] = (rt_real_t *)(bytes + header->offsets[MESH_SECTION_NORMALS_X + axis]);
+        }
+        result->box.min.components[axis] = (rt_real_t)header->box_min[axis];
+        result->box.max.components[axis] = (rt_real_t)header->box_max[axis];
+    }
+    for (int i = 0; i < 2 && 0 != header->offsets[MESH_SECTION_TEXTURE_U]; ++i)
+    {
+        result->texture_coordinates[i] = (rt_real_t *)(bytes + header->offsets[MESH_SECTION_TEXTURE_U + i]);
+    }
+    result->indices = (uint32_t *)(bytes + header->offsets[MESH_SECTION_INDICES]);
+    result->nodes = (rt_bvh_node_t *)(bytes + header->offsets[MESH_SECTION_NODES]);
+    result->mapping = mapping;
+    result->mapping_size = (size_t)status.st_size;
+
+    rt_mesh_init(result);
+
+    // Arena meshes are never deleted one by one, the file is unmapped together with the rest of the scene
+    if (NULL != rt_arena_get_current())
+    {
+        rt_arena_add_cleanup(rt_arena_get_current(), mesh_cache_unmap, result);
+    }
+
+    return (rt_hittable_t *)result;
+}
+
+// Returns what's wrong with the layout of the file, NULL if its arrays are where the header says they are
+static const char *mesh_cache_check(const mesh_cache_header_t *header, uint64_t file_size)
+{
+    if (0 != memcmp(header->magic, gs_magic, sizeof(gs_magic)))
+    {
+        return "not a mesh cache";
+    }
+    if (RT_MESH_CACHE_VERSION != header->version)
+    {
+        return "unsupported version";
+    }
+    if (RT_MESH_CACHE_BYTE_ORDER != header->byte_order || sizeof(rt_real_t) != header->real_size ||
+        sizeof(rt_bvh_node_t) != header->node_size)
+    {
+        return "written by an incompatible build";
+    }
+    if (header->file_size != file_size)
+    {
+        return "truncated";
+    }
+    if (0 == header->number_of_vertices || header->number_of_vertices > UINT32_MAX ||
+        0 == header->number_of_triangles || header->number_of_triangles > file_size ||
+        0 == header->number_of_nodes || header->number_of_nodes > file_size)
+    {
+        return "invalid number of elements";
+    }
+
+    for (int section = 0; section < MESH_SECTION_COUNT; ++section)
+    {
+        uint64_t offset = header->offsets[section];
+        if (0 == offset)
+        {
+            continue;
+        }
+        if (0 != offset % RT_MESH_CACHE_ALIGNMENT || offset < sizeof(mesh_cache_header_t) || offset > file_size ||
+            mesh_section_size(header, section) > file_size - offset)
+        {
+            return "array out of the file";
+        }
+    }
+
+    const uint64_t *offsets = header->offsets;
+    bool has_positions = 0 != offsets[MESH_SECTION_POSITIONS_X] && 0 != offsets[MESH_SECTION_POSITIONS_Y] &&
+                         0 != offsets[MESH_SECTION_POSITIONS_Z];
+    bool normals_match = (0 == offsets[MESH_SECTION_NORMALS_X]) == (0 == offsets[MESH_SECTION_NORMALS_Y]) &&
+                         (0 == offsets[MESH_SECTION_NORMALS_X]) == (0 == offsets[MESH_SECTION_NORMALS_Z]);
+    bool texture_coordinates_match = (0 == offsets[MESH_SECTION_TEXTURE_U]) == (0 == offsets[MESH_SECTION_TEXTURE_V]);
+    if (!has_positions || !normals_match || !texture_coordinates_match || 0 == offsets[MESH_SECTION_INDICES] ||
+        0 == offsets[MESH_SECTION_NODES])
+    {
+        return "missing arrays";
+    }
+    return NULL;
+}
+
+// Returns what's wrong with the arrays of a file mesh_cache_check has accepted, NULL if a mesh can use them as they are:
+// every index refers to a vertex, and the BVH has no cycles, refers to triangles within the mesh and isn't deeper than
+// the traversal stack
+static const char *mesh_cache_check_contents(const mesh_cache_header_t *header)
+{
+    const unsigned char *bytes = (const unsigned char *)header;
+    const uint32_t *indices = (const uint32_t *)(bytes + header->offsets[MESH_SECTION_INDICES]);
+    for (uint64_t i = 0; i < 3 * header->number_of_triangles; ++i)
+    {
+        if (indices[i] >= header->number_of_vertices)
+        {
+            return "vertex index out of range";
+        }
+    }
+
+    // Children always come after their parent, so the depth of a node is known by the time it's reached
+    const rt_bvh_node_t *nodes = (const rt_bvh_node_t *)(bytes + header->offsets[MESH_SECTION_NODES]);
+    uint8_t *depths = calloc((size_t)header->number_of_nodes, sizeof(uint8_t));
+    assert(NULL != depths);
+    const char *error = NULL;
+    for (uint64_t i = 0; NULL == error && i < header->number_of_nodes; ++i)
+    {
+        const rt_bvh_node_t *node = &nodes[i];
+        if (node->number_of_primitives > 0)
+        {
+            if ((uint64_t)node->offset + node->number_of_primitives > header->number_of_triangles)
+            {
+                error = "BVH leaf out of range";
+            }
+            continue;
+        }
+        if (node->axis > VEC3_AXIS_Z || node->offset <= i + 1 || node->offset >= header->number_of_nodes)
+        {
+            error = "invalid BVH node";
+        }
+        else if (depths[i] + 1 >= RT_BVH_STACK_SIZE)
+        {
+            error = "BVH too deep";
+        }
+        else
+        {
+            uint8_t depth = (uint8_t)(depths[i] + 1);
+            depths[i + 1] = depths[i + 1] > depth ? depths[i + 1] : depth;
+            depths[node->offset] = depths[node->offset] > depth ? depths[node->offset] : depth;
+        }
+    }
+    free(depths);
+    return error;
+}
+
+static uint64_t mesh_section_size(const mesh_cache_header_t *header, mesh_section_t section)
+{
+    switch (section)
+    {
+        case MESH_SECTION_INDICES:
+            return 3 * header->number_of_triangles * sizeof(uint32_t);
+        case MESH_SECTION_NODES:
+            return header->number_of_nodes * sizeof(rt_bvh_node_t);
+        default:
+            return header->number_of_vertices * sizeof(rt_real_t);
+    }
+}
+
+static const void *mesh_section_data(const rt_mesh_t *mesh, mesh_section_t section)
+{
+    switch (section)
+    {
+        case MESH_SECTION_POSITIONS_X:
+        case MESH_SECTION_POSITIONS_Y:
+        case MESH_SECTION_POSITIONS_Z:
+            return mesh->positions[section - MESH_SECTION_POSITIONS_X];
+        case MESH_SECTION_NORMALS_X:
+        case MESH_SECTION_NORMALS_Y:
+        case MESH_SECTION_NORMALS_Z:
+            return mesh->normals[section - MESH_SECTION_NORMALS_X];
+        case MESH_SECTION_TEXTURE_U:
+        case MESH_SECTION_TEXTURE_V:
+            return mesh->texture_coordinates[section - MESH_SECTION_TEXTURE_U];
+        case MESH_SECTION_INDICES:
+            return mesh->indices;
+        case MESH_SECTION_NODES:
+            return mesh->nodes;
+        default:
+            assert(0);
+            return NULL;
+    }
+}
+
+static uint64_t mesh_cache_align(uint64_t offset)
+{
+    return (offset + RT_MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(RT_MESH_CACHE_ALIGNMENT - 1);
+}
+
+static void mesh_cache_unmap(void *data)
+{
+    rt_mesh_t *mesh = data;
+    munmap(mesh->mapping, mesh->mapping_size);
+}
@@ -26,6 +26,7 @@ static rt_moving_sphere_t rt_moving_sphere_init(point3_t center_start, point3_t
                                                 double time_end, double radius, rt_material_t *material);
 static bool rt_moving_sphere_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                                  rt_hit_record_t *record);
+static bool rt_moving_sphere_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
 static bool rt_moving_sphere_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void rt_moving_sphere_delete(rt_hittable_t *hittable);
 static point3_t get_center_at_time(const rt_moving_sphere_t *moving_sphere, double time);
@@ -33,7 +34,7 @@ static point3_t get_center_at_time(const rt_moving_sphere_t *moving_sphere, doub
 rt_hittable_t *rt_moving_sphere_new(point3_t center_start, point3_t center_end, double time_start, double time_end,
                                     double radius, rt_material_t *material)
 {
-    rt_moving_sphere_t *sphere = calloc(1, sizeof(rt_moving_sphere_t));
+    rt_moving_sphere_t *sphere = rt_arena_calloc(sizeof(rt_moving_sphere_t));
     assert(NULL != sphere);
 
     *sphere = rt_moving_sphere_init(center_start, center_end, time_start, time_end, radius, material);
@@ -55,6 +56,7 @@ static rt_moving_sphere_t rt_moving_sphere_init(point3_t center_start, point3_t
     };
     rt_hittable_init(&result.base, RT_HITTABLE_TYPE_MOVING_SPHERE, rt_moving_sphere_hit, rt_moving_sphere_bb,
                      rt_moving_sphere_delete);
+    result.base.occluded = rt_moving_sphere_occluded;
     return result;
 }
 
@@ -72,6 +74,19 @@ bool rt_moving_sphere_hit(const rt_hittable_t *hittable, const ray_t *ray, doubl
                                       record);
 }
 
+static bool rt_moving_sphere_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(NULL != ray);
+
+    assert(RT_HITTABLE_TYPE_MOVING_SPHERE == hittable->type);
+    rt_moving_sphere_t *moving_sphere = (rt_moving_sphere_t *)hittable;
+
+    point3_t center = get_center_at_time(moving_sphere, ray->time);
+    return rt_sphere_hit_test_generic(center, moving_sphere->radius, moving_sphere->material, ray, t_min, t_max,
+                                      NULL);
+}
+
 bool rt_moving_sphere_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != hittable);
@@ -7,6 +7,7 @@
 
 #include "rt_hittable.h"
 #include "rt_hittable_shared.h"
+#include "rt_hittable_list.h"
 #include <assert.h>
 #include <stdlib.h>
 
@@ -22,12 +23,20 @@ typedef struct rt_sphere_s
 static rt_sphere_t rt_sphere_init(point3_t center, double radius, rt_material_t *material);
 static bool rt_sphere_hit(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max,
                           rt_hit_record_t *record);
+static bool rt_sphere_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max);
+static unsigned rt_sphere_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                     double t_min, double *t_max, rt_hit_record_t *records);
+static void rt_sphere_fill_record(point3_t center, double radius, rt_material_t *material, const ray_t *ray, double t,
+                                  rt_hit_record_t *record);
 static bool rt_sphere_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb);
 static void rt_sphere_delete(rt_hittable_t *hittable);
+static vec3_t rt_sphere_random(const rt_hittable_t *hittable, const point3_t *origin);
+static double rt_sphere_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction);
+static void rt_sphere_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights);
 
 rt_hittable_t *rt_sphere_new(point3_t center, double radius, rt_material_t *material)
 {
-    rt_sphere_t *sphere = calloc(1, sizeof(rt_sphere_t));
+    rt_sphere_t *sphere = rt_arena_calloc(sizeof(rt_sphere_t));
     assert(NULL != sphere);
 
     *sphere = rt_sphere_init(center, radius, material);
@@ -63,18 +72,24 @@ bool rt_sphere_hit_test_generic(point3_t center, double radius, rt_material_t *m
 
     if (NULL != record)
     {
-        record->t = t;
-        record->p = ray_at(*ray, t);
-        record->material = material;
-        vec3_t outward_normal = vec3_scale(vec3_diff(record->p, center), 1.0 / radius);
-        rt_hit_record_set_front_face(record, ray, &outward_normal);
-
-        rt_get_sphere_uv(&outward_normal, &record->u, &record->v);
+        rt_sphere_fill_record(center, radius, material, ray, t, record);
     }
 
     return true;
 }
 
+static void rt_sphere_fill_record(point3_t center, double radius, rt_material_t *material, const ray_t *ray, double t,
+                                  rt_hit_record_t *record)
+{
+    record->t = t;
+    record->p = ray_at(*ray, t);
+    record->material = material;
+    vec3_t outward_normal = vec3_scale(vec3_diff(record->p, center), 1.0 / radius);
+    rt_hit_record_set_front_face(record, ray, &outward_normal);
+
+    rt_get_sphere_uv(&outward_normal, &record->u, &record->v);
+}
+
 void rt_get_sphere_uv(const point3_t *p, double *u, double *v)
 {
     assert(NULL != p);
@@ -98,6 +113,9 @@ static rt_sphere_t rt_sphere_init(point3_t center, double radius, rt_material_t
         .material = material,
     };
     rt_hittable_init(&result.base, RT_HITTABLE_TYPE_SPHERE, rt_sphere_hit, rt_sphere_bb, rt_sphere_delete);
+    result.base.occluded = rt_sphere_occluded;
+    result.base.hit_packet = rt_sphere_hit_packet;
+    rt_hittable_init_light_sampling(&result.base, rt_sphere_random, rt_sphere_pdf_value, rt_sphere_collect_lights);
     return result;
 }
 
@@ -111,6 +129,37 @@ static bool rt_sphere_hit(const rt_hittable_t *hittable, const ray_t *ray, doubl
     return rt_sphere_hit_test_generic(sphere->center, sphere->radius, sphere->material, ray, t_min, t_max, record);
 }
 
+static bool rt_sphere_occluded(const rt_hittable_t *hittable, const ray_t *ray, double t_min, double t_max)
+{
+    assert(NULL != hittable);
+    assert(RT_HITTABLE_TYPE_SPHERE == hittable->type);
+
+    rt_sphere_t *sphere = (rt_sphere_t *)hittable;
+    return rt_sphere_hit_test_generic(sphere->center, sphere->radius, sphere->material, ray, t_min, t_max, NULL);
+}
+
+static unsigned rt_sphere_hit_packet(const rt_hittable_t *hittable, rt_ray_packet_t *packet, unsigned mask,
+                                     double t_min, double *t_max, rt_hit_record_t *records)
+{
+    assert(NULL != hittable);
+    assert(NULL != packet);
+    assert(RT_HITTABLE_TYPE_SPHERE == hittable->type);
+
+    rt_sphere_t *sphere = (rt_sphere_t *)hittable;
+    double t[RT_RAY_PACKET_SIZE];
+    unsigned result = rt_ray_packet_sphere_test(packet, mask, sphere->center, sphere->radius, t_min, t_max, t);
+    for (int lane = 0; lane < RT_RAY_PACKET_SIZE; ++lane)
+    {
+        if (result & (1u << lane))
+        {
+            rt_sphere_fill_record(sphere->center, sphere->radius, sphere->material, &packet->rays[lane], t[lane],
+                                  &records[lane]);
+            t_max[lane] = t[lane];
+        }
+    }
+    return result;
+}
+
 static bool rt_sphere_bb(const rt_hittable_t *hittable, double time0, double time1, rt_aabb_t *out_bb)
 {
     assert(NULL != hittable);
@@ -125,6 +174,78 @@ static bool rt_sphere_bb(const rt_hittable_t *hittable, double time0, double tim
     return true;
 }
 
+// Uniformly picks a direction inside the cone the sphere subtends from origin
+static vec3_t rt_sphere_random(const rt_hittable_t *hittable, const point3_t *origin)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+    assert(RT_HITTABLE_TYPE_SPHERE == hittable->type);
+
+    rt_sphere_t *sphere = (rt_sphere_t *)hittable;
+    vec3_t to_center = vec3_diff(sphere->center, *origin);
+    double distance_squared = vec3_length_squared(to_center);
+    if (distance_squared <= sphere->radius * sphere->radius)
+    {
+        // Every direction hits the sphere from the inside, rt_sphere_pdf_value rejects them
+        return vec3_random_unit_vector();
+    }
+
+    double cos_theta_max = sqrt(1 - sphere->radius * sphere->radius / distance_squared);
+    double u1, u2;
+    rt_random_double_2d(&u1, &u2);
+    double z = 1 + u1 * (cos_theta_max - 1);
+    double phi = 2 * PI * u2;
+    double sin_theta = sqrt(1 - z * z);
+
+    // Orthonormal basis around the direction to the center
+    vec3_t w = vec3_normalized(to_center);
+    vec3_t a = fabs(w.x) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3_t v = vec3_normalized(vec3_cross(w, a));
+    vec3_t u = vec3_cross(w, v);
+
+    vec3_t result = vec3_scale(u, cos(phi) * sin_theta);
+    vec3_add(&result, vec3_scale(v, sin(phi) * sin_theta));
+    vec3_add(&result, vec3_scale(w, z));
+    return result;
+}
+
+static double rt_sphere_pdf_value(const rt_hittable_t *hittable, const point3_t *origin, const vec3_t *direction)
+{
+    assert(NULL != hittable);
+    assert(NULL != origin);
+    assert(NULL != direction);
+    assert(RT_HITTABLE_TYPE_SPHERE == hittable->type);
+
+    rt_sphere_t *sphere = (rt_sphere_t *)hittable;
+    double distance_squared = vec3_length_squared(vec3_diff(sphere->center, *origin));
+    if (distance_squared <= sphere->radius * sphere->radius)
+    {
+        return 0.0;
+    }
+
+    ray_t ray = ray_init(*origin, *direction, 0);
+    if (!rt_sphere_hit(hittable, &ray, 0.001, INFINITY, NULL))
+    {
+        return 0.0;
+    }
+
+    double cos_theta_max = sqrt(1 - sphere->radius * sphere->radius / distance_squared);
+    return 1 / (2 * PI * (1 - cos_theta_max));
+}
+
+static void rt_sphere_collect_lights(rt_hittable_t *hittable, rt_hittable_list_t *lights)
+{
+    assert(NULL != hittable);
+    assert(NULL != lights);
+    assert(RT_HITTABLE_TYPE_SPHERE == hittable->type);
+
+    rt_sphere_t *sphere = (rt_sphere_t *)hittable;
+    if (rt_material_is_emissive(sphere->material))
+    {
+        rt_hittable_list_add(lights, rt_hittable_claim(hittable));
+    }
+}
+
 static void rt_sphere_delete(rt_hittable_t *hittable)
 {
     if (NULL == hittable)
@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_ARENA_H
+#define RAY_TRACING_ONE_WEEK_RT_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Reference count of the objects owned by an arena. Claiming or deleting such an object does nothing, it lives exactly
+// as long as its arena.
+#define RT_ARENA_REFCOUNT (-1)
+
+typedef struct rt_arena_s rt_arena_t;
+
+typedef void (*rt_arena_cleanup_fn)(void *data);
+
+// Starts an empty arena that grabs memory from the heap in blocks of block_size bytes (0 picks the default size)
+rt_arena_t *rt_arena_new(size_t block_size);
+
+// Returns zeroed memory aligned to alignment (a power of two) that stays valid until the arena is deleted. Not
+// thread safe, an arena is filled from one thread at a time.
+void *rt_arena_alloc(rt_arena_t *arena, size_t size, size_t alignment);
+
+// Calls fn(data) when the arena is deleted, the last registered cleanup runs first. This is how arena objects let go of
+// resources the arena doesn't own, e.g. image data or references to objects shared with other scenes.
+void rt_arena_add_cleanup(rt_arena_t *arena, rt_arena_cleanup_fn fn, void *data);
+
+// Number of bytes handed out and number of heap blocks behind them
+size_t rt_arena_get_used(const rt_arena_t *arena);
+size_t rt_arena_get_number_of_blocks(const rt_arena_t *arena);
+
+// Runs the cleanups and frees every block at once, without visiting the objects allocated from the arena
+void rt_arena_delete(rt_arena_t *arena);
+
+// Scene objects (hittables, materials, textures and everything they own) are allocated from the current arena, or one
+// by one from the heap when there's none. Objects made while no arena is current are reference counted as usual and
+// may be shared between scenes.
+void rt_arena_set_current(rt_arena_t *arena);
+rt_arena_t *rt_arena_get_current(void);
+
+// Zeroed memory for a scene object: from the current arena if there is one, from the heap otherwise
+void *rt_arena_calloc(size_t size);
+
+#endif // RAY_TRACING_ONE_WEEK_RT_ARENA_H
@@ -15,8 +15,22 @@ typedef struct rt_camera_s rt_camera_t;
 rt_camera_t *rt_camera_new(point3_t look_from, point3_t look_at, vec3_t up, double vertical_fov, double aspect_ratio,
                            double aperture, double focus_distance, double shutter_start_time, double shutter_end_time);
 
+// Position of a camera sample within the lens and the shutter interval, every component is in [0, 1)
+typedef struct rt_camera_sample_s
+{
+    double pixel_x;
+    double pixel_y;
+    double lens_u;
+    double lens_v;
+    double time;
+} rt_camera_sample_t;
+
 ray_t rt_camera_get_ray(const rt_camera_t *camera, double s, double t);
 
+// Same as rt_camera_get_ray but the lens position and the time are taken from the sample instead of being drawn at
+// random. The pixel_x and pixel_y members are ignored, s and t are expected to include them already.
+ray_t rt_camera_get_ray_sampled(const rt_camera_t *camera, double s, double t, const rt_camera_sample_t *sample);
+
 void rt_camera_delete(rt_camera_t *camera);
 
 #endif // RAY_TRACING_ONE_WEEK_RT_CAMERA_H
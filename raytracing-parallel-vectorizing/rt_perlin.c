@@ -5,9 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 #include <assert.h>
+#include "rt_arena.h"
 #include "rt_perlin.h"
 #include "rt_colour.h"
-#include <pthread.h>
 
 struct rt_perlin_s
 {
@@ -25,7 +25,7 @@ static double_t perlin_interpolation(vec3_t c[2][2][2], double u, double v, doub
 
 rt_perlin_t *rt_perlin_new(void)
 {
-    rt_perlin_t *result = calloc(1, sizeof(rt_perlin_t));
+    rt_perlin_t *result = rt_arena_calloc(sizeof(rt_perlin_t));
     assert(NULL != result);
 
     result->tile_size = 255;
@@ -34,7 +34,8 @@ rt_perlin_t *rt_perlin_new(void)
     result->y = generate_permutation(result->tile_size + 1);
     result->z = generate_permutation(result->tile_size + 1);
 
-    result->random_vectors = calloc(result->tile_size, sizeof(vec3_t));
+    // Permutations go up to tile_size inclusive, the last vector is never drawn and stays zero
+    result->random_vectors = rt_arena_calloc((result->tile_size + 1) * sizeof(vec3_t));
     assert(NULL != result->random_vectors);
     for (size_t i = 0; i < result->tile_size; ++i)
     {
@@ -110,7 +111,7 @@ void rt_perlin_delete(rt_perlin_t *perlin)
 
 static int *generate_permutation(size_t size)
 {
-    int *permutation = malloc(sizeof(int) * size);
+    int *permutation = rt_arena_calloc(sizeof(int) * size);
     assert(NULL != permutation);
 
     for (int i = 0; i < size; ++i)
@@ -125,13 +126,11 @@ static int *generate_permutation(size_t size)
 
 static void permutate(int *array, size_t size)
 {
-    static unsigned int dummy=0; if (dummy==0) dummy=pthread_self();
-
     assert(NULL != array);
 
     for (int i = 0; i < size; ++i)
     {
-        int target = i + rand_r(&dummy) % (size - i);
+        int target = i + (int)(rt_random_u32() % (size - i));
         int tmp = array[i];
         array[i] = array[target];
         array[target] = tmp;
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef RAY_TRACING_ONE_WEEK_RT_RANDOM_H
+#define RAY_TRACING_ONE_WEEK_RT_RANDOM_H
+
+#include <stdint.h>
+
+// PCG32 generator state (see https://www.pcg-random.org). inc is always odd once the state is seeded.
+typedef struct rt_random_state_s
+{
+    uint64_t state;
+    uint64_t inc;
+} rt_random_state_t;
+
+// Number of draws at the start of a bounce that may come from a low-discrepancy pattern, and the number of bounces of a
+// path that use one. Enough for a diffuse hit: the scattered direction, the light to sample, the point on it and the
+// Russian roulette.
+#define RT_RANDOM_PATTERN_DIMENSIONS (4)
+#define RT_RANDOM_PATTERN_BOUNCES (2)
+
+// The first draws of the current bounce take points of the unit square from a pattern instead of the generator: the
+// n-th draw made by rt_random_double or rt_random_double_2d after rt_random_begin_bounce gets the n-th point
+// (rt_random_double only uses its first coordinate). count is 0 if there's no pattern for the bounce.
+typedef struct rt_random_dimensions_s
+{
+    uint32_t bounce;
+    uint32_t next;
+    uint32_t count;
+} rt_random_dimensions_t;
+
+// Every thread owns its generator, so the samplers never share a cache line or a sequence
+extern _Thread_local rt_random_state_t rt_random_thread_state;
+extern _Thread_local rt_random_dimensions_t rt_random_thread_dimensions;
+
+// Seeds the calling thread's generator. Streams with different stream ids never overlap.
+void rt_random_seed(uint64_t seed, uint64_t stream);
+
+// Gives the calling thread a fresh stream. Called automatically on the first draw of every thread.
+void rt_random_seed_thread(void);
+
+// Sets the seed of the frame used by rt_random_begin_sample. The calling thread (the one building the scene) is reset to
+// a fixed stream, so the scene stays the same for every seed and only the noise changes.
+void rt_random_set_seed(uint64_t seed);
+
+// Counter-based keying. After rt_random_begin_sample the draws of the calling thread are a pure function of the frame
+// seed, the pixel and the sample index, and rt_random_begin_bounce rekeys them by the bounce as well. As long as the
+// renderer calls these before drawing, the image doesn't depend on the number of threads or on the order pixels are
+// rendered in, and disjoint parts of a frame may be rendered by different processes.
+void rt_random_begin_sample(uint64_t pixel_index, uint32_t sample);
+void rt_random_begin_bounce(uint32_t bounce);
+
+// Point of one dimension of one bounce of one sample of a pixel, a pure function of its arguments
+typedef void (*rt_random_pattern_fn)(const void *pattern, uint64_t pixel_index, uint32_t sample, uint32_t bounce,
+                                     uint32_t dimension, double *u, double *v);
+
+// Makes rt_random_begin_bounce take the first draws of the first RT_RANDOM_PATTERN_BOUNCES bounces from the pattern
+// (see rt_random_dimensions_t). Passing NULL leaves every draw to the generator, which is the default.
+void rt_random_set_pattern(rt_random_pattern_fn fn, const void *pattern);
+
+// Takes the next point of the pattern, only called while rt_random_thread_dimensions has points left
+void rt_random_pattern_point(double *u, double *v);
+
+// Generator of the calling thread together with the pixel and sample its draws are keyed by. Saving and restoring it
+// lets a thread interleave several samples (e.g. the lanes of a ray packet) without changing any of their draws.
+typedef struct rt_random_context_s
+{
+    rt_random_state_t state;
+    rt_random_dimensions_t dimensions;
+    uint64_t pixel_index;
+    uint32_t sample;
+} rt_random_context_t;
+
+void rt_random_save(rt_random_context_t *context);
+void rt_random_restore(const rt_random_context_t *context);
+
+static inline uint32_t rt_random_u32(void)
+{
+    rt_random_state_t *rng = &rt_random_thread_state;
+    if (__builtin_expect(0 == rng->inc, 0))
+    {
+        rt_random_seed_thread();
+    }
+
+    uint64_t old_state = rng->state;
+    rng->state = old_state * 6364136223846793005ULL + rng->inc;
+
+    uint32_t xor_shifted = (uint32_t)(((old_state >> 18u) ^ old_state) >> 27u);
+    uint32_t rotation = (uint32_t)(old_state >> 59u);
+    return (xor_shifted >> rotation) | (xor_shifted << ((-rotation) & 31u));
+}
+
+// splitmix64 finalizer: every input bit affects every output bit. Used to turn indices into seeds.
+static inline uint64_t rt_random_mix64(uint64_t x)
+{
+    x ^= x >> 30u;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27u;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31u;
+    return x;
+}
+
+static inline double rt_random_double(double min, double max)
+{
+    if (rt_random_thread_dimensions.next < rt_random_thread_dimensions.count)
+    {
+        double u, v;
+        rt_random_pattern_point(&u, &v);
+        return min + (max - min) * u;
+    }
+    return min + (max - min) * (rt_random_u32() * (1.0 / 4294967296.0));
+}
+
+// Point of the unit square. Samplers stratify the two coordinates together rather than each on its own, so draws that
+// make one 2D choice (a direction, a point on a light) should take them from here.
+static inline void rt_random_double_2d(double *u, double *v)
+{
+    if (rt_random_thread_dimensions.next < rt_random_thread_dimensions.count)
+    {
+        rt_random_pattern_point(u, v);
+        return;
+    }
+    *u = rt_random_u32() * (1.0 / 4294967296.0);
+    *v = rt_random_u32() * (1.0 / 4294967296.0);
+}
+
+// Number in [0, 1) hashed from the calling thread's generator and the key, the generator doesn't advance. Meant for
+// draws made while intersecting (e.g. inside a participating medium): a query may visit the objects in any order,
+// depending on the BVH layout or on the packet the ray is in, and keyed draws don't change with that order.
+static inline double rt_random_double_keyed(uint64_t key)
+{
+    uint64_t x = rt_random_mix64(rt_random_thread_state.state ^ rt_random_mix64(key));
+    return (double)(x >> 11u) * (1.0 / 9007199254740992.0);
+}
+
+#endif // RAY_TRACING_ONE_WEEK_RT_RANDOM_H
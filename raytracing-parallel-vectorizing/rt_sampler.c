@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rt_sampler.h"
+#include "rt_random.h"
+
+// Camera samples are made of three independent patterns: pixel offset (2D), lens position (2D) and time (1D). They are
+// followed by one 2D pattern for every dimension of every bounce that takes its draws from the sampler.
+typedef enum sample_pattern_e
+{
+    SAMPLE_PATTERN_PIXEL,
+    SAMPLE_PATTERN_LENS,
+    SAMPLE_PATTERN_TIME,
+    SAMPLE_PATTERN_BOUNCE,
+} sample_pattern_t;
+
+typedef void (*rt_sampler_generate_fn)(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                                       rt_camera_sample_t *sample);
+
+struct rt_sampler_s
+{
+    rt_sampler_type_t type;
+    rt_sampler_generate_fn generate;
+    rt_random_pattern_fn bounces;
+    uint64_t seed;
+};
+
+static void random_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                            rt_camera_sample_t *sample);
+static void sobol_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                           rt_camera_sample_t *sample);
+static void r2_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                        rt_camera_sample_t *sample);
+static void sobol_bounce(const void *pattern, uint64_t pixel_index, uint32_t sample_index, uint32_t bounce,
+                         uint32_t dimension, double *u, double *v);
+
+typedef struct rt_samplers_s
+{
+    rt_sampler_type_t type;
+    const char *name;
+    const char *desc;
+    rt_sampler_generate_fn generate;
+    rt_random_pattern_fn bounces;
+} rt_samplers_t;
+
+static rt_samplers_t gs_samplers[] = {
+    {RT_SAMPLER_RANDOM, "random", "Independent uniform random numbers", random_generate, NULL},
+    {RT_SAMPLER_SOBOL, "sobol", "Owen-scrambled Sobol sequence shuffled per pixel, camera and first two bounces",
+     sobol_generate, sobol_bounce},
+    {RT_SAMPLER_R2, "r2", "R2 sequence with a random shift per pixel, camera only", r2_generate, NULL},
+};
+
+rt_sampler_t *rt_sampler_new(rt_sampler_type_t type, uint64_t seed)
+{
+    rt_sampler_t *result = calloc(1, sizeof(rt_sampler_t));
+    assert(NULL != result);
+
+    for (size_t i = 0; i < sizeof(gs_samplers) / sizeof(gs_samplers[0]); ++i)
+    {
+        if (gs_samplers[i].type == type)
+        {
+            result->generate = gs_samplers[i].generate;
+            result->bounces = gs_samplers[i].bounces;
+        }
+    }
+    assert(NULL != result->generate);
+
+    result->type = type;
+    result->seed = seed;
+
+    return result;
+}
+
+void rt_sampler_get_camera_sample(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                                  rt_camera_sample_t *sample)
+{
+    assert(NULL != sampler);
+    assert(NULL != sample);
+
+    sampler->generate(sampler, pixel_index, sample_index, sample);
+}
+
+void rt_sampler_use_for_bounces(const rt_sampler_t *sampler)
+{
+    if (NULL == sampler)
+    {
+        rt_random_set_pattern(NULL, NULL);
+        return;
+    }
+    rt_random_set_pattern(sampler->bounces, sampler);
+}
+
+rt_sampler_type_t rt_sampler_get_type_by_name(const char *name)
+{
+    if (NULL == name)
+    {
+        return RT_SAMPLER_NONE;
+    }
+
+    for (size_t i = 0; i < sizeof(gs_samplers) / sizeof(gs_samplers[0]); ++i)
+    {
+        if (0 == strcmp(gs_samplers[i].name, name))
+        {
+            return gs_samplers[i].type;
+        }
+    }
+
+    return RT_SAMPLER_NONE;
+}
+
+const char *rt_sampler_get_name_by_type(rt_sampler_type_t type)
+{
+    for (size_t i = 0; i < sizeof(gs_samplers) / sizeof(gs_samplers[0]); ++i)
+    {
+        if (gs_samplers[i].type == type)
+        {
+            return gs_samplers[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+void rt_sampler_print_samplers_info(FILE *to)
+{
+    assert(NULL != to);
+
+    for (size_t i = 0; i < sizeof(gs_samplers) / sizeof(gs_samplers[0]); ++i)
+    {
+        fprintf(to, "\t%-30s  %s\n", gs_samplers[i].name, gs_samplers[i].desc);
+    }
+}
+
+void rt_sampler_delete(rt_sampler_t *sampler)
+{
+    free(sampler);
+}
+
+static inline double u32_to_unit(uint32_t x)
+{
+    return x * (1.0 / 4294967296.0);
+}
+
+// Seed of one pattern of one pixel, patterns of the same pixel must be decorrelated from each other
+static inline uint64_t pattern_seed(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t pattern)
+{
+    return rt_random_mix64(rt_random_mix64(sampler->seed ^ rt_random_mix64(pixel_index)) + pattern);
+}
+
+static void random_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                            rt_camera_sample_t *sample)
+{
+    (void)sampler;
+    (void)pixel_index;
+    (void)sample_index;
+
+    // Draws from the calling thread's generator which the renderer keys by the pixel and the sample
+    sample->pixel_x = rt_random_double(0, 1);
+    sample->pixel_y = rt_random_double(0, 1);
+    sample->lens_u = rt_random_double(0, 1);
+    sample->lens_v = rt_random_double(0, 1);
+    sample->time = rt_random_double(0, 1);
+}
+
+/* Sobol sampler. Follows B. Burley, "Practical Hash-based Owen Scrambling" (JCGT, 2020): every pattern uses the first
+ * two Sobol dimensions, with the sample index shuffled and the result Owen-scrambled by seeds of its own. Shuffling
+ * keeps the patterns from correlating with each other without needing higher (worse distributed) dimensions. */
+
+static inline uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1u) & 0x55555555u) | ((x & 0x55555555u) << 1u);
+    x = ((x >> 2u) & 0x33333333u) | ((x & 0x33333333u) << 2u);
+    x = ((x >> 4u) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4u);
+    x = ((x >> 8u) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8u);
+    return (x >> 16u) | (x << 16u);
+}
+
+static inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The first Sobol dimension is the van der Corput sequence in base 2
+static inline uint32_t sobol_dimension_0(uint32_t index)
+{
+    return reverse_bits(index);
+}
+
+// The generator matrix of the second dimension is Pascal's triangle mod 2: bit k of the reversed result is the parity
+// of the bits j of the index with k a subset of j. Five steps sum over the supersets instead of looping over the bits.
+static inline uint32_t sobol_dimension_1(uint32_t index)
+{
+    index ^= (index >> 1u) & 0x55555555u;
+    index ^= (index >> 2u) & 0x33333333u;
+    index ^= (index >> 4u) & 0x0f0f0f0fu;
+    index ^= (index >> 8u) & 0x00ff00ffu;
+    index ^= (index >> 16u) & 0x0000ffffu;
+    return reverse_bits(index);
+}
+
+static void sobol_2d(uint64_t seed, uint32_t sample_index, double *x, double *y)
+{
+    uint32_t index = nested_uniform_scramble(sample_index, (uint32_t)seed);
+    *x = u32_to_unit(nested_uniform_scramble(sobol_dimension_0(index), (uint32_t)(seed >> 32u)));
+    *y = u32_to_unit(nested_uniform_scramble(sobol_dimension_1(index), (uint32_t)rt_random_mix64(seed)));
+}
+
+static void sobol_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                           rt_camera_sample_t *sample)
+{
+    sobol_2d(pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_PIXEL), sample_index, &sample->pixel_x,
+             &sample->pixel_y);
+    sobol_2d(pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_LENS), sample_index, &sample->lens_u, &sample->lens_v);
+
+    uint64_t time_seed = pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_TIME);
+    uint32_t index = nested_uniform_scramble(sample_index, (uint32_t)time_seed);
+    sample->time = u32_to_unit(nested_uniform_scramble(sobol_dimension_0(index), (uint32_t)(time_seed >> 32u)));
+}
+
+static void sobol_bounce(const void *pattern, uint64_t pixel_index, uint32_t sample_index, uint32_t bounce,
+                         uint32_t dimension, double *u, double *v)
+{
+    uint32_t pattern_index = SAMPLE_PATTERN_BOUNCE + bounce * RT_RANDOM_PATTERN_DIMENSIONS + dimension;
+    sobol_2d(pattern_seed(pattern, pixel_index, pattern_index), sample_index, u, v);
+}
+
+/* R2 sampler. Additive recurrence based on the plastic constant (M. Roberts, "The Unreasonable Effectiveness of
+ * Quasirandom Sequences", 2018), the 1D pattern uses the golden ratio. Every pixel shifts the sequence by a random
+ * offset (Cranley-Patterson rotation). All the patterns are the same sequence shifted, so they are correlated with each
+ * other: the bounces are left to the generator. */
+
+#define R2_PLASTIC_CONSTANT 1.32471795724474602596
+#define R1_GOLDEN_RATIO 1.61803398874989484820
+
+static inline double fractional(double x)
+{
+    return x - floor(x);
+}
+
+static void r2_generate(const rt_sampler_t *sampler, uint64_t pixel_index, uint32_t sample_index,
+                        rt_camera_sample_t *sample)
+{
+    const double alpha_x = 1.0 / R2_PLASTIC_CONSTANT;
+    const double alpha_y = 1.0 / (R2_PLASTIC_CONSTANT * R2_PLASTIC_CONSTANT);
+
+    uint64_t seed = pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_PIXEL);
+    sample->pixel_x = fractional(u32_to_unit((uint32_t)seed) + sample_index * alpha_x);
+    sample->pixel_y = fractional(u32_to_unit((uint32_t)(seed >> 32u)) + sample_index * alpha_y);
+
+    seed = pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_LENS);
+    sample->lens_u = fractional(u32_to_unit((uint32_t)seed) + sample_index * alpha_x);
+    sample->lens_v = fractional(u32_to_unit((uint32_t)(seed >> 32u)) + sample_index * alpha_y);
+
+    seed = pattern_seed(sampler, pixel_index, SAMPLE_PATTERN_TIME);
+    sample->time = fractional(u32_to_unit((uint32_t)seed) + sample_index / R1_GOLDEN_RATIO);
+}
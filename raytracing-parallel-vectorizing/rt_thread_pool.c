@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2020, Evgeniy Morozov
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif // __linux__
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rt_thread_pool.h"
+
+#define RT_THREAD_POOL_INITIAL_QUEUE_CAPACITY (64)
+
+typedef struct rt_thread_pool_job_s
+{
+    rt_thread_pool_job_fn fn;
+    void *arg;
+} rt_thread_pool_job_t;
+
+struct rt_thread_pool_s
+{
+    pthread_t *workers;
+    size_t number_of_workers;
+
+    // Ring buffer of queued jobs
+    rt_thread_pool_job_t *queue;
+    size_t queue_head;
+    size_t queue_size;
+    size_t queue_capacity;
+
+    // Number of jobs that are either queued or being executed right now
+    size_t pending;
+    bool shutdown;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t all_done;
+};
+
+static void *worker_loop(void *arg);
+static void queue_grow(rt_thread_pool_t *pool);
+static void pin_worker(pthread_t worker, size_t worker_index);
+static size_t cgroup_cpu_limit(void);
+
+rt_thread_pool_t *rt_thread_pool_new(size_t number_of_workers, bool pin_workers)
+{
+    assert(number_of_workers > 0);
+
+    rt_thread_pool_t *pool = calloc(1, sizeof(rt_thread_pool_t));
+    assert(NULL != pool);
+
+    pool->queue_capacity = RT_THREAD_POOL_INITIAL_QUEUE_CAPACITY;
+    pool->queue = calloc(pool->queue_capacity, sizeof(rt_thread_pool_job_t));
+    assert(NULL != pool->queue);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    pool->workers = calloc(number_of_workers, sizeof(pthread_t));
+    assert(NULL != pool->workers);
+
+    for (size_t i = 0; i < number_of_workers; ++i)
+    {
+        if (0 != pthread_create(&pool->workers[i], NULL, worker_loop, pool))
+        {
+            // Shut down and join the workers that did start
+            pool->number_of_workers = i;
+            rt_thread_pool_delete(pool);
+            return NULL;
+        }
+
+        if (pin_workers)
+        {
+            pin_worker(pool->workers[i], i);
+        }
+    }
+    pool->number_of_workers = number_of_workers;
+
+    return pool;
+}
+
+void rt_thread_pool_submit(rt_thread_pool_t *pool, rt_thread_pool_job_fn job, void *arg)
+{
+    assert(NULL != pool);
+    assert(NULL != job);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queue_size == pool->queue_capacity)
+    {
+        queue_grow(pool);
+    }
+
+    size_t tail = (pool->queue_head + pool->queue_size) % pool->queue_capacity;
+    pool->queue[tail].fn = job;
+    pool->queue[tail].arg = arg;
+    pool->queue_size++;
+    pool->pending++;
+
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void rt_thread_pool_wait(rt_thread_pool_t *pool)
+{
+    assert(NULL != pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t rt_thread_pool_available_cpus(void)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cpus = online > 0 ? (size_t)online : 1;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (0 == sched_getaffinity(0, sizeof(allowed), &allowed) && CPU_COUNT(&allowed) > 0 &&
+        (size_t)CPU_COUNT(&allowed) < cpus)
+    {
+        cpus = CPU_COUNT(&allowed);
+    }
+#endif // __linux__
+
+    size_t quota = cgroup_cpu_limit();
+    if (quota > 0 && quota < cpus)
+    {
+        cpus = quota;
+    }
+
+    return cpus;
+}
+
+size_t rt_thread_pool_get_size(const rt_thread_pool_t *pool)
+{
+    assert(NULL != pool);
+
+    return pool->number_of_workers;
+}
+
+void rt_thread_pool_delete(rt_thread_pool_t *pool)
+{
+    if (NULL == pool)
+    {
+        return;
+    }
+
+    rt_thread_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->number_of_workers; ++i)
+    {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->workers);
+    free(pool->queue);
+    free(pool);
+}
+
+static void *worker_loop(void *arg)
+{
+    rt_thread_pool_t *pool = arg;
+    assert(NULL != pool);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (0 == pool->queue_size && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->has_work, &pool->lock);
+        }
+        if (0 == pool->queue_size && pool->shutdown)
+        {
+            break;
+        }
+
+        rt_thread_pool_job_t job = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->queue_capacity;
+        pool->queue_size--;
+
+        pthread_mutex_unlock(&pool->lock);
+        job.fn(job.arg);
+        pthread_mutex_lock(&pool->lock);
+
+        if (0 == --pool->pending)
+        {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void pin_worker(pthread_t worker, size_t worker_index)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (0 != sched_getaffinity(0, sizeof(allowed), &allowed) || 0 == CPU_COUNT(&allowed))
+    {
+        return;
+    }
+
+    // Pick the (worker_index mod N)-th CPU out of the ones we are allowed to run on
+    size_t target = worker_index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed) && 0 == target--)
+        {
+            cpu_set_t single;
+            CPU_ZERO(&single);
+            CPU_SET(cpu, &single);
+            pthread_setaffinity_np(worker, sizeof(single), &single);
+            return;
+        }
+    }
+#else
+    (void)worker;
+    (void)worker_index;
+#endif // __linux__
+}
+
+// Returns the CPU limit imposed by the cgroup quota rounded up to whole CPUs, 0 if there's no limit
+static size_t cgroup_cpu_limit(void)
+{
+    long long quota = -1, period = 0;
+
+    // cgroup v2: "<quota|max> <period>"
+    FILE *file = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (NULL != file)
+    {
+        if (2 != fscanf(file, "%lld %lld", &quota, &period))
+        {
+            quota = -1; // "max" doesn't parse as a number which also means no limit
+        }
+        fclose(file);
+    }
+    else
+    {
+        // cgroup v1: quota and period live in separate files, quota is -1 when unlimited
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if (NULL != file)
+        {
+            if (1 != fscanf(file, "%lld", &quota))
+            {
+                quota = -1;
+            }
+            fclose(file);
+        }
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (NULL != file)
+        {
+            if (1 != fscanf(file, "%lld", &period))
+            {
+                period = 0;
+            }
+            fclose(file);
+        }
+    }
+
+    if (quota <= 0 || period <= 0)
+    {
+        return 0;
+    }
+    return (size_t)((quota + period - 1) / period);
+}
+
+static void queue_grow(rt_thread_pool_t *pool)
+{
+    size_t new_capacity = pool->queue_capacity * 2;
+    rt_thread_pool_job_t *new_queue = calloc(new_capacity, sizeof(rt_thread_pool_job_t));
+    assert(NULL != new_queue);
+
+    // Unroll the ring buffer so the queue starts at index 0 again
+    for (size_t i = 0; i < pool->queue_size; ++i)
+    {
+        new_queue[i] = pool->queue[(pool->queue_head + i) % pool->queue_capacity];
+    }
+
+    free(pool->queue);
+    pool->queue = new_queue;
+    pool->queue_head = 0;
+    pool->queue_capacity = new_capacity;
+}
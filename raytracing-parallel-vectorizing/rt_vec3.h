@@ -21,88 +21,173 @@ typedef enum vec3_axis_e
     VEC3_AXIS_Z = 2,
 } vec3_axis_t;
 
+// Scalar type of vectors, rays, bounding boxes and matrices. Building with RT_SINGLE_PRECISION (a CMake option) makes
+// it float, which is enough for previews and halves the size of everything built from it. Distances along rays, pdfs
+// and accumulated colours are double either way.
+#ifdef RT_SINGLE_PRECISION
+typedef float rt_real_t;
+#else
+typedef double rt_real_t;
+#endif // RT_SINGLE_PRECISION
+
+// RT_VEC3_SIMD (a CMake option as well, needs RT_SINGLE_PRECISION) keeps a vector in one 16-byte SSE/NEON register,
+// the fourth lane is always 0. Every lane does exactly the operation the scalar code does on its component, so the
+// images don't change.
+#ifdef RT_VEC3_SIMD
+#ifndef RT_SINGLE_PRECISION
+#error "RT_VEC3_SIMD packs vectors into four floats, it needs RT_SINGLE_PRECISION"
+#endif // RT_SINGLE_PRECISION
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#define RT_VEC3_SSE
+typedef __m128 rt_vec3_simd_t;
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RT_VEC3_NEON
+typedef float32x4_t rt_vec3_simd_t;
+#else
+#error "RT_VEC3_SIMD needs SSE or NEON"
+#endif
+#define RT_VEC3_LANES (4)
+#else
+#define RT_VEC3_LANES (3)
+#endif // RT_VEC3_SIMD
+
 union vec3_u
 {
-    double components[3];
+    rt_real_t components[RT_VEC3_LANES];
     struct {
-        double x;
-        double y;
-        double z;
+        rt_real_t x;
+        rt_real_t y;
+        rt_real_t z;
     };
+#ifdef RT_VEC3_SIMD
+    rt_vec3_simd_t simd;
+#endif // RT_VEC3_SIMD
 };
 
 typedef union vec3_u vec3_t;
 
-static inline vec3_t vec3(double x, double y, double z)
+static inline vec3_t vec3(rt_real_t x, rt_real_t y, rt_real_t z)
 {
+    // Initializing x, y and z alone would leave the fourth lane undefined
+#if defined(RT_VEC3_SSE)
+    vec3_t result = {.simd = _mm_set_ps(0.0f, z, y, x)};
+#elif defined(RT_VEC3_NEON)
+    const float lanes[RT_VEC3_LANES] = {x, y, z, 0.0f};
+    vec3_t result = {.simd = vld1q_f32(lanes)};
+#else
     vec3_t result = {.x = x, .y = y, .z = z};
+#endif
     return result;
 }
 
-static inline vec3_t vec3_negate(const vec3_t *v)
+#ifdef RT_VEC3_SIMD
+static inline vec3_t vec3_from_simd(rt_vec3_simd_t simd)
 {
-    return vec3(-v->x, -v->y, -v->z);
+    vec3_t result = {.simd = simd};
+    return result;
 }
+#endif // RT_VEC3_SIMD
 
-static inline void vec3_add(vec3_t *a, vec3_t b)
+static inline vec3_t vec3_sum(vec3_t a, vec3_t b)
 {
-    a->x += b.x;
-    a->y += b.y;
-    a->z += b.z;
+#if defined(RT_VEC3_SSE)
+    return vec3_from_simd(_mm_add_ps(a.simd, b.simd));
+#elif defined(RT_VEC3_NEON)
+    return vec3_from_simd(vaddq_f32(a.simd, b.simd));
+#else
+    return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+#endif
 }
 
-static inline void vec3_sub(vec3_t *a, vec3_t b)
+static inline vec3_t vec3_diff(vec3_t a, vec3_t b)
 {
-    a->x -= b.x;
-    a->y -= b.y;
-    a->z -= b.z;
+#if defined(RT_VEC3_SSE)
+    return vec3_from_simd(_mm_sub_ps(a.simd, b.simd));
+#elif defined(RT_VEC3_NEON)
+    return vec3_from_simd(vsubq_f32(a.simd, b.simd));
+#else
+    return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+#endif
 }
 
-static inline void vec3_scale_in_place(vec3_t *a, double scalar)
+static inline vec3_t vec3_multiply(vec3_t a, vec3_t b)
 {
-    a->x *= scalar;
-    a->y *= scalar;
-    a->z *= scalar;
+#if defined(RT_VEC3_SSE)
+    return vec3_from_simd(_mm_mul_ps(a.simd, b.simd));
+#elif defined(RT_VEC3_NEON)
+    return vec3_from_simd(vmulq_f32(a.simd, b.simd));
+#else
+    return vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+#endif
 }
 
-static inline double vec3_length_squared(vec3_t v)
+static inline vec3_t vec3_scale(vec3_t a, rt_real_t s)
 {
-    return v.x * v.x + v.y * v.y + v.z * v.z;
+#if defined(RT_VEC3_SSE)
+    return vec3_from_simd(_mm_mul_ps(a.simd, _mm_set1_ps(s)));
+#elif defined(RT_VEC3_NEON)
+    return vec3_from_simd(vmulq_n_f32(a.simd, s));
+#else
+    return vec3(a.x * s, a.y * s, a.z * s);
+#endif
 }
 
-static inline double vec3_length(vec3_t v)
+static inline vec3_t vec3_negate(const vec3_t *v)
 {
-    return sqrt(vec3_length_squared(v));
+#if defined(RT_VEC3_SSE)
+    return vec3_from_simd(_mm_xor_ps(v->simd, _mm_set_ps(0.0f, -0.0f, -0.0f, -0.0f)));
+#elif defined(RT_VEC3_NEON)
+    return vec3_from_simd(vsetq_lane_f32(0.0f, vnegq_f32(v->simd), 3));
+#else
+    return vec3(-v->x, -v->y, -v->z);
+#endif
 }
 
-static inline vec3_t vec3_sum(vec3_t a, vec3_t b)
+static inline void vec3_add(vec3_t *a, vec3_t b)
 {
-    return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+    *a = vec3_sum(*a, b);
 }
 
-static inline vec3_t vec3_diff(vec3_t a, vec3_t b)
+static inline void vec3_sub(vec3_t *a, vec3_t b)
 {
-    return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+    *a = vec3_diff(*a, b);
 }
 
-static inline vec3_t vec3_multiply(vec3_t a, vec3_t b)
+static inline void vec3_scale_in_place(vec3_t *a, rt_real_t scalar)
 {
-    return vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+    *a = vec3_scale(*a, scalar);
 }
 
-static inline vec3_t vec3_scale(vec3_t a, double s)
+static inline rt_real_t vec3_dot(vec3_t a, vec3_t b)
 {
-    return vec3(a.x * s, a.y * s, a.z * s);
+    // The products are summed in the same order as in the scalar code
+    vec3_t products = vec3_multiply(a, b);
+    return products.x + products.y + products.z;
+}
+
+static inline rt_real_t vec3_length_squared(vec3_t v)
+{
+    return vec3_dot(v, v);
 }
 
-static inline double vec3_dot(vec3_t a, vec3_t b)
+static inline rt_real_t vec3_length(vec3_t v)
 {
-    return a.x * b.x + a.y * b.y + a.z * b.z;
+    return sqrt(vec3_length_squared(v));
 }
 
 static inline vec3_t vec3_cross(vec3_t a, vec3_t b)
 {
+#if defined(RT_VEC3_SSE)
+    __m128 a_yzx = _mm_shuffle_ps(a.simd, a.simd, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_zxy = _mm_shuffle_ps(b.simd, b.simd, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 a_zxy = _mm_shuffle_ps(a.simd, a.simd, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_yzx = _mm_shuffle_ps(b.simd, b.simd, _MM_SHUFFLE(3, 0, 2, 1));
+    return vec3_from_simd(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+#else
     return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+#endif
 }
 
 static inline vec3_t vec3_normalized(vec3_t a)
@@ -119,7 +204,7 @@ static inline const char *vec3_to_string(vec3_t a, char *buffer, size_t max_buff
     return buffer;
 }
 
-static inline vec3_t vec3_lerp(vec3_t from, vec3_t to, double t)
+static inline vec3_t vec3_lerp(vec3_t from, vec3_t to, rt_real_t t)
 {
     return vec3_sum(vec3_scale(from, 1 - t), vec3_scale(to, t));
 }
@@ -131,8 +216,10 @@ static inline vec3_t vec3_random(double min, double max)
 
 static inline vec3_t vec3_random_unit_vector(void)
 {
-    double a = rt_random_double(0, 2 * PI);
-    double z = rt_random_double(-1, 1);
+    double u, v;
+    rt_random_double_2d(&u, &v);
+    double a = 2 * PI * u;
+    double z = 2 * v - 1;
     double r = sqrt(1 - z * z);
     return vec3(r * cos(a), r * sin(a), z);
 }
@@ -157,28 +244,49 @@ static inline vec3_t vec3_random_in_hemisphere(const vec3_t *n)
     return vec3_negate(&in_unit_sphere);
 }
 
-static inline vec3_t vec3_random_in_unit_disc(void)
+// Maps a point of the unit square onto the unit disc (Shirley-Chiu concentric mapping). The mapping preserves area
+// and adjacency, so uniformly and evenly spread points of the square stay uniform and evenly spread on the disc.
+static inline vec3_t vec3_concentric_disc(double u1, double u2)
 {
-    vec3_t res = vec3(rt_random_double(-1, 1), rt_random_double(-1, 1), 0);
-    if (vec3_length_squared(res) > 1)
+    double a = 2 * u1 - 1;
+    double b = 2 * u2 - 1;
+    if (0 == a && 0 == b)
     {
-        return vec3_normalized(res);
+        return vec3(0, 0, 0);
     }
-    return res;
+
+    double r, phi;
+    if (fabs(a) > fabs(b))
+    {
+        r = a;
+        phi = (PI / 4) * (b / a);
+    }
+    else
+    {
+        r = b;
+        phi = (PI / 2) - (PI / 4) * (a / b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
+static inline vec3_t vec3_random_in_unit_disc(void)
+{
+    double u1 = rt_random_double(0, 1);
+    return vec3_concentric_disc(u1, rt_random_double(0, 1));
 }
 
 static inline vec3_t vec3_reflect(const vec3_t *vec, const vec3_t *n)
 {
-    double scale = 2 * vec3_dot(*vec, *n);
+    rt_real_t scale = 2 * vec3_dot(*vec, *n);
     return vec3_diff(*vec, vec3_scale(*n, scale));
 }
 
-static inline vec3_t vec3_refract(const vec3_t *vec, const vec3_t *n, double r)
+static inline vec3_t vec3_refract(const vec3_t *vec, const vec3_t *n, rt_real_t r)
 {
-    double vec_length = vec3_length(*vec);
-    double c = -vec3_dot(*vec, *n) / vec_length;
+    rt_real_t vec_length = vec3_length(*vec);
+    rt_real_t c = -vec3_dot(*vec, *n) / vec_length;
 
-    double aux = vec_length * (r * c - sqrt(1 - r * r * (1 - c * c)));
+    rt_real_t aux = vec_length * (r * c - sqrt(1 - r * r * (1 - c * c)));
     return vec3_sum(vec3_scale(*vec, r), vec3_scale(*n, aux));
 }
 
@@ -20,12 +20,13 @@ typedef struct rt_texture_image_s
 
 static colour_t rt_texture_image_value(const rt_texture_t *texture, double u, double v, const vec3_t *p);
 static void rt_texture_image_delete(rt_texture_t *texture);
+static void rt_texture_image_free_data(void *data);
 
 rt_texture_t *rt_texture_image_new(const char *filename)
 {
     assert(NULL != filename);
 
-    rt_texture_image_t *result = calloc(1, sizeof(rt_texture_image_t));
+    rt_texture_image_t *result = rt_arena_calloc(sizeof(rt_texture_image_t));
     assert(NULL != result);
 
     int channels_in_file = 3;
@@ -34,6 +35,11 @@ rt_texture_t *rt_texture_image_new(const char *filename)
     {
         fprintf(stderr, "Unable to load texture image '%s'\n", filename);
     }
+    else if (NULL != rt_arena_get_current())
+    {
+        // The texture itself is never deleted when it lives in an arena
+        rt_arena_add_cleanup(rt_arena_get_current(), rt_texture_image_free_data, result->image_data);
+    }
     rt_texture_init(&result->base, RT_TEXTURE_TYPE_IMAGE, rt_texture_image_value, rt_texture_image_delete);
     result->bytes_per_scanline = channels_in_file * result->width;
 
@@ -77,3 +83,8 @@ static void rt_texture_image_delete(rt_texture_t *texture)
     stbi_image_free(img->image_data);
     free(img);
 }
+
+static void rt_texture_image_free_data(void *data)
+{
+    stbi_image_free(data);
+}
@@ -21,7 +21,7 @@ static void rt_texture_noise_delete(rt_texture_t *texture);
 
 rt_texture_t *rt_texture_noise_new(double intensity)
 {
-    rt_texture_noise_t *result = calloc(1, sizeof(rt_texture_noise_t));
+    rt_texture_noise_t *result = rt_arena_calloc(sizeof(rt_texture_noise_t));
     assert(NULL != result);
 
     result->perlin = rt_perlin_new();
@@ -7,6 +7,7 @@
 #ifndef RAY_TRACING_ONE_WEEK_RT_TEXTURE_SHARED_H
 #define RAY_TRACING_ONE_WEEK_RT_TEXTURE_SHARED_H
 
+#include <rt_arena.h>
 #include <rt_texture.h>
 
 typedef enum rt_texture_type_e